@@ -0,0 +1,380 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+
+"""Replay a recorded station session (see src/record.c) at 1x or accelerated speed.
+
+The recorded radio frames are fed through lgwsim and the recorded muxs messages
+through a scripted websocket peer. The replayed station records itself and its
+uplinks and TX decisions are compared with the original session.
+
+Usage: python3 replay.py [--speed N] [--home DIR] [--gps FIFO] [--dump] session.rec [replay.rec]
+
+  --speed N   compress the spacing of recorded inputs by N (default 1)
+  --home DIR  station home directory (station.conf, tc.uri pointing at ws://localhost:6038)
+  --gps FIFO  write recorded NMEA sentences into this FIFO (station.conf gps setting)
+  --dump      just print the records of session.rec
+"""
+
+from typing import Any,Dict,List,Optional,Tuple
+import os
+import sys
+import time
+import json
+import struct
+import bisect
+import asyncio
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('replay')
+
+import tcutils as tu
+import simutils as su
+
+MAGIC   = b'S2RC'
+HDR     = struct.Struct('<4sHHqq')
+
+REC_SESSION, REC_RX, REC_WSRX, REC_WSTX, REC_TIMESYNC, REC_GPS, REC_TIMER, REC_TX = range(8)
+REC_NAMES = ['SESSION','RX','WSRX','WSTX','TIMESYNC','GPS','TIMER','TX']
+RECTX_NAMES = ['PLACED','REJECTED','MISSED','SENT']
+
+RX_FIX = struct.Struct('<qqIBBb')
+TS_FIX = struct.Struct('<Biqqq')
+TM_FIX = struct.Struct('<i')
+TX_FIX = struct.Struct('<BqBBIiB')
+
+# Uplink message types and fields which differ between sessions by nature
+UPLINK_MSGTYPES = ('updf','jreq','propdf','rejoin')
+VOLATILE = ('xtime','rxtime','gpstime','fts','rctx','RefTime','MuxTime')
+BW = { 0:125, 1:250, 2:500 }
+MAX_DNDELAY = 20000000   # us - max RX window offset of a downlink from its uplink (incl. class B/C slack)
+
+
+def varint (data:bytes, off:int) -> Tuple[int,int]:
+    v = s = 0
+    while True:
+        b = data[off]
+        off += 1
+        v |= (b & 0x7F) << s
+        s += 7
+        if not b & 0x80:
+            return v, off
+
+
+def read_record (data:bytes) -> Tuple[Dict[str,Any],List[Dict[str,Any]]]:
+    magic, version, _, ustime, utcoff = HDR.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('Not a station record file')
+    if version != 1:
+        raise ValueError('Unsupported record file version: %d' % version)
+    off = HDR.size
+    t = 0
+    recs = []
+    while off < len(data):
+        rtype = data[off]
+        dt, off = varint(data, off+1)
+        rlen, off = varint(data, off)
+        if off + rlen > len(data):
+            break   # truncated last record (station killed)
+        p = data[off:off+rlen]
+        off += rlen
+        t += dt
+        r = { 't': t, 'type': rtype }   # type: Dict[str,Any]
+        if rtype == REC_RX:
+            xtime, rctx, freq, rps, rssi, snr = RX_FIX.unpack_from(p, 0)
+            r.update(xtime=xtime, rctx=rctx, freq=freq, rps=rps, rssi=-rssi, snr=snr/4.0, frame=p[RX_FIX.size:])
+        elif rtype in (REC_SESSION, REC_WSRX, REC_WSTX):
+            r['msg'] = json.loads(p.decode('utf-8'))
+        elif rtype == REC_GPS:
+            r['line'] = p
+        elif rtype == REC_TIMESYNC:
+            r.update(zip(('txunit','quality','ustime','xtime','pps_xtime'), TS_FIX.unpack_from(p, 0)))
+        elif rtype == REC_TIMER:
+            r['cb'] = TM_FIX.unpack_from(p, 0)[0]
+        elif rtype == REC_TX:
+            r.update(zip(('what','diid','txunit','dr','freq','lead','len'), TX_FIX.unpack_from(p, 0)))
+        recs.append(r)
+    return { 'ustime': ustime, 'utcOffset': utcoff }, recs
+
+
+def normalize (msg:Any) -> Any:
+    if isinstance(msg, dict):
+        return { k:normalize(v) for k,v in msg.items() if k not in VOLATILE }
+    if isinstance(msg, list):
+        return [ normalize(v) for v in msg ]
+    return msg
+
+
+def uplink_key (msg:Dict[str,Any]) -> Tuple:
+    return (msg.get('msgtype'), msg.get('DevEui', msg.get('DevAddr')), msg.get('FCnt', msg.get('DevNonce')), msg.get('MIC'))
+
+
+def uplinks (recs:List[Dict[str,Any]]) -> List[Dict[str,Any]]:
+    return [ r['msg'] for r in recs if r['type'] == REC_WSTX and r['msg'].get('msgtype') in UPLINK_MSGTYPES ]
+
+
+def txdecisions (recs:List[Dict[str,Any]]) -> List[Tuple[int,str]]:
+    return [ (r['diid'], RECTX_NAMES[r['what']]) for r in recs if r['type'] == REC_TX ]
+
+
+def compare (orig:List[Dict[str,Any]], replay:List[Dict[str,Any]]) -> int:
+    mismatches = 0
+    o_up = { uplink_key(m):normalize(m) for m in uplinks(orig) }
+    r_up = { uplink_key(m):normalize(m) for m in uplinks(replay) }
+    for k in sorted(o_up.keys() - r_up.keys(), key=str):
+        print('MISSING uplink: %r' % (k,))
+        mismatches += 1
+    for k in sorted(r_up.keys() - o_up.keys(), key=str):
+        print('EXTRA   uplink: %r' % (k,))
+        mismatches += 1
+    for k in sorted(o_up.keys() & r_up.keys(), key=str):
+        if o_up[k] != r_up[k]:
+            print('DIFF    uplink: %r\n  orig  : %s\n  replay: %s' % (k, json.dumps(o_up[k]), json.dumps(r_up[k])))
+            mismatches += 1
+    o_tx = txdecisions(orig)
+    r_tx = txdecisions(replay)
+    if o_tx != r_tx:
+        o_set, r_set = set(o_tx), set(r_tx)
+        for d in o_tx:
+            if d not in r_set:
+                print('MISSING TX decision: diid=%d %s' % d)
+                mismatches += 1
+        for d in r_tx:
+            if d not in o_set:
+                print('EXTRA   TX decision: diid=%d %s' % d)
+                mismatches += 1
+    print('Compared %d/%d uplinks, %d/%d TX decisions: %d mismatches' %
+          (len(o_up), len(r_up), len(o_tx), len(r_tx), mismatches))
+    return mismatches
+
+
+def percentiles (v:List[float]) -> str:
+    if not v:
+        return 'n/a'
+    v = sorted(v)
+    pct = lambda p: v[min(len(v)-1, int(p*len(v)))]
+    return 'n=%d p50=%.1fms p99=%.1fms max=%.1fms' % (len(v), pct(0.5)*1e3, pct(0.99)*1e3, v[-1]*1e3)
+
+
+class Replay:
+    """Drives one replay of a recorded session through lgwsim and a muxs peer."""
+
+    def __init__(self, recs:List[Dict[str,Any]], speed:float=1.0, gps:Optional[str]=None) -> None:
+        self.recs = recs
+        self.speed = speed
+        self.gps = gps
+        self.gpsf = None
+        self.xtimes = {}        # type: Dict[int,int]   recorded -> replayed uplink xtime
+        self.sent = {}          # type: Dict[bytes,float] frame -> send time
+        self.uplat = []         # type: List[float]
+        self.dnlate = 0
+        self.done = asyncio.get_event_loop().create_future()
+        # The session starts with the first router_config - earlier inputs are not replayable
+        rc = [ r for r in recs if r['type'] == REC_WSRX and r['msg'].get('msgtype') == 'router_config' ]
+        if not rc:
+            raise ValueError('Recording does not contain a muxs session')
+        self.router_config = rc[0]['msg']
+        self.t0 = rc[0]['t']
+        # Map recorded radio xtime to the recorded uplink message which reported it
+        self.upkeys = { m['upinfo']['xtime']:uplink_key(m) for m in uplinks(recs) if 'upinfo' in m }
+        self.upxtimes = sorted(self.upkeys)
+        self.newxtime = {}      # type: Dict[Tuple,int]
+        self.upevent = asyncio.Event()
+
+    def at (self, r:Dict[str,Any]) -> float:
+        return self.start + (r['t'] - self.t0) / 1e6 / self.speed
+
+    async def run (self, lgwsim:su.LgwSim, ws) -> None:
+        self.start = time.monotonic()
+        last = self.t0
+        for r in self.recs:
+            if r['t'] <= self.t0 or r['type'] not in (REC_RX, REC_WSRX, REC_GPS):
+                continue
+            delay = self.at(r) - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            if r['type'] == REC_RX:
+                await self.send_rx(lgwsim, r)
+            elif r['type'] == REC_WSRX:
+                await self.send_msg(ws, r['msg'])
+            elif r['type'] == REC_GPS and self.gps:
+                if self.gpsf is None:
+                    self.gpsf = open(self.gps, 'wb', buffering=0)
+                self.gpsf.write(r['line'])
+            last = r['t']
+        # Let the station finish pending TX of the recorded tail
+        await asyncio.sleep((self.recs[-1]['t'] - last) / 1e6 / self.speed + 1.0)
+        self.done.set_result(True)
+
+    async def send_rx (self, lgwsim:su.LgwSim, r:Dict[str,Any]) -> None:
+        rps = r['rps']
+        if rps & 7 > 5:
+            logger.warning('FSK frame at t=%.3fs not replayable - skipped', r['t']/1e6)
+            return
+        self.sent[r['frame']] = time.monotonic()
+        await lgwsim.send_rx(rps=(12-(rps & 7), BW[(rps>>3)&3]), freq=r['freq']/1e6,
+                             frame=r['frame'], rssi=r['rssi'], snr=r['snr'])
+
+    async def send_msg (self, ws, msg:Dict[str,Any]) -> None:
+        mt = msg.get('msgtype')
+        if mt in ('router_config', 'timesync'):
+            return   # router_config sent on connect - timesync answered live
+        if mt in ('dnmsg','dnframe') and 'xtime' in msg:
+            # Downlinks are timed relative to the xtime of the uplink they answer
+            i = bisect.bisect_right(self.upxtimes, msg['xtime']) - 1
+            key = self.upkeys[self.upxtimes[i]] if i >= 0 and msg['xtime'] - self.upxtimes[i] < MAX_DNDELAY else None
+            if key is None:
+                logger.warning('%s diid=%s does not refer to a recorded uplink - sent as is', mt, msg.get('diid'))
+            else:
+                # Anchor the downlink to the replayed uplink - wait for it if necessary
+                deadline = time.monotonic() + 1.0
+                while key not in self.newxtime and time.monotonic() < deadline:
+                    self.upevent.clear()
+                    try:
+                        await asyncio.wait_for(self.upevent.wait(), deadline - time.monotonic())
+                    except asyncio.TimeoutError:
+                        pass
+                if key not in self.newxtime:
+                    logger.warning('%s diid=%s - uplink %r not replayed', mt, msg.get('diid'), key)
+                    self.dnlate += 1
+                else:
+                    msg = { **msg, 'xtime': self.newxtime[key] + msg['xtime'] - self.upxtimes[i] }
+        if 'MuxTime' in msg:
+            msg = { **msg, 'MuxTime': time.time() }
+        await ws.send(json.dumps(msg))
+
+    def on_uplink (self, msg:Dict[str,Any], frame:Optional[bytes]=None) -> None:
+        if 'upinfo' in msg:
+            self.newxtime[uplink_key(msg)] = msg['upinfo']['xtime']
+            self.upevent.set()
+        t = self.sent.pop(frame, None) if frame else None
+        if t is not None:
+            self.uplat.append(time.monotonic() - t)
+
+
+class ReplaySim(su.LgwSimServer):
+    async def on_close(self):
+        pass
+
+
+class ReplayMuxs(tu.Muxs):
+    def __init__(self, replay:Replay, sim:su.LgwSimServer) -> None:
+        super().__init__()
+        self.replay = replay
+        self.sim = sim
+
+    def get_router_config(self):
+        return { **self.replay.router_config, 'MuxTime': time.time() }
+
+    async def handle_connection(self, ws):
+        while 0 not in self.sim.units:
+            await asyncio.sleep(0.05)
+        asyncio.ensure_future(self.replay.run(self.sim.units[0], ws))
+        await super().handle_connection(ws)
+
+    async def handle_uplink (self, ws, msg):
+        self.replay.on_uplink(msg, self.frame_of(msg))
+
+    handle_updf = handle_jreq = handle_propdf = handle_rejoin = handle_uplink
+
+    def frame_of (self, msg:Dict[str,Any]) -> Optional[bytes]:
+        # Recover the raw frame to measure radio->muxs latency
+        for f in self.replay.sent:
+            if f[-4:] == struct.pack('<i', msg.get('MIC', 0)):
+                return f
+        return None
+
+
+async def replay_session (recfile:str, outfile:str, speed:float, home:str, gps:Optional[str], station_bin:str) -> int:
+    with open(recfile, 'rb') as f:
+        _, orig = read_record(f.read())
+    replay = Replay(orig, speed, gps)
+    infos = tu.Infos()
+    sim = ReplaySim(os.path.join(home, 'spidev'))
+    muxs = ReplayMuxs(replay, sim)
+    await infos.start_server()
+    await muxs.start_server()
+    await sim.start_server()
+    env = { **os.environ, 'RECORD_FILE': os.path.abspath(outfile) }
+    station = await subprocess.create_subprocess_exec(station_bin, '-p', '--home', '.', '--temp', '.', cwd=home, env=env)
+    t = time.monotonic()
+    await replay.done
+    wall = time.monotonic() - t
+    station.terminate()
+    await station.wait()
+    sim.close()
+    with open(outfile, 'rb') as f:
+        _, rerun = read_record(f.read())
+    span = (orig[-1]['t'] - replay.t0) / 1e6
+    print('Replayed %.1fs of session in %.1fs (%.1fx)' % (span, wall, span/wall if wall else 0))
+    print('Uplink latency radio->muxs: %s' % percentiles(replay.uplat))
+    if replay.dnlate:
+        print('Downlinks without replayed uplink: %d' % replay.dnlate)
+    return compare(orig, rerun) + replay.dnlate
+
+
+def dump (recfile:str) -> None:
+    with open(recfile, 'rb') as f:
+        hdr, recs = read_record(f.read())
+    print('# utcOffset=%d records=%d' % (hdr['utcOffset'], len(recs)))
+    for r in recs:
+        d = { k:v for k,v in r.items() if k not in ('t','type') }
+        if 'frame' in d:
+            d['frame'] = d['frame'].hex()
+        if 'what' in d:
+            d['what'] = RECTX_NAMES[d['what']]
+        print('%12.6f %-8s %s' % (r['t']/1e6, REC_NAMES[r['type']], d))
+
+
+def main (argv:List[str]) -> int:
+    speed, home, gps, args = 1.0, '.', None, []
+    it = iter(argv[1:])
+    for a in it:
+        if a == '--speed':
+            speed = float(next(it))
+        elif a == '--home':
+            home = next(it)
+        elif a == '--gps':
+            gps = next(it)
+        elif a == '--dump':
+            args.insert(0, a)
+        else:
+            args.append(a)
+    if args and args[0] == '--dump' and len(args) == 2:
+        dump(args[1])
+        return 0
+    if len(args) not in (1,2) or speed <= 0:
+        print(__doc__, file=sys.stderr)
+        return 1
+    outfile = args[1] if len(args) > 1 else 'replay.rec'
+    station_bin = os.environ.get('STATION', 'station')
+    loop = asyncio.get_event_loop()
+    mismatches = loop.run_until_complete(replay_session(args[0], outfile, speed, home, gps, station_bin))
+    return 1 if mismatches else 0
+
+
+if __name__ == '__main__':
+    logging.basicConfig(level=logging.INFO)
+    sys.exit(main(sys.argv))
@@ -326,11 +326,15 @@ class LgwSim:
         await self.server.on_close()
         self.server.units.pop(self.unitIdx,None)
 
-    async def send_rx(self, rps:Tuple[int,int], freq=869.515, rxtime=None, frame=b''):
+    async def send_rx(self, rps:Tuple[int,int], freq=869.515, rxtime=None, frame=b'', rssi=None, snr=None):
         pkt = {
             'freq_hz': int(freq*1e6),
             'payload': frame
         }
+        if rssi is not None:
+            pkt['rssi'] = float(rssi)
+        if snr is not None:
+            pkt['snr'] = pkt['snr_min'] = pkt['snr_max'] = float(snr)
         self.hal.add_rps(pkt, rps)
         p = self.hal.pack_pkt_rx(pkt, rxtime or self.xticks())
         self.writer.write(p)
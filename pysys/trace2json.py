@@ -0,0 +1,105 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+"""Convert a station trace dump (see src/trace.c) into Chrome trace JSON.
+
+The output can be loaded into chrome://tracing or https://ui.perfetto.dev.
+Trace points named *_BEG/*_END become slices, all others instant events.
+
+Usage: python3 trace2json.py station.trace [out.json]
+"""
+
+from typing import Any,Dict,List,Tuple
+import json
+import struct
+import sys
+
+MAGIC   = b'STRC'
+HDR     = struct.Struct('=4sHHIIq')
+REC     = struct.Struct('=qIHH')
+
+
+def read_trace (data:bytes) -> Tuple[Dict[str,Any],List[str],List[Tuple[int,int,int]]]:
+    magic, version, nnames, nrecs, lost, utcoff = HDR.unpack_from(data, 0)
+    if magic != MAGIC:
+        raise ValueError('Not a station trace dump')
+    if version != 1:
+        raise ValueError('Unsupported trace dump version: %d' % version)
+    off = HDR.size
+    names = []
+    for _ in range(nnames):
+        end = data.index(b'\0', off)
+        names.append(data[off:end].decode('ascii'))
+        off = end+1
+    recs = []
+    for i in range(nrecs):
+        ts, arg, tid, _ = REC.unpack_from(data, off + i*REC.size)
+        recs.append((ts, tid, arg))
+    hdr = { 'nrecs': nrecs, 'lost': lost, 'utcOffset': utcoff }
+    return hdr, names, recs
+
+
+def to_chrome (hdr:Dict[str,Any], names:List[str], recs:List[Tuple[int,int,int]]) -> Dict[str,Any]:
+    events = []
+    open_slices = {}   # type: Dict[str,int]
+    for ts, tid, arg in recs:
+        name = names[tid] if tid < len(names) else 'ID%d' % tid
+        ev = { 'ts': ts, 'pid': 1, 'tid': 1, 'args': { 'arg': arg } }
+        if name.endswith('_BEG'):
+            ev.update(name=name[:-4], ph='B')
+            open_slices[name[:-4]] = open_slices.get(name[:-4], 0) + 1
+        elif name.endswith('_END'):
+            if not open_slices.get(name[:-4]):
+                continue   # start of slice was overwritten in the ring
+            ev.update(name=name[:-4], ph='E')
+            open_slices[name[:-4]] -= 1
+        else:
+            ev.update(name=name, ph='i', s='t')
+        ev['cat'] = name.split('_')[0]
+        events.append(ev)
+    events.append({ 'name': 'process_name', 'ph': 'M', 'pid': 1, 'args': { 'name': 'station' } })
+    return { 'traceEvents': events, 'displayTimeUnit': 'ms',
+             'otherData': { 'lost': hdr['lost'], 'utcOffset': hdr['utcOffset'] } }
+
+
+def main (argv:List[str]) -> int:
+    if len(argv) < 2:
+        print(__doc__, file=sys.stderr)
+        return 1
+    with open(argv[1], 'rb') as f:
+        hdr, names, recs = read_trace(f.read())
+    out = json.dumps(to_chrome(hdr, names, recs))
+    if len(argv) > 2:
+        with open(argv[2], 'w') as f:
+            f.write(out)
+    else:
+        print(out)
+    print('%d records (%d lost)' % (hdr['nrecs'], hdr['lost']), file=sys.stderr)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
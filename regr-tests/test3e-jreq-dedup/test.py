@@ -0,0 +1,137 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+import os
+import sys
+import time
+import json
+import struct
+import asyncio
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('test3e-jreq-dedup')
+
+import tcutils as tu
+import simutils as su
+import testutils as tstu
+
+
+station = None
+infos = None
+muxs = None
+sim = None
+
+# Mass rejoin after a power outage: every device sends the same join request
+# several times (retransmissions on different channels/DRs).
+DEVICES = 40
+COPIES  = 5
+UPFREQS = [ch[0]/1e6 for ch in tu.router_config_EU863_6ch['upchannels']]
+
+
+def makeJR(joineui=1, deveui=1, devnonce=0, mic=1):
+    return struct.pack('<BQQHi', su.FrmType.JREQ, joineui, deveui, devnonce, mic)
+
+
+class TestLgwSimServer(su.LgwSimServer):
+    sent = 0
+
+    async def send_flood(self):
+        lgwsim = self.units[0]
+        for c in range(COPIES):
+            for d in range(DEVICES):
+                freq = UPFREQS[(d+c) % len(UPFREQS)]
+                await lgwsim.send_rx(rps=(7+c%3,125), freq=freq, frame=makeJR(deveui=0x1000+d, devnonce=d))
+                self.sent += 1
+            await asyncio.sleep(0.5)
+
+
+class TestMuxs(tu.Muxs):
+    jreqs = {}
+    send_task = None
+
+    def get_router_config(self):
+        return { **self.router_config, 'MuxTime': time.time(),
+                 'jreq_dedup': { 'window': 10.0, 'entries': 64 } }
+
+    async def handle_connection(self, ws):
+        self.send_task = asyncio.ensure_future(self.run_flood())
+        await super().handle_connection(ws)
+
+    async def handle_jreq(self, ws, msg):
+        deveui = msg['DevEui']
+        self.jreqs[deveui] = self.jreqs.get(deveui, 0) + 1
+
+    async def testDone(self, status):
+        global station
+        if station:
+            station.terminate()
+            await station.wait()
+            station = None
+        os._exit(status)
+
+    async def run_flood(self):
+        try:
+            await asyncio.sleep(2.0)
+            await sim.send_flood()
+            await asyncio.sleep(2.0)
+            rcvd = sum(self.jreqs.values())
+            logger.info('Join requests: sent=%d forwarded=%d devices=%d - reduction %.1f%%',
+                        sim.sent, rcvd, len(self.jreqs), 100.0*(sim.sent-rcvd)/sim.sent)
+            if len(self.jreqs) != DEVICES:
+                logger.error('Missing join requests: %d of %d devices seen', len(self.jreqs), DEVICES)
+                await self.testDone(1)
+            dups = { k:v for k,v in self.jreqs.items() if v != 1 }
+            if dups:
+                logger.error('Duplicate join requests forwarded: %r', dups)
+                await self.testDone(1)
+            await self.testDone(0)
+        except Exception as exc:
+            logger.error('run_flood failed: %s', exc, exc_info=True)
+            await self.testDone(1)
+
+
+with open("tc.uri","w") as f:
+    f.write('ws://localhost:6038')
+
+async def test_start():
+    global station, infos, muxs, sim
+    infos = tu.Infos()
+    muxs = TestMuxs()
+    sim = TestLgwSimServer()
+
+    await infos.start_server()
+    await muxs.start_server()
+    await sim.start_server()
+
+    # 'valgrind', '--leak-check=full',
+    station_args = ['station','-p', '--temp', '.']
+    station = await subprocess.create_subprocess_exec(*station_args)
+
+tstu.setup_logging()
+
+asyncio.ensure_future(test_start())
+asyncio.get_event_loop().run_forever()
@@ -0,0 +1,169 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Pipelined TX: frames spaced by less than TX_MIN_GAP (10ms) on the same antenna
+# must all go out at their requested times if TX_PIPELINE_GAP is configured.
+
+import os
+import sys
+import time
+import json
+import asyncio
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('test3f-txpipe')
+
+import tcutils as tu
+import simutils as su
+import testutils as tstu
+
+
+station = None
+infos = None
+muxs = None
+sim = None
+
+NFRAMES = 8
+PLEN    = 20
+GAP     = 5000      # us - below TX_MIN_GAP, above TX_PIPELINE_GAP
+
+
+def airtime(sf:int, bw:int, plen:int, crc:bool=False, preamble:int=8) -> int:
+    # Same as _calcAirTime in s2e.c (LoRa, CR 4/5, explicit header)
+    bwi = {125:0, 250:1, 500:2}[bw]
+    sfx = 4*sf
+    q = sfx - (8 if sf >= 11 and bwi == 0 else 0)
+    tmp = 8*plen - sfx + 28 + (16 if crc else 0)
+    tmp = (tmp + q - 1) // q * 5 + 8 if tmp > 0 else 8
+    tmp = (tmp << 2) + 17 + 4*preamble
+    sfx = sf - 5 - bwi
+    div = 15625
+    if sfx > 4:
+        div >>= sfx-4
+        sfx = 4
+    return ((tmp << sfx) * 1000000 + div//2) // div
+
+
+class TestLgwSimServer(su.LgwSimServer):
+    updf_task = None
+    txtimes = []
+
+    async def on_connected(self, lgwsim:su.LgwSim) -> None:
+        self.updf_task = asyncio.ensure_future(self.send_updf())
+
+    async def on_close(self):
+        if self.updf_task:
+            self.updf_task.cancel()
+            self.updf_task = None
+        logger.debug('LGWSIM - close')
+
+    async def on_tx(self, lgwsim, pkt):
+        logger.debug('LGWSIM: TX count_us=%d size=%d', pkt['count_us'], pkt['size'])
+        self.txtimes.append(pkt['count_us'])
+
+    async def send_updf(self) -> None:
+        try:
+            # Give station time to sync time with the radio
+            await asyncio.sleep(3.0)
+            lgwsim = self.units[0]
+            await lgwsim.send_rx(rps=(7,125), freq=869.525, frame=su.makeDF(fcnt=0, port=1))
+        except asyncio.CancelledError:
+            pass
+        except Exception as exc:
+            logger.error('send_updf failed!', exc_info=True)
+
+
+class TestMuxs(tu.Muxs):
+    planned = None
+
+    async def testDone(self, status):
+        global station
+        if station:
+            station.terminate()
+            await station.wait()
+            station = None
+        os._exit(status)
+
+    async def handle_updf(self, ws, msg):
+        if self.planned is not None:
+            return
+        upinfo = msg['upinfo']
+        spacing = airtime(7, 125, PLEN) + GAP
+        self.planned = []
+        for k in range(NFRAMES):
+            xtime = upinfo['xtime'] + k*spacing
+            self.planned.append((xtime + 1000000) & 0xFFFFFFFF)
+            dnframe = {
+                'msgtype' : 'dnmsg',
+                'dC'      : 0,
+                'dnmode'  : 'updn',
+                'priority': 0,
+                'RxDelay' : 1,
+                'RX1DR'   : msg['DR'],
+                'RX1Freq' : msg['Freq'],
+                'DevEui'  : '00-00-00-00-11-00-00-01',
+                'xtime'   : xtime,
+                'seqno'   : k,
+                'MuxTime' : time.time(),
+                'rctx'    : upinfo['rctx'],
+                'pdu'     : bytes(range(PLEN)).hex(),
+            }
+            await ws.send(json.dumps(dnframe))
+        asyncio.ensure_future(self.check())
+
+    async def check(self):
+        await asyncio.sleep(3.0)
+        txtimes = sim.txtimes
+        at = airtime(7, 125, PLEN)
+        gaps = [ ((b - a) & 0xFFFFFFFF) - at for a,b in zip(txtimes, txtimes[1:]) ]
+        logger.info('TX pipelining: %d of %d frames sent - gaps: %r us', len(txtimes), NFRAMES, gaps)
+        if txtimes != self.planned:
+            logger.error('Expected TX at %r\n  but got %r', self.planned, txtimes)
+            await self.testDone(1)
+        await self.testDone(0)
+
+
+with open("tc.uri","w") as f:
+    f.write('ws://localhost:6038')
+
+async def test_start():
+    global station, infos, muxs, sim
+    infos = tu.Infos()
+    muxs = TestMuxs()
+    sim = TestLgwSimServer()
+
+    await infos.start_server()
+    await muxs.start_server()
+    await sim.start_server()
+
+    station_args = ['station','-p', '--temp', '.']
+    station = await subprocess.create_subprocess_exec(*station_args)
+
+tstu.setup_logging()
+
+asyncio.ensure_future(test_start())
+asyncio.get_event_loop().run_forever()
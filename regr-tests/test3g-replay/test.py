@@ -0,0 +1,133 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+
+import os
+import sys
+import time
+import json
+import asyncio
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('test3g-replay')
+
+import tcutils as tu
+import simutils as su
+import testutils as tstu
+
+
+station = None
+infos = None
+muxs = None
+sim = None
+
+# Recording side of the test - station runs with RECORD_FILE set (see test.sh).
+# Every uplink is answered with a downlink in RX1 and the session ends when all
+# of them have been sent. test.sh then replays the recording with pysys/replay.py.
+UPLINKS = 8
+
+
+class TestLgwSimServer(su.LgwSimServer):
+    updf_task = None
+
+    async def on_connected(self, lgwsim:su.LgwSim) -> None:
+        self.updf_task = asyncio.ensure_future(self.send_updf())
+
+    async def on_close(self):
+        if self.updf_task:
+            self.updf_task.cancel()
+            self.updf_task = None
+
+    async def send_updf(self) -> None:
+        try:
+            await asyncio.sleep(2.0)
+            for fcnt in range(UPLINKS):
+                lgwsim = self.units[0]
+                await lgwsim.send_rx(rps=(7+fcnt%3,125), freq=869.525, frame=su.makeDF(fcnt=fcnt, port=1, mic=0x100+fcnt),
+                                     rssi=-40-fcnt, snr=10.0-fcnt/4)
+                await asyncio.sleep(1.5)
+        except asyncio.CancelledError:
+            pass
+        except Exception as exc:
+            logger.error('send_updf failed!', exc_info=True)
+
+
+class TestMuxs(tu.Muxs):
+    dntxed = 0
+
+    async def testDone(self, status):
+        global station
+        if station:
+            station.terminate()
+            await station.wait()
+            station = None
+        os._exit(status)
+
+    async def handle_updf(self, ws, msg):
+        fcnt = msg['FCnt']
+        dnframe = {
+            'msgtype': 'dnframe',
+            'DR'     : msg['DR'],
+            'Freq'   : msg['Freq'],
+            'DevEui' : '00-00-00-00-11-00-00-01',
+            'xtime'  : msg['upinfo']['xtime']+1000000,
+            'seqno'  : fcnt,
+            'MuxTime': time.time(),
+            'rctx'   : msg['upinfo']['rctx'],
+            'pdu'    : '0A0B0C0D0E0F',
+        }
+        await ws.send(json.dumps(dnframe))
+
+    async def handle_dntxed(self, ws, msg):
+        self.dntxed += 1
+        if self.dntxed == UPLINKS:
+            await asyncio.sleep(0.5)
+            await self.testDone(0 if os.path.getsize('session.rec') > 0 else 1)
+
+
+with open("tc.uri","w") as f:
+    f.write('ws://localhost:6038')
+
+async def test_start():
+    global station, infos, muxs, sim
+    infos = tu.Infos()
+    muxs = TestMuxs()
+    sim = TestLgwSimServer()
+
+    await infos.start_server()
+    await muxs.start_server()
+    await sim.start_server()
+
+    station_args = ['station','-p', '--temp', '.']
+    station = await subprocess.create_subprocess_exec(*station_args)
+
+    await asyncio.sleep(30)
+    logger.error('Recording session did not complete')
+    await muxs.testDone(1)
+
+tstu.setup_logging()
+
+asyncio.ensure_future(test_start())
+asyncio.get_event_loop().run_forever()
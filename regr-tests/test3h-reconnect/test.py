@@ -0,0 +1,177 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+# Downlinks admitted before a muxs connection drops must still be sent, both
+# while station is disconnected and after it has reconnected. Uplinks received
+# during the outage are buffered and delivered once the connection is back.
+# Each round the muxs answers two fresh uplinks and then closes the connection:
+#  - one downlink in RX1 after 1s - TX while disconnected
+#  - one downlink after station has reconnected (backoff pinned to 2s)
+
+import os
+import sys
+import time
+import json
+import asyncio
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('test3h-reconnect')
+
+import tcutils as tu
+import simutils as su
+import testutils as tstu
+
+
+station = None
+infos = None
+muxs = None
+sim = None
+
+ROUNDS = 3
+UPINTV = 0.5        # s between simulated uplinks
+
+
+class TestLgwSimServer(su.LgwSimServer):
+    updf_task = None
+    fcnt = -1       # last uplink sent
+    txseqnos = []
+
+    async def on_connected(self, lgwsim:su.LgwSim) -> None:
+        # Radio might be reconnected if station restarts it - keep one uplink source
+        if self.updf_task is None:
+            self.updf_task = asyncio.ensure_future(self.send_updf())
+
+    async def on_tx(self, lgwsim, pkt):
+        logger.debug('LGWSIM: TX count_us=%d size=%d', pkt['count_us'], pkt['size'])
+        self.txseqnos.append(pkt['payload'][0])
+
+    async def send_updf(self) -> None:
+        try:
+            # Give station time to sync time with the radio
+            await asyncio.sleep(3.0)
+            while True:
+                lgwsim = self.units.get(0)
+                if lgwsim:
+                    self.fcnt += 1
+                    await lgwsim.send_rx(rps=(7,125), freq=869.525, frame=su.makeDF(fcnt=self.fcnt, port=1))
+                await asyncio.sleep(UPINTV)
+        except asyncio.CancelledError:
+            pass
+        except Exception as exc:
+            logger.error('send_updf failed!', exc_info=True)
+
+
+class TestMuxs(tu.Muxs):
+    rounds = 0
+    replies = 0
+    seqno = 0
+    planned = []
+    upfcnts = set()
+
+    async def testDone(self, status):
+        global station
+        if station:
+            station.terminate()
+            await station.wait()
+            station = None
+        os._exit(status)
+
+    async def handle_connection(self, ws):
+        self.replies = 0
+        if self.rounds == ROUNDS:
+            asyncio.ensure_future(self.check())
+        await super().handle_connection(ws)
+
+    async def handle_updf(self, ws, msg):
+        fcnt = msg['FCnt']
+        self.upfcnts.add(fcnt)
+        # Only answer fresh uplinks - not the ones buffered during an outage
+        if self.rounds == ROUNDS or fcnt != sim.fcnt:
+            return
+        rxdelay = 1 if self.replies == 0 else min(15, (1 << self.rounds) + 3)
+        dnmsg = {
+            'msgtype' : 'dnmsg',
+            'dC'      : 0,
+            'dnmode'  : 'updn',
+            'priority': 0,
+            'RxDelay' : rxdelay,
+            'RX1DR'   : msg['DR'],
+            'RX1Freq' : msg['Freq'],
+            'DevEui'  : '00-00-00-00-11-00-00-01',
+            'xtime'   : msg['upinfo']['xtime'],
+            'seqno'   : self.seqno,
+            'MuxTime' : time.time(),
+            'rctx'    : msg['upinfo']['rctx'],
+            'pdu'     : bytes([self.seqno]*12).hex(),
+        }
+        self.planned.append(self.seqno)
+        self.seqno += 1
+        self.replies += 1
+        await ws.send(json.dumps(dnmsg))
+        if self.replies == 2:
+            self.rounds += 1
+            logger.info('Round %d: closing muxs connection', self.rounds)
+            await ws.close()
+
+    async def check(self):
+        await asyncio.sleep(15.0)
+        delivered = [s for s in self.planned if s in sim.txseqnos]
+        expected = set(range(sim.fcnt - 2))   # recent ones might still be in flight
+        lost = sorted(expected - self.upfcnts)
+        logger.info('Reconnects: %d  downlinks delivered %d/%d (%.0f%%)  uplinks lost %d/%d',
+                    ROUNDS, len(delivered), len(self.planned), 100.0*len(delivered)/len(self.planned),
+                    len(lost), len(expected))
+        if len(delivered) != len(self.planned) or lost:
+            logger.error('Expected seqnos %r - TXed %r - lost uplinks %r', self.planned, sim.txseqnos, lost)
+            await self.testDone(1)
+        await self.testDone(0)
+
+
+with open("tc.uri","w") as f:
+    f.write('ws://localhost:6038')
+
+async def test_start():
+    global station, infos, muxs, sim
+    infos = tu.Infos()
+    muxs = TestMuxs()
+    sim = TestLgwSimServer()
+
+    await infos.start_server()
+    await muxs.start_server()
+    await sim.start_server()
+
+    station_args = ['station','-p', '--temp', '.']
+    station = await subprocess.create_subprocess_exec(*station_args)
+
+    await asyncio.sleep(90)
+    logger.error('Test did not complete')
+    await muxs.testDone(1)
+
+tstu.setup_logging()
+
+asyncio.ensure_future(test_start())
+asyncio.get_event_loop().run_forever()
@@ -0,0 +1,194 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+# A fleet of stations shares one LNS which restarts. Reconnects must spread out:
+#  A) plain restart         - jittered backoff, no synchronized wave
+#  B) close w/ retry-after  - nobody comes back before the server asked for it
+#  C) LNS drops every new connection for a while - handshake rate per station
+#     stays within the token bucket (TC_CONNECT_BURST per TC_CONNECT_WINDOW)
+
+import os
+import sys
+import time
+import json
+import shutil
+import asyncio
+import statistics
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('test3i-storm')
+
+import tcutils as tu
+import simutils as su
+import testutils as tstu
+
+
+NGW = 10
+GWS = ['gw%02d' % i for i in range(NGW)]
+RETRY_AFTER = 5         # s - requested in close frame of phase B
+STORM = 20              # s - duration of phase C
+BURST, WINDOW = 2, 30   # must match station.conf
+
+stations = []
+sims = []
+infos = None
+muxs = None
+
+
+class TestInfos(tu.Infos):
+    def router_info_response(self, resp):
+        # Route each station to its own muxs path to tell them apart
+        resp['uri'] = 'ws://localhost:6039/router-%s' % (str(resp['router']).replace(':',''),)
+        return resp
+
+
+class TestMuxs(tu.Muxs):
+    conns = {}          # router -> current ws
+    log = []            # (time, router) for every muxs handshake
+    storm_until = 0
+
+    async def handle_ws(self, ws, path):
+        r = path[len('/router-'):]
+        self.log.append((time.time(), r))
+        if time.time() < self.storm_until:
+            await ws.close(1013, 'try again later')
+            return
+        self.conns[r] = ws
+        await super().handle_ws(ws, '/router')
+
+    def since(self, t0, t1=None):
+        return [(t,r) for t,r in self.log if t >= t0 and (t1 is None or t < t1)]
+
+    async def wait_all(self, t0, timeout):
+        deadline = time.time() + timeout
+        while len({r for t,r in self.since(t0)}) < NGW:
+            if time.time() > deadline:
+                logger.error('Not all stations reconnected: %r', sorted({r for t,r in self.since(t0)}))
+                await testDone(1)
+            await asyncio.sleep(0.1)
+        first = {}
+        for t,r in self.since(t0):
+            first.setdefault(r, t-t0)
+        return sorted(first.values())
+
+    async def restart(self, code=1000, reason=''):
+        wss = list(self.conns.values())
+        self.conns = {}
+        t0 = time.time()
+        await asyncio.gather(*[ws.close(code, reason) for ws in wss], return_exceptions=True)
+        return t0
+
+
+def report(phase, delays):
+    bins = {}
+    for d in delays:
+        bins[int(d*4)] = bins.get(int(d*4), 0) + 1
+    logger.info('%s: reconnects after %.2fs..%.2fs  stdev %.2fs  peak %d/%d per 250ms',
+                phase, delays[0], delays[-1], statistics.pstdev(delays), max(bins.values()), len(delays))
+    logger.info('%s: histogram %s', phase,
+                ' '.join('%.2f:%d' % (b/4, bins[b]) for b in sorted(bins)))
+
+
+async def testDone(status):
+    for p in stations:
+        if p.returncode is None:
+            p.terminate()
+            await p.wait()
+    os._exit(status)
+
+
+async def run_phases():
+    await muxs.wait_all(0, 30)
+    await asyncio.sleep(8)      # > TC_MUXS_BACKOFF_MAX - backoff series starts over
+
+    t0 = await muxs.restart()
+    delays = await muxs.wait_all(t0, 30)
+    report('A restart', delays)
+    if delays[-1] - delays[0] < 0.5:
+        logger.error('Reconnects not spread: %r', delays)
+        await testDone(1)
+    await asyncio.sleep(8)
+
+    t0 = await muxs.restart(1013, 'retry-after=%d' % RETRY_AFTER)
+    delays = await muxs.wait_all(t0, 30)
+    report('B retry-after', delays)
+    if delays[0] < RETRY_AFTER:
+        logger.error('Station reconnected before retry-after=%ds: %r', RETRY_AFTER, delays)
+        await testDone(1)
+    await asyncio.sleep(8)
+
+    muxs.storm_until = time.time() + STORM
+    t0 = await muxs.restart()
+    await asyncio.sleep(STORM)
+    attempts = {}
+    for t,r in muxs.since(t0, t0+STORM):
+        attempts[r] = attempts.get(r, 0) + 1
+    limit = BURST + STORM*BURST//WINDOW
+    logger.info('C storm: handshakes per station in %ds: %r (limit %d)', STORM, sorted(attempts.values()), limit)
+    if max(attempts.values()) > limit:
+        logger.error('Handshake rate limit exceeded: %r', attempts)
+        await testDone(1)
+    delays = await muxs.wait_all(t0+STORM, 40)
+    report('C recovery', delays)
+    await testDone(0)
+
+
+async def test_start():
+    global infos, muxs
+    with open('station.conf') as f:
+        conf = f.read()
+    for i,gw in enumerate(GWS):
+        shutil.rmtree(gw, ignore_errors=True)
+        os.mkdir(gw)
+        with open(gw+'/station.conf', 'w') as f:
+            f.write(conf.replace('"routerid": "::1"', '"routerid": "::%x"' % (i+1,)))
+        shutil.copy('slave-0.conf', gw)
+        with open(gw+'/tc.uri', 'w') as f:
+            f.write('ws://localhost:6038')
+
+    infos = TestInfos()
+    muxs = TestMuxs()
+    await infos.start_server()
+    await muxs.start_server()
+    for gw in GWS:
+        sim = su.LgwSimServer(path=gw+'/spidev')
+        await sim.start_server()
+        sims.append(sim)
+        stations.append(await subprocess.create_subprocess_exec(
+            'station', '-p', '--temp', '.', cwd=gw,
+            stderr=open(gw+'/station.log', 'w')))
+
+    asyncio.ensure_future(run_phases())
+    await asyncio.sleep(180)
+    logger.error('Test did not complete')
+    await testDone(1)
+
+tstu.setup_logging()
+
+asyncio.ensure_future(test_start())
+asyncio.get_event_loop().run_forever()
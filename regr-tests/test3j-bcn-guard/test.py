@@ -0,0 +1,173 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+
+# Class C downlinks at random times with beacons every BINTV seconds.
+# Beacon windows are reserved ahead of time - downlinks overlapping a beacon
+# are moved when admitted and never have to be displaced when the beacon is
+# queued or goes on air. Every beacon and every downlink must be sent.
+
+import os
+import re
+import sys
+import time
+import json
+import random
+import asyncio
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('test3j-bcn-guard')
+
+import tcutils as tu
+import simutils as su
+import testutils as tstu
+
+
+station = None
+infos = None
+muxs = None
+sim = None
+
+BINTV    = 2        # s - BEACON_INTVL in station.conf
+DURATION = 40       # s - of class C load
+MEANGAP  = 0.4      # s - mean time between class C downlinks
+RX2FREQ  = 921.9
+
+
+class TestLgwSimServer(su.LgwSimServer):
+    bcncnt = 0
+    dncnt = 0
+
+    async def on_tx(self, lgwsim, pkt):
+        if pkt['tx_mode'] == lgwsim.hal.ON_GPS:
+            self.bcncnt += 1
+        else:
+            self.dncnt += 1
+
+
+class TestMuxs(tu.Muxs):
+    seqno = 0
+    dntxed = set()
+    t0 = 0
+
+    def get_router_config(self):
+        conf = dict(tu.router_config_KR920)
+        conf['bcning'] = {
+            'DR': 3,
+            'layout': [2,8,17],
+            'freqs': [923100000]
+        }
+        return { **conf, 'MuxTime': time.time() }
+
+    async def handle_connection(self, ws):
+        asyncio.ensure_future(self.send_classC(ws))
+        await super().handle_connection(ws)
+
+    async def handle_dntxed(self, ws, msg):
+        self.dntxed.add(msg['seqno'])
+
+    async def send_classC(self, ws):
+        try:
+            while sim.bcncnt == 0:           # beaconing starts once timesync has settled
+                await asyncio.sleep(0.1)
+            self.t0 = time.time()
+            bcn0 = sim.bcncnt
+            while time.time() < self.t0 + DURATION:
+                await asyncio.sleep(random.expovariate(1/MEANGAP))
+                dnmsg = {
+                    'msgtype' : 'dnmsg',
+                    'dC'      : 2,
+                    'dnmode'  : 'dn',
+                    'priority': 0,
+                    'RX2DR'   : 3,
+                    'RX2Freq' : int(RX2FREQ*1e6),
+                    'DevEui'  : '00-00-00-00-11-00-00-01',
+                    'seqno'   : self.seqno,
+                    'MuxTime' : time.time(),
+                    'rctx'    : 0,
+                    'pdu'     : bytes(range(16)).hex(),
+                }
+                self.seqno += 1
+                await ws.send(json.dumps(dnmsg))
+            await asyncio.sleep(3.0)
+            await self.check(sim.bcncnt - bcn0)
+        except asyncio.CancelledError:
+            pass
+        except Exception as exc:
+            logger.error('send_classC failed: %s', exc, exc_info=True)
+            await testDone(1)
+
+    async def check(self, bcns):
+        with open('station.log') as f:
+            log = f.read()
+        # Beacon is ::0 diid=0 - either it displaces a frame or a frame is hindered by it
+        displaced = len(re.findall(r'::0 diid=0 \S+ - displaces', log))
+        hindered  = len(re.findall(r'Hindered by ::0 diid=0', log))
+        moved     = len(re.findall(r'overlaps beacon reservation', log))
+        hours = (time.time() - self.t0) / 3600
+        logger.info('Beacons %d  class C sent %d/%d  displaced by beacon %d  hindered by beacon %d  (%.0f/h)  moved at admission %d',
+                    bcns, len(self.dntxed), self.seqno, displaced, hindered, (displaced+hindered)/hours, moved)
+        # Class C frames may still lose against each other - only beacon conflicts count
+        if bcns < DURATION//BINTV - 1 or len(self.dntxed) < self.seqno*9//10 or displaced+hindered:
+            logger.error('Beacon windows not kept free: missing seqnos %r', sorted(set(range(self.seqno)) - self.dntxed))
+            await testDone(1)
+        await testDone(0)
+
+
+async def testDone(status):
+    global station
+    if station:
+        station.terminate()
+        await station.wait()
+        station = None
+    os._exit(status)
+
+
+with open("tc.uri","w") as f:
+    f.write('ws://localhost:6038')
+
+async def test_start():
+    global station, infos, muxs, sim
+    infos = tu.Infos()
+    muxs = TestMuxs()
+    sim = TestLgwSimServer()
+
+    await infos.start_server()
+    await muxs.start_server()
+    await sim.start_server()
+
+    station_args = ['station','-p', '--temp', '.']
+    station = await subprocess.create_subprocess_exec(*station_args, stderr=open('station.log','w'))
+
+    await asyncio.sleep(DURATION + 30)
+    logger.error('Test did not complete')
+    await testDone(1)
+
+tstu.setup_logging()
+
+asyncio.ensure_future(test_start())
+asyncio.get_event_loop().run_forever()
@@ -0,0 +1,209 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2022. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+import os
+import time
+import json
+import socket
+import asyncio
+from asyncio import subprocess
+
+import logging
+logger = logging.getLogger('test3k-dnlocal')
+
+import tcutils as tu
+import simutils as su
+import testutils as tstu
+
+
+station = None
+infos = None
+muxs = None
+sim = None
+
+SOCKPATH = os.path.abspath('dnlocal.sock')
+
+
+def nobody_send() -> int:
+    # Unauthorized sender: runs as nobody and must not get through to the station
+    pid = os.fork()
+    if pid == 0:
+        os.setgid(65534)
+        os.setuid(65534)
+        s = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+        try:
+            s.sendto(b'{"msgtype":"dnmsg"}', SOCKPATH)
+        except PermissionError:
+            os._exit(0)
+        os._exit(1)
+    return os.waitstatus_to_exitcode(os.waitpid(pid, 0)[1])
+
+
+class Client:
+    def __init__(self, name:str):
+        self.path = os.path.abspath(name + '.sock')
+        if os.path.exists(self.path):
+            os.unlink(self.path)
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+        self.sock.bind(self.path)
+        self.sock.setblocking(False)
+        self.msgs = []
+
+    def send(self, msg) -> None:
+        self.sock.sendto(json.dumps(msg).encode('ascii'), SOCKPATH)
+
+    def poll(self) -> list:
+        while True:
+            try:
+                self.msgs.append(json.loads(self.sock.recv(2048).decode('ascii')))
+            except BlockingIOError:
+                return self.msgs
+
+    async def wait_for(self, msgtype:str, diid:int, timeout:float=3.0):
+        t = time.time() + timeout
+        while time.time() < t:
+            for m in self.poll():
+                if m['msgtype'] == msgtype and m['diid'] == diid:
+                    return m
+            await asyncio.sleep(0.05)
+        raise Exception('%s: no %s for diid=%d - got %r' % (self.path, msgtype, diid, self.msgs))
+
+
+def make_dnmsgC(diid:int, rx2dr:int=5, plen:int=5):
+    return {
+        'msgtype' : 'dnmsg',
+        'dC'      : 2,
+        'dnmode'  : 'dn',
+        'priority': 0,
+        'RX2DR'   : rx2dr,
+        'RX2Freq' : 869525000,
+        'DevEui'  : '00-00-00-00-11-00-00-01',
+        'diid'    : diid,
+        'rctx'    : 0,
+        'pdu'     : bytes(range(plen)).hex(),
+    }
+
+
+class TestLgwSimServer(su.LgwSimServer):
+    txcnt = 0
+
+    async def on_tx(self, lgwsim, pkt):
+        self.txcnt += 1
+
+
+class TestMuxs(tu.Muxs):
+    dntxed = []
+    test_task = None
+
+    async def handle_connection(self, ws):
+        self.test_task = asyncio.ensure_future(self.run_test())
+        await super().handle_connection(ws)
+
+    async def handle_dntxed(self, ws, msg):
+        self.dntxed.append(msg['diid'])
+
+    async def testDone(self, status):
+        global station
+        if station:
+            station.terminate()
+            await station.wait()
+            station = None
+        os._exit(status)
+
+    async def run_test(self):
+        try:
+            # Give station time to sync time with the radio
+            await asyncio.sleep(3.0)
+            mode = os.stat(SOCKPATH).st_mode & 0o777
+            if mode != 0o660:
+                raise Exception('Socket mode %o - expected 660' % mode)
+
+            # Round trip: dnmsg -> dnacc -> dntxed, nothing goes to the LNS
+            a = Client('clientA')
+            a.send(make_dnmsgC(100))
+            acc = await a.wait_for('dnacc', 100)
+            if not acc['admitted']:
+                raise Exception('dnmsg not admitted: %r' % acc)
+            await a.wait_for('dntxed', 100)
+            a.send({ 'msgtype': 'dntxed' })
+            acc = await a.wait_for('dnacc', 0)
+            if acc['admitted']:
+                raise Exception('Illegal msgtype admitted: %r' % acc)
+
+            # Unauthorized process
+            if os.geteuid() == 0:
+                if nobody_send() != 0:
+                    raise Exception('Unauthorized process could send to local downlink socket')
+            else:
+                logger.info('Not running as root - skipping unauthorized sender')
+
+            # Client A is replaced while its frames are queued - the new client
+            # in the same slot must not see their dntxed.
+            a.msgs = []
+            a.send(make_dnmsgC(200, rx2dr=0, plen=20))     # airtime 1.3s
+            a.send(make_dnmsgC(201))                       # queued behind 200
+            await a.wait_for('dnacc', 201)
+            others = [ Client('client'+c) for c in 'BCDE' ]
+            for c in others:
+                c.send({ 'msgtype': 'dntxed' })    # rejected - diid=0
+                await c.wait_for('dnacc', 0)
+            await asyncio.sleep(3.0)
+            late = [ (c.path, m) for c in others for m in c.poll() if m['msgtype'] == 'dntxed' ]
+            if late:
+                raise Exception('dntxed of replaced client delivered: %r' % late)
+            if [ m for m in a.poll() if m['msgtype'] == 'dntxed' and m['diid'] == 201 ]:
+                raise Exception('dntxed delivered to replaced client')
+            if self.dntxed:
+                raise Exception('dntxed of local frames sent to LNS: %r' % self.dntxed)
+            if sim.txcnt != 3:
+                raise Exception('Expected 3 frames on air - got %d' % sim.txcnt)
+            logger.info('Local downlinks: %d frames sent', sim.txcnt)
+            await self.testDone(0)
+        except Exception as exc:
+            logger.error('run_test failed: %s', exc, exc_info=True)
+            await self.testDone(1)
+
+
+with open("tc.uri","w") as f:
+    f.write('ws://localhost:6038')
+
+async def test_start():
+    global station, infos, muxs, sim
+    infos = tu.Infos()
+    muxs = TestMuxs()
+    sim = TestLgwSimServer()
+
+    await infos.start_server()
+    await muxs.start_server()
+    await sim.start_server()
+
+    station_args = ['station','-p', '--temp', '.']
+    station = await subprocess.create_subprocess_exec(*station_args)
+
+tstu.setup_logging()
+
+asyncio.ensure_future(test_start())
+asyncio.get_event_loop().run_forever()
@@ -36,6 +36,8 @@
 #include "s2conf.h"
 #include "rt.h"
 #include "tc.h"
+#include "trace.h"
+#include "sys_linux.h"
 
 
 static str_t  fifo;
@@ -87,8 +89,29 @@ static void fifo_read(aio_t* _aio) {
                 int lvl = log_str2level(cmdline);
                 if( lvl >= 0 ) {
                     log_setLevel(lvl);
-                } else {
-                    
+                }
+                else if( strcmp(cmdline, "reload") == 0 ) {
+                    if( !sys_reloadStationConf() )
+                        err = "Reload of station.conf failed";
+                }
+                else if( strcmp(cmdline, "dnlat") == 0 ) {
+                    if( TC ) {
+                        s2e_dnlatLog(&TC->s2ctx);
+                    } else {
+                        err = "No downlink latency stats - not connected right now";
+                    }
+                }
+#if defined(CFG_trace)
+                else if( strcmp(cmdline, "trace") == 0 ) {
+                    int n = trace_dump(NULL);
+                    if( n < 0 ) {
+                        err = "Failed to write trace dump";
+                    } else {
+                        LOG(INFO, "Trace dump written to %s (%d records)", trace_file(), n);
+                    }
+                }
+#endif // defined(CFG_trace)
+                else {
                     err = "Unknown fifo command";
                 }
             }
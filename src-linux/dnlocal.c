@@ -0,0 +1,235 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if defined(CFG_linux)
+#define _GNU_SOURCE  // struct ucred, SCM_CREDENTIALS
+
+// Local downlink injection.
+// Applications on the gateway submit 'dnmsg' objects (same format as from the LNS)
+// as datagrams to a unix socket. Frames are admitted through the same TX queue/
+// placement path as LNS traffic. The sender gets an admission reply and later
+// 'dntxed' for every frame sent on air. Only processes of the station's user/group
+// or root are accepted. Senders must bind their socket to a path to get replies.
+//
+//  <- {"msgtype":"dnmsg", "DevEui":.., "dC":0, "diid":.., "pdu":.., "RxDelay":1, "RX1DR":.., "RX1Freq":.., "xtime":.., "rctx":.., ..}
+//  -> {"msgtype":"dnacc", "diid":.., "admitted":true, "latency":0.000042}
+//  -> {"msgtype":"dntxed", ..}
+//
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "s2conf.h"
+#include "rt.h"
+#include "tc.h"
+
+
+enum { MAX_DNLOCAL_CLIENTS = 4 };
+enum { DNLOCAL_MSGSIZE = 2048 };
+// Client tags handed to s2e combine slot and generation of a slot.
+// s2e stores tag+1 in a u1_t - thus tags must stay below 255.
+enum { DNLOCAL_GENS = 255 / MAX_DNLOCAL_CLIENTS };
+
+typedef struct dnclient {
+    struct sockaddr_un addr;
+    socklen_t          addrlen;   // 0 = free slot
+    u1_t               gen;       // bumped whenever the slot gets a new client
+    ustime_t           lastSeen;
+} dnclient_t;
+
+static str_t      sockpath;
+static aio_t*     aio;
+static dnclient_t clients[MAX_DNLOCAL_CLIENTS];
+static char       msgbuf[DNLOCAL_MSGSIZE];
+
+
+static int findClient (struct sockaddr_un* addr, socklen_t addrlen) {
+    int lru = 0;
+    for( int i=0; i<MAX_DNLOCAL_CLIENTS; i++ ) {
+        dnclient_t* c = &clients[i];
+        if( c->addrlen == addrlen && memcmp(&c->addr, addr, addrlen) == 0 )
+            return i;
+        if( c->addrlen == 0 ) {
+            lru = i;
+            clients[lru].lastSeen = USTIME_MIN;
+        }
+        else if( c->lastSeen < clients[lru].lastSeen ) {
+            lru = i;
+        }
+    }
+    // New client - take a free slot or replace least recently seen
+    // New generation - frames of a previous client still in the TX queue are not reported to this one.
+    if( clients[lru].addrlen )
+        LOG(MOD_S2E|WARNING, "Local downlink clients exhausted - dropping %s", clients[lru].addr.sun_path);
+    memcpy(&clients[lru].addr, addr, addrlen);
+    clients[lru].addrlen = addrlen;
+    clients[lru].gen = (clients[lru].gen + 1) % DNLOCAL_GENS;
+    return lru;
+}
+
+
+static void sendToClient (int client, char* data, int len) {
+    dnclient_t* c = &clients[client];
+    if( aio == NULL || c->addrlen == 0 )
+        return;
+    if( sendto(aio->fd, data, len, MSG_DONTWAIT, (struct sockaddr*)&c->addr, c->addrlen) == -1 ) {
+        LOG(MOD_S2E|ERROR, "Local downlink client %s: %s - dropped", c->addr.sun_path, strerror(errno));
+        c->addrlen = 0;
+    }
+}
+
+
+void sys_dnlocalTxed (u1_t tag, dbuf_t* json) {
+    int client = tag % MAX_DNLOCAL_CLIENTS;
+    if( clients[client].addrlen == 0 || clients[client].gen != tag / MAX_DNLOCAL_CLIENTS ) {
+        LOG(MOD_S2E|DEBUG, "Local downlink client of dntxed is gone - dropped");
+        return;
+    }
+    sendToClient(client, json->buf, json->pos);
+}
+
+
+static int isAuthorized (struct ucred* cred) {
+    return cred != NULL && (cred->uid == 0 || cred->uid == geteuid() || cred->gid == getegid());
+}
+
+
+static void dnlocal_read (aio_t* _aio) {
+    assert(aio == _aio);
+    while(1) {
+        struct sockaddr_un addr;
+        union {
+            char buf[CMSG_SPACE(sizeof(struct ucred))];
+            struct cmsghdr align;
+        } cmsg;
+        struct iovec iov = { .iov_base = msgbuf, .iov_len = sizeof(msgbuf) };
+        struct msghdr msg = {
+            .msg_name = &addr, .msg_namelen = sizeof(addr),
+            .msg_iov = &iov, .msg_iovlen = 1,
+            .msg_control = cmsg.buf, .msg_controllen = sizeof(cmsg.buf),
+        };
+        ssize_t n = recvmsg(aio->fd, &msg, 0);
+        if( n == -1 ) {
+            if( errno == EINTR )
+                continue;
+            if( errno != EAGAIN )
+                LOG(MOD_S2E|ERROR, "Local downlink socket '%s' recv failed: %s", sockpath, strerror(errno));
+            return;
+        }
+        ustime_t t0 = rt_getTime();
+        struct ucred* cred = NULL;
+        for( struct cmsghdr* c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c) ) {
+            if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_CREDENTIALS )
+                cred = (struct ucred*)CMSG_DATA(c);
+        }
+        if( !isAuthorized(cred) ) {
+            LOG(MOD_S2E|ERROR, "Local downlink from unauthorized process (pid=%d uid=%d) - dropped",
+                cred ? cred->pid : -1, cred ? (int)cred->uid : -1);
+            continue;
+        }
+        if( msg.msg_namelen <= offsetof(struct sockaddr_un, sun_path) || addr.sun_path[0] == 0 ) {
+            LOG(MOD_S2E|ERROR, "Local downlink from unbound socket (pid=%d) - cannot reply, dropped", cred->pid);
+            continue;
+        }
+        int client = findClient(&addr, msg.msg_namelen);
+        clients[client].lastSeen = t0;
+
+        sL_t diid = 0;
+        int ok = 0;
+        if( (msg.msg_flags & MSG_TRUNC) ) {
+            LOG(MOD_S2E|ERROR, "Local downlink from %s too large (max %d bytes) - dropped", addr.sun_path, DNLOCAL_MSGSIZE);
+        }
+        else if( TC == NULL ) {
+            LOG(MOD_S2E|WARNING, "Local downlink from %s dropped - no TC session", addr.sun_path);
+        }
+        else {
+            ok = s2e_localDnmsg(&TC->s2ctx, msgbuf, n, client + MAX_DNLOCAL_CLIENTS*clients[client].gen, &diid);
+        }
+        ustime_t dt = rt_getTime() - t0;
+        LOG(MOD_S2E|VERBOSE, "Local downlink diid=%ld from %s %s in %~T", diid, addr.sun_path, ok ? "admitted" : "rejected", dt);
+
+        char replybuf[128];
+        ujbuf_t reply = { .buf = replybuf, .bufsize = sizeof(replybuf), .pos = 0 };
+        uj_encOpen(&reply, '{');
+        uj_encKVn(&reply,
+                  "msgtype",  's', "dnacc",
+                  "diid",     'I', diid,
+                  "admitted", 'b', ok,
+                  "latency",  'T', dt/1e6,
+                  NULL);
+        uj_encClose(&reply, '}');
+        sendToClient(client, reply.buf, reply.pos);
+    }
+}
+
+
+static void dnlocal_close () {
+    if( aio == NULL )
+        return;
+    aio_close(aio);
+    aio = NULL;
+    unlink(sockpath);
+}
+
+
+void sys_enableDnlocal (str_t path) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if( strlen(path) >= sizeof(addr.sun_path) ) {
+        LOG(MOD_S2E|ERROR, "Local downlink socket path too long: %s", path);
+        return;
+    }
+    strcpy(addr.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if( fd == -1 ) {
+        LOG(MOD_S2E|ERROR, "Failed to create local downlink socket: %s", strerror(errno));
+        return;
+    }
+    int one = 1, err;
+    unlink(path);  // stale socket of a previous instance
+    if( (err = setsockopt(fd, SOL_SOCKET, SO_PASSCRED, &one, sizeof(one))) == 0 ) {
+        // Socket file gets mode 0660 right away - no window with wider access
+        mode_t mask = umask(S_IXUSR|S_IXGRP|S_IRWXO);
+        err = bind(fd, (struct sockaddr*)&addr, sizeof(addr));
+        umask(mask);
+    }
+    if( err == -1 ) {
+        LOG(MOD_S2E|ERROR, "Failed to set up local downlink socket '%s': %s", path, strerror(errno));
+        close(fd);
+        return;
+    }
+    sockpath = path;
+    aio = aio_open(&sockpath, fd, dnlocal_read, NULL);
+    atexit(dnlocal_close);
+    rt_addFeature("dnlocal");
+    LOG(MOD_S2E|INFO, "Local downlink socket: %s", path);
+}
+
+#endif // defined(CFG_linux)
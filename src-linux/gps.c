@@ -51,6 +51,7 @@ int sys_enableGPS (str_t _device) {
 
 #include "sys.h"
 #include "s2conf.h"
+#include "record.h"
 
 
 // Special value to mark absent NMEA float/int field - e.g. $GPGGA,170801.00,,,,,0,00,99.99,,,,,,*69
@@ -71,6 +72,9 @@ static u1_t UBX_EN_NAVTIMEGPS[] = {
     0x01, 0x20, 0x01, // Enable NAV-TIMEGPS messages on current port (serial) with 1s rate
     0x2C, 0x83 // checksum
 };
+
+// Standard NMEA sentences (class 0xF0) not used by station: GLL, GSA, GSV, RMC, VTG
+static const u1_t UBX_NMEA_UNUSED[] = { 0x01, 0x02, 0x03, 0x04, 0x05 };
 #endif // defined(CFG_ubx)
 
 
@@ -91,6 +95,17 @@ static double orig_lat, orig_lon, from_lat, from_lon;
 static int    last_satellites;
 static int    last_quality;
 
+// Last GGA sentence: raw fields following the time of fix and their parsed values.
+// A sentence with the same raw fields is not parsed again.
+static struct {
+    ustime_t last;              // time last GGA was processed
+    int      rawlen;            // 0=no cached sentence
+    u1_t     hasPos;            // cached sentence carried a position
+    char     raw[96];
+    double   lat, lon, alt, dilution;
+    sL_t     quality, satellites;
+} gga;
+
 static str_t const lastpos_filename = "~temp/station.lastpos";
 static int      report_move;
 static int      last_reported_fix;
@@ -251,6 +266,8 @@ str_t GPSEV_NOFIX = "nofix";
 static int send_gpsev_fix(str_t gpsev, float lat, float lon, float alt,
                           float dilution, int satellites, int quality, float from_lat, float from_lon) {
     assert(gpsev == GPSEV_MOVE  || gpsev == GPSEV_FIX || gpsev == GPSEV_NOFIX);
+    if( !TC )
+        return 0;
     ujbuf_t sendbuf = (*TC->s2ctx.getSendbuf)(&TC->s2ctx, MIN_UPJSON_SIZE);
     if( sendbuf.buf == NULL ) {
         LOG(MOD_S2E|ERROR, "Failed to send GPS event. Either no TC connection or insufficient IO buffer space.");
@@ -290,6 +307,8 @@ static int send_gpsev_fix(str_t gpsev, float lat, float lon, float alt,
 
 
 static int send_gpsev_nofix(ustime_t since) {
+    if( !TC )
+        return 0;
     ujbuf_t sendbuf = (*TC->s2ctx.getSendbuf)(&TC->s2ctx, MIN_UPJSON_SIZE);
     if( sendbuf.buf == NULL ) {
         LOG(MOD_S2E|ERROR, "Failed to send gps event', no buffer space");
@@ -324,38 +343,64 @@ static float nmea_p2dec(float lat, char d) {
 }
 
 
-static void nmea_gga (char* p) {
-    double time_of_fix, lat, lon, dilution, alt;
-    char *latD, *lonD;
-    char *pp = p;
-    sL_t quality, satellites;
-    if( !nmea_float  (&p, &time_of_fix) ||
-        !nmea_float  (&p, &lat        ) ||
-        !nmea_str    (&p, 1, &latD    ) ||
-        !nmea_float  (&p, &lon        ) ||
-        !nmea_str    (&p, 1, &lonD    ) ||
-        !nmea_decimal(&p, &quality    ) ||
-        !nmea_decimal(&p, &satellites ) ||
-        !nmea_float  (&p, &dilution   ) ||
-        !nmea_float  (&p, &alt        )) {
-        int len = 0;
-        while (pp[len]>31 && pp[len]<128 && ++len );
-        LOG(MOD_GPS|ERROR, "Failed to parse GPS GGA sentence: (len=%d) %.*s", len, len, pp);
-        return;
+// p points after "$xxGGA," and len is the length up to (excluding) the checksum
+static void nmea_gga (char* p, int len) {
+    ustime_t now = rt_getTime();
+    if( gga.last && now - gga.last < GPS_GGA_INTV )
+        return;     // receiver sends faster than we care
+    gga.last = now;
+
+    // Skip time of fix - compare remaining fields with last sentence
+    char* raw = memchr(p, ',', len);
+    int rawlen = raw ? len - (raw - p) : 0;
+    if( rawlen == 0 || rawlen > sizeof(gga.raw) || rawlen != gga.rawlen || memcmp(raw, gga.raw, rawlen) != 0 ) {
+        double time_of_fix, lat, lon, dilution, alt;
+        char *latD, *lonD;
+        char *pp = p;
+        sL_t quality, satellites;
+        gga.rawlen = 0;
+        if( rawlen > 0 && rawlen <= sizeof(gga.raw) ) {
+            memcpy(gga.raw, raw, rawlen);   // copy before parsing overwrites terminators
+            gga.rawlen = rawlen;
+        }
+        if( !nmea_float  (&p, &time_of_fix) ||
+            !nmea_float  (&p, &lat        ) ||
+            !nmea_str    (&p, 1, &latD    ) ||
+            !nmea_float  (&p, &lon        ) ||
+            !nmea_str    (&p, 1, &lonD    ) ||
+            !nmea_decimal(&p, &quality    ) ||
+            !nmea_decimal(&p, &satellites ) ||
+            !nmea_float  (&p, &dilution   ) ||
+            !nmea_float  (&p, &alt        )) {
+            int len = 0;
+            while (pp[len]>31 && pp[len]<128 && ++len );
+            LOG(MOD_GPS|ERROR, "Failed to parse GPS GGA sentence: (len=%d) %.*s", len, len, pp);
+            gga.rawlen = 0;
+            return;
+        }
+        gga.hasPos = (lat != NILFIELD && lon != NILFIELD);
+        if( !gga.hasPos ) {
+            LOG(MOD_GPS|WARNING, "GGA sentence without a fix - bad GPS signal?");
+            return;
+        }
+        gga.lat = nmea_p2dec(lat, latD[0]);
+        gga.lon = nmea_p2dec(lon, lonD[0]);
+        gga.alt = alt;
+        gga.dilution = dilution;
+        gga.quality = quality;
+        gga.satellites = satellites;
+        LOG(MOD_GPS|XDEBUG, "nmea_gga: lat %f, lon %f", gga.lat, gga.lon);
     }
-    if( lat == NILFIELD || lon == NILFIELD ) {
-        LOG(MOD_GPS|WARNING, "GGA sentence without a fix - bad GPS signal?");
-        return;
+    else if( !gga.hasPos ) {
+        return;     // still no fix - already reported
     }
-    lat = nmea_p2dec(lat, latD[0]);
-    lon = nmea_p2dec(lon, lonD[0]);
-    LOG(MOD_GPS|XDEBUG, "nmea_gga: lat %f, lon %f", lat, lon);
+    double lat = gga.lat, lon = gga.lon, alt = gga.alt, dilution = gga.dilution;
+    sL_t quality = gga.quality, satellites = gga.satellites;
 
     if( (quality == 0) ^ (last_quality == 0) )
         time_fixchange = rt_getTime();
 
     int fix = (quality == 0 ? -1 : 1);
-    ustime_t now = rt_getTime();
     ustime_t delay = GPS_REPORT_DELAY;
 
     //if (fix > 0) {
@@ -437,22 +482,26 @@ static void gps_read(aio_t* _aio) {
         gpsfill = n = gpsfill + n;
         for( int i=0; i<n; i++ ) {
             if( gpsline[i] == '\n' ) {
-                if( nmea_cksum(gpsline, i) ) {
-                    LOG(MOD_GPS|XDEBUG, "NMEA: %.*s", i+1, &gpsline[done]);
-                    if( gpsline[done+0] == '$' && gpsline[done+3] == 'G' &&
-                        gpsline[done+4] == 'G' && gpsline[done+5] == 'A' && gpsline[done+6] == ',' ) {
-                        nmea_gga((char*)gpsline+7);
-                    }
+                u1_t* s = &gpsline[done];
+                int isGGA = i-done > 7 && s[3] == 'G' && s[4] == 'G' && s[5] == 'A' && s[6] == ',';
+                if( s[0] == '$' && !isGGA ) {
+                    // Only GGA is used - drop others without checksumming them
+                }
+                else if( nmea_cksum(s, i-done) ) {
+                    LOG(MOD_GPS|XDEBUG, "NMEA: %.*s", i+1-done, s);
+                    REC(text, REC_GPS, (char*)s, i+1-done);
+                    u1_t* e = memchr(s, '*', i-done);
+                    nmea_gga((char*)s+7, e - s - 7);
                 }
                 else {
                     if( garbageCnt == 0 ) {
-                        LOG(MOD_GPS|XDEBUG, "GPS garbage (%d bytes): %64H", i+1, i+1, &gpsline[done]);
+                        LOG(MOD_GPS|XDEBUG, "GPS garbage (%d bytes): %64H", i+1-done, i+1-done, s);
                     } else {
                         garbageCnt -= 1;  // 1st few sentences might be garbage
                     }
                 }
                 done = i+1;
-                break;
+                continue;   // more complete sentences may be buffered (FIFO, burst after wakeup)
             }
 #if defined(CFG_ubx)
             // UBX
@@ -591,6 +640,21 @@ static int gps_reopen () {
             int n = sizeof(UBX_EN_NAVTIMEGPS);
             if( write(fd, UBX_EN_NAVTIMEGPS, n) != n )
                 LOG(MOD_GPS|ERROR, "Failed to write UBX enable to GPS: n=%d %s", n, strerror(errno));
+            // Turn off NMEA sentences we drop anyway - less serial traffic and wakeups
+            for( int k=0; k<SIZE_ARRAY(UBX_NMEA_UNUSED); k++ ) {
+                u1_t cfgmsg[] = {
+                    UBX_SYN1, UBX_SYN2,
+                    0x06, 0x01, // CFG-MSG
+                    0x03, 0x00, // payload length
+                    0xF0, UBX_NMEA_UNUSED[k], 0x00, // NMEA class/ID - rate 0 on current port
+                    0x00, 0x00  // checksum
+                };
+                u2_t cksum = fletcher8(&cfgmsg[2], 7);
+                cfgmsg[9]  = cksum;
+                cfgmsg[10] = cksum >> 8;
+                if( write(fd, cfgmsg, sizeof(cfgmsg)) != sizeof(cfgmsg) )
+                    LOG(MOD_GPS|ERROR, "Failed to write UBX CFG-MSG to GPS: %s", strerror(errno));
+            }
         }
 #endif // defined(CFG_ubx)
     }
@@ -47,6 +47,7 @@
 #include "sx130xconf.h"
 #include "ral.h"
 #include "ralsub.h"
+#include "trace.h"
 
 
 #define WAIT_SLAVE_PID_INTV rt_millis(500)
@@ -56,7 +57,6 @@
 
 typedef struct slave {
     tmr_t      tmr;
-    tmr_t      tsync;
     pid_t      pid;
     aio_t*     dn;
     aio_t*     up;
@@ -64,7 +64,9 @@ typedef struct slave {
     u1_t       killCnt;
     u1_t       restartCnt;
     u1_t       antennaType;
-    dbuf_t     sx1301confJson;
+    u1_t       synced;          // slave delivered a timesync since (re)start - joins batched rounds
+    u2_t       sx1301confLen;   // 0 = no config
+    char       sx1301confJson[sizeof(((struct ral_config_req*)0)->json)];
     chdefl_t   upchs;
     int        last_expcmd;
     // Read Spill Buffer
@@ -80,9 +82,71 @@ static slave_t* slaves;
 static pid_t    master_pid;
 static u4_t     region;
 
+// Batched timesync - one request fan-out to all slaves per round.
+// All slaves sample at a common MCU epoch and results are processed together.
+static tmr_t    syncTmr;
+static ustime_t syncEpoch;
+static u1_t     syncPending;    // bitmap: slaves of current round not yet answered
+static u1_t     syncHave;       // bitmap: slaves with a result in syncResps
+static struct ral_timesync_resp syncResps[MAX_TXUNITS];
+
 
 // Fwd decl
 static void restart_slave (tmr_t* tmr);
+static void req_timesync (tmr_t* tmr);
+
+
+static void process_syncRound () {
+    ustime_t delay = TIMESYNC_RADIO_INTV;
+    int first = 1;
+    for( int i=0; i<n_slaves; i++ ) {
+        if( (syncHave & (1<<i)) == 0 )
+            continue;
+        struct ral_timesync_resp* resp = &syncResps[i];
+        TRACE(TS_RADIO, resp->quality | (i<<16));
+        ustime_t d = ts_updateTimesync(i, resp->quality, &resp->timesync);
+        // Slave#0 owns PPS and places the next round between two pulses - all others follow.
+        // Without slave#0 the most urgent request wins.
+        if( i == 0 || (!(syncHave & 1) && (first || d < delay)) )
+            delay = d;
+        first = 0;
+    }
+    syncHave = syncPending = 0;
+    // Next epoch is relative to the common sampling point, not to the last response
+    rt_setTimerCb(&syncTmr, syncEpoch + delay - TIMESYNC_FANOUT_LEAD, req_timesync);
+}
+
+
+static void syncRound_timeout (tmr_t* tmr) {
+    for( int i=0; i<n_slaves; i++ ) {
+        if( (syncPending & (1<<i)) ) {
+            LOG(MOD_RAL|WARNING, "Slave (%d) missed timesync round", i);
+        }
+    }
+    process_syncRound();
+}
+
+
+static void on_timesync (slave_t* slave, struct ral_timesync_resp* resp) {
+    int slave_idx = (int)(slave-slaves);
+    slave->synced = 1;
+    if( (syncPending & (1<<slave_idx)) ) {
+        syncResps[slave_idx] = *resp;
+        syncHave |= 1<<slave_idx;
+        syncPending &= ~(1<<slave_idx);
+        if( syncPending == 0 )
+            process_syncRound();
+        return;
+    }
+    // Unsolicited sync right after config or straggler from an expired round
+    TRACE(TS_RADIO, resp->quality | (slave_idx<<16));
+    ustime_t delay = ts_updateTimesync(slave_idx, resp->quality, &resp->timesync);
+    if( syncTmr.next == TMR_NIL ) {
+        // No rounds running - start cadence
+        syncEpoch = rt_getTime();
+        rt_setTimerCb(&syncTmr, rt_micros_ahead(delay - TIMESYNC_FANOUT_LEAD), req_timesync);
+    }
+}
 
 static int read_slave_pipe (slave_t* slave, u1_t* buf, int bufsize, int expcmd, struct ral_response* expresp) {
     u1_t slave_idx = (int)(slave-slaves);
@@ -145,8 +209,7 @@ static int read_slave_pipe (slave_t* slave, u1_t* buf, int bufsize, int expcmd,
             else if( hdr->cmd == RAL_CMD_TIMESYNC ) {
                 if( (slave->rsb.exp= sizeof(struct ral_timesync_resp)) > dlen ) goto spill;
                 struct ral_timesync_resp* resp = (struct ral_timesync_resp*)hdr;
-                ustime_t delay = ts_updateTimesync(slave_idx, resp->quality, &resp->timesync);
-                rt_setTimer(&slave->tsync, rt_micros_ahead(delay));
+                on_timesync(slave, resp);
                 consumed = sizeof(*resp);
             }
             else if( hdr->cmd == RAL_CMD_RX ) {
@@ -165,6 +228,7 @@ static int read_slave_pipe (slave_t* slave, u1_t* buf, int bufsize, int expcmd,
                     if( rxjob->dr == DR_ILLEGAL ) {
                         LOG(MOD_RAL|ERROR, "Unable to map to an up DR: %R", resp->rps);
                     } else {
+                        TRACE(RX_FRAME, rxjob->len | (rxjob->dr<<8) | (rxjob->rctx<<16));
                         s2e_addRxjob(&TC->s2ctx, rxjob);
                         s2e_flushRxjobs(&TC->s2ctx); // XXX
                     }
@@ -345,14 +409,12 @@ static int write_slave_pipe (slave_t* slave, void* data, int len) {
 static void send_config (slave_t* slave) {
     struct ral_config_req req = { .cmd = RAL_CMD_CONFIG, .rctx = 0 };
     strcpy(req.hwspec, "sx1301/1");
-    int jlen = slave->sx1301confJson.bufsize;
-    if( jlen > sizeof(req.json) )
-        rt_fatal("JSON of sx1301conf to big for pipe: %d > %d", jlen, sizeof(req.json));
+    int jlen = slave->sx1301confLen;
     if( jlen > 0 ) {
         req.region = region;
         req.jsonlen = jlen;
         req.upchs = slave->upchs;
-        memcpy(req.json, slave->sx1301confJson.buf, jlen);
+        memcpy(req.json, slave->sx1301confJson, jlen);
         LOG(MOD_RAL|INFO, "Master sending %d bytes of JSON sx1301conf to slave (%d)", jlen, (int)(slave-slaves));
         if( !write_slave_pipe(slave, &req, sizeof(req)) )
             rt_fatal("Failed to send sx1301conf");
@@ -361,10 +423,21 @@ static void send_config (slave_t* slave) {
 
 
 static void req_timesync (tmr_t* tmr) {
-    slave_t* slave = memberof(slave_t, tmr, tsync);
-    struct ral_timesync_req req = { .cmd = RAL_CMD_TIMESYNC, .rctx = 0 };
-    if( !write_slave_pipe(slave, &req, sizeof(req)) )
-        rt_fatal("Failed to send ral_timesync_req");
+    // Fan out one request to all synced slaves back-to-back - they delay sampling until epoch
+    struct ral_timesync_req req = { .cmd = RAL_CMD_TIMESYNC, .rctx = 0, .epoch = rt_micros_ahead(TIMESYNC_FANOUT_LEAD) };
+    syncEpoch = req.epoch;
+    syncPending = syncHave = 0;
+    for( int i=0; i<n_slaves; i++ ) {
+        slave_t* slave = &slaves[i];
+        if( !slave->synced || slave->dn == NULL )
+            continue;
+        if( !write_slave_pipe(slave, &req, sizeof(req)) )
+            rt_fatal("Failed to send ral_timesync_req");
+        syncPending |= 1<<i;
+    }
+    if( syncPending == 0 )
+        return;  // nobody synced - next unsolicited sync from a slave restarts cadence
+    rt_setTimerCb(&syncTmr, syncEpoch + TIMESYNC_BATCH_WAIT, syncRound_timeout);
 }
 
 
@@ -379,7 +452,9 @@ static void restart_slave (tmr_t* tmr) {
                  slaveIdx, slave->restartCnt);
     }
     rt_clrTimer(&slave->tmr);
-    rt_clrTimer(&slave->tsync);
+    slave->synced = 0;
+    syncPending &= ~(1<<slaveIdx);
+    syncHave &= ~(1<<slaveIdx);
     aio_close(slave->up);
     aio_close(slave->dn);
     slave->up = slave->dn = NULL;
@@ -533,7 +608,7 @@ int ral_config (str_t hwspec, u4_t cca_region, char* json, int jsonlen, chdefl_t
         return 0;
     }
     for( int i=0; i<n_slaves; i++ )
-        dbuf_free(&slaves[i].sx1301confJson);
+        slaves[i].sx1301confLen = 0;
 
     ujdec_t D;
     uj_iniDecoder(&D, json, jsonlen);
@@ -550,7 +625,15 @@ int ral_config (str_t hwspec, u4_t cca_region, char* json, int jsonlen, chdefl_t
     while( (slaveIdx = uj_nextSlot(&D)) >= 0 ) {
         n1301 = slaveIdx+1;
         if( slaveIdx < n_slaves ) {
-            slaves[slaveIdx].sx1301confJson = dbuf_dup(uj_skipValue(&D));
+            slave_t* slave = &slaves[slaveIdx];
+            dbuf_t sx1301conf = uj_skipValue(&D);
+            if( sx1301conf.bufsize > sizeof(slave->sx1301confJson) ) {
+                LOG(MOD_RAL|ERROR, "JSON of sx1301conf#%d too big for pipe: %d > %d",
+                    slaveIdx, sx1301conf.bufsize, sizeof(slave->sx1301confJson));
+                return 0;
+            }
+            memcpy(slave->sx1301confJson, sx1301conf.buf, sx1301conf.bufsize);
+            slave->sx1301confLen = sx1301conf.bufsize;
         } else {
             uj_skipValue(&D);
         }
@@ -581,7 +664,8 @@ int ral_config (str_t hwspec, u4_t cca_region, char* json, int jsonlen, chdefl_t
         } else {
             for( int si=n1301, sj=0; si < n_slaves; si++, sj=(sj+1)%n1301 ) {
                 slaves[si].upchs = slaves[sj].upchs;
-                slaves[si].sx1301confJson = dbuf_dup(slaves[sj].sx1301confJson);
+                memcpy(slaves[si].sx1301confJson, slaves[sj].sx1301confJson, slaves[sj].sx1301confLen);
+                slaves[si].sx1301confLen = slaves[sj].sx1301confLen;
             }
             LOG(MOD_RAL|WARNING, "Region plan hwspec '%s' replicated %d times onto slaves 'sx1301/%d' - assuming antenna diversity",
                 hwspec, n_slaves/n1301, n_slaves);
@@ -647,19 +731,20 @@ void ral_ini () {
     for( int i=0; i<n_slaves; i++ ) {
         // 初始化从进程的主定时器（无回调函数）
         rt_iniTimer(&slaves[i].tmr, NULL);
-        // 初始化时间同步定时器，回调函数为req_timesync
-        rt_iniTimer(&slaves[i].tsync, req_timesync);
         // 将主定时器设置为执行restart_slave函数，启动从进程
         rt_yieldTo(&slaves[i].tmr, restart_slave);
     }
+    rt_iniTimer(&syncTmr, req_timesync);
 }
 
 
 void ral_stop () {
-    struct ral_timesync_req req = { .cmd = RAL_CMD_STOP, .rctx = 0 };
+    struct ral_stop_req req = { .cmd = RAL_CMD_STOP, .rctx = 0 };
+    rt_clrTimer(&syncTmr);
+    syncPending = syncHave = 0;
     for( int slaveIdx=0; slaveIdx < n_slaves; slaveIdx++ ) {
         slave_t* slave = &slaves[slaveIdx];
-        rt_clrTimer(&slave->tsync);
+        slave->synced = 0;
         write_slave_pipe(slave, &req, sizeof(req));
     }
 }
@@ -201,6 +201,10 @@ static void pipe_read (aio_t* aio) {
             }
             else if( n >= off + sizeof(struct ral_timesync_req) && req->cmd == RAL_CMD_TIMESYNC) {
                 off += sizeof(struct ral_timesync_req);
+                // Batched request - sample at the common epoch shared with the other slaves
+                ustime_t wait = ((struct ral_timesync_req*)req)->epoch - rt_getTime();
+                if( wait > 0 && wait <= TIMESYNC_FANOUT_LEAD )
+                    rt_usleep(wait);
                 sendTimesync();
                 continue;
             }
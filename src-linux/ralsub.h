@@ -51,8 +51,9 @@ struct ral_header {
 };
 
 struct ral_timesync_req {
-    sL_t rctx;
-    u1_t cmd;
+    sL_t     rctx;
+    u1_t     cmd;
+    ustime_t epoch;  // common MCU time all slaves sample at (CLOCK_MONOTONIC is shared)
 };
 
 struct ral_stop_req {
@@ -46,6 +46,8 @@
 #include "s2e.h"
 #include "ral.h"
 #include "timesync.h"
+#include "trace.h"
+#include "record.h"
 #include "sys.h"
 #include "sys_linux.h"
 #include "fs.h"
@@ -95,14 +97,15 @@ static int    workerPid;
 static str_t  radioInit;
 static str_t  radioDevice;
 static str_t  versionTxt;
-static char*  updfile;
-static char*  temp_updfile;
-static int    updfd = -1;
 
 static str_t  protoEuiSrc;
 static str_t  prefixEuiSrc;
 static str_t  radioInitSrc;
+static dbuf_t confText;         // station.conf as read at startup
+static time_t confMtime;
+static tmr_t  confTmr;
 
+static void checkConfChange (tmr_t* tmr);
 
 static void handle_signal (int signum) {
     // Calling exit() in a signal handler is unsafe
@@ -117,6 +120,14 @@ static void handle_signal (int signum) {
     //_exit(128+signum);
 }
 
+#if defined(CFG_trace)
+static void handle_traceSignal (int signum) {
+    int err = errno;
+    trace_dump(NULL);
+    errno = err;
+}
+#endif // defined(CFG_trace)
+
 
 
 static int updateDirSetting (str_t path, str_t source, str_t* pdir, str_t* psrc) {
@@ -476,64 +487,6 @@ str_t sys_version () {
     return readFileAsString("version", ".txt", &versionTxt);
 }
 
-/* FW Update ************************************ */
-
-void sys_updateStart (int len) {
-    close(updfd);
-    if( len == 0 ) {
-        updfd = -1;
-        return;
-    }
-    makeFilepath("/tmp/update", ".bi_", &temp_updfile, 0);
-    updfd = open(temp_updfile, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
-    if( updfd == -1 )
-        LOG(MOD_SYS|ERROR, "Failed to open '%s': %s", temp_updfile, strerror(errno));
-}
-
-void sys_updateWrite (u1_t* data, int off, int len) {
-    if( updfd == -1 ) return;
-    int err = write(updfd, data, len);
-    if( err == -1 ) {
-        LOG(MOD_SYS|ERROR, "Failed to write '%s': %s", temp_updfile, strerror(errno));
-        close(updfd);
-        updfd = -1;
-    }
-}
-
-int sys_updateCommit (int len) {
-    // Rename file and start a process
-    if( len == 0 )
-        return 1;
-    if( updfd == -1 ) {
-        if( temp_updfile )
-            unlink(temp_updfile);
-        return 0;
-    }
-    close(updfd);
-    sync();
-    updfd = -1;
-    makeFilepath("/tmp/update", ".bin", &updfile, 0);
-    if( rename(temp_updfile, updfile) == -1 ) {
-        LOG(MOD_SYS|ERROR, "Rename of update file failed '%s': %s", temp_updfile, strerror(errno));
-    }
-    sync();
-    return 1;
-}
-
-
-void sys_runUpdate () {
-    makeFilepath("/tmp/update", ".bin", &updfile, 0);
-    if( access(updfile, X_OK) != 0 )
-        return; // no such file or not executable
-    str_t argv[2] = { updfile, NULL };
-    sys_execCommand(0, argv);  // 0=detach, don't wait for update to finish
-}
-
-void sys_abortUpdate () {
-    unlink("/tmp/update.bin");
-    sync();
-}
-
 int sys_runRadioInit (str_t device) {
     setenv("LORAGW_SPI", device, 1);   // for libloragw (SPI module)
     if( !radioInit )
@@ -683,6 +636,8 @@ static int parseStationConf () {
         LOG(MOD_SYS|ERROR, "No such file (or not readable): %s", filename);
         return 0;
     }
+    rt_free(confText.buf);
+    confText = (dbuf_t){ .buf = rt_strdupn(jbuf.buf, jbuf.bufsize), .bufsize = jbuf.bufsize };
     ujdec_t D;
     uj_iniDecoder(&D, jbuf.buf, jbuf.bufsize);
     if( uj_decode(&D) ) {
@@ -820,10 +775,253 @@ static int parseStationConf () {
     if( ccaDisabled   ) s2e_ccaDisabled   = ccaDisabled   & 2;
     if( dcDisabled    ) s2e_dcDisabled    = dcDisabled    & 2;
     if( dwellDisabled ) s2e_dwellDisabled = dwellDisabled & 2;
+    s2conf_validate();
     return 1;
 }
 
 
+// --------------------------------------------------------------------------------
+//
+// Reload of station.conf - apply tunables at runtime
+//
+// --------------------------------------------------------------------------------
+
+enum { MAX_CONF_FIELDS = 96 };
+enum { CONF_HOT=1, CONF_RESTART, CONF_LOGLEVEL, CONF_FLAG };
+
+// station_conf settings not backed by a tunable - only read at startup
+static const char* const startupFields[] = {
+    "routerid", "euiprefix", "log_file", "log_size", "log_rotate", "gps", "pps",
+    "radio_init", "device", "device_mode", "web_port", "web_dir", NULL
+};
+
+typedef struct conffield {
+    str_t  name;    // points into decoded buffer
+    dbuf_t raw;     // raw JSON text of the value
+    u1_t   kind;    // CONF_* - how to apply a change, 0=unchanged
+} conffield_t;
+
+// Collect raw values of station_conf fields and other top level sections.
+// Decodes buf in place. Returns -1 if not proper JSON.
+static int collectConfFields (char* buf, int bufsize, conffield_t* fields) {
+    static int n;  // must survive longjmp from uj_decode
+    ujdec_t D;
+    n = 0;
+    uj_iniDecoder(&D, buf, bufsize);
+    if( uj_decode(&D) )
+        return -1;
+    ujcrc_t field;
+    uj_enterObject(&D);
+    while( (field = uj_nextField(&D)) ) {
+        if( field == J_station_conf ) {
+            uj_enterObject(&D);
+            while( uj_nextField(&D) ) {
+                str_t name = D.field.name;
+                dbuf_t raw = uj_skipValue(&D);
+                if( n < MAX_CONF_FIELDS )
+                    fields[n++] = (conffield_t){ .name = name, .raw = raw };
+            }
+            uj_exitObject(&D);
+        } else {
+            str_t name = D.field.name;
+            dbuf_t raw = uj_skipValue(&D);
+            if( n < MAX_CONF_FIELDS )
+                fields[n++] = (conffield_t){ .name = name, .raw = raw, .kind = CONF_RESTART };
+        }
+    }
+    uj_exitObject(&D);
+    uj_assertEOF(&D);
+    return n;
+}
+
+static conffield_t* findConfField (conffield_t* fields, int n, str_t name) {
+    for( int i=0; i<n; i++ ) {
+        if( strcmp(fields[i].name, name) == 0 )
+            return &fields[i];
+    }
+    return NULL;
+}
+
+static int checkLogLevel (str_t levels) {
+    while( log_str2level(levels) >= 0 ) {
+        if( (levels = strchr(levels, ',')) == NULL )
+            return 1;
+        levels += 1;
+    }
+    return 0;
+}
+
+// Decode a JSON string or bool value of a field
+static int decodeConfValue (conffield_t* f, int asbool, char* str, int strsize) {
+    ujdec_t D;
+    char* v = rt_strdupn(f->raw.buf, f->raw.bufsize);
+    uj_iniDecoder(&D, v, f->raw.bufsize);
+    if( uj_decode(&D) ) {
+        rt_free(v);
+        return -1;
+    }
+    int res = 0;
+    if( asbool ) {
+        res = uj_bool(&D);
+    } else {
+        snprintf(str, strsize, "%s", uj_str(&D));
+    }
+    uj_assertEOF(&D);
+    rt_free(v);
+    return res;
+}
+
+static void addConfName (char* list, int listsize, str_t name) {
+    int n = strlen(list);
+    snprintf(list+n, listsize-n, "%s%s", n ? ", " : "", name);
+}
+
+
+// Re-read station.conf and apply parameters which are safe to change at runtime.
+// The whole file is validated first - nothing is applied if any value is illegal.
+// Changes compared to startup which require a restart are reported.
+// Runs from the event loop - changes take effect between two aio iterations.
+int sys_reloadStationConf () {
+    str_t filename = "station.conf";
+    dbuf_t jbuf = sys_readFile(filename);
+    if( jbuf.buf == NULL ) {
+        LOG(MOD_SYS|ERROR, "Reload: no such file (or not readable): %s", filename);
+        return 0;
+    }
+    conffield_t* curr = rt_mallocN(conffield_t, MAX_CONF_FIELDS);
+    conffield_t* orig = rt_mallocN(conffield_t, MAX_CONF_FIELDS);
+    char* origbuf = rt_strdupn(confText.buf, confText.bufsize);
+    char  applied[256] = { 0 };
+    char  restart[256] = { 0 };
+    char  value[64];
+    int   ok = 0;
+    int   ncurr = collectConfFields(jbuf.buf, jbuf.bufsize, curr);
+    int   norig = origbuf ? collectConfFields(origbuf, confText.bufsize, orig) : 0;
+    if( ncurr < 0 ) {
+        LOG(MOD_SYS|ERROR, "Reload: parsing of JSON failed - '%s' ignored", filename);
+        goto done;
+    }
+    // Validate and classify all changes
+    for( int i=0; i<ncurr; i++ ) {
+        conffield_t* f = &curr[i];
+        if( f->kind == CONF_RESTART ) {
+            conffield_t* o = findConfField(orig, norig, f->name);
+            if( o && o->raw.bufsize == f->raw.bufsize && memcmp(o->raw.buf, f->raw.buf, f->raw.bufsize) == 0 )
+                f->kind = 0;
+            continue;
+        }
+        if( strcmp(f->name, "log_level") == 0 ) {
+            if( decodeConfValue(f, 0, value, sizeof(value)) < 0 || !checkLogLevel(value) ) {
+                LOG(MOD_SYS|ERROR, "Reload: illegal log level: %.*s - '%s' ignored", f->raw.bufsize, f->raw.buf, filename);
+                goto done;
+            }
+            f->kind = CONF_LOGLEVEL;
+            continue;
+        }
+#if !defined(CFG_prod)
+        if( strcmp(f->name, "nocca") == 0 || strcmp(f->name, "nodc") == 0 || strcmp(f->name, "nodwell") == 0 ) {
+            if( decodeConfValue(f, 1, NULL, 0) < 0 ) {
+                LOG(MOD_SYS|ERROR, "Reload: illegal value for %s: %.*s - '%s' ignored", f->name, f->raw.bufsize, f->raw.buf, filename);
+                goto done;
+            }
+            f->kind = CONF_FLAG;
+            continue;
+        }
+#endif // !defined(CFG_prod)
+        char* v = rt_strdupn(f->raw.buf, f->raw.bufsize);
+        int res = s2conf_check(filename, f->name, v);
+        rt_free(v);
+        if( res == 0 ) {
+            LOG(MOD_SYS|ERROR, "Reload: illegal value for %s: %.*s - '%s' ignored", f->name, f->raw.bufsize, f->raw.buf, filename);
+            goto done;
+        }
+        if( res == 2 ) {
+            f->kind = s2conf_needsRestart(f->name) ? CONF_RESTART : CONF_HOT;
+            continue;
+        }
+        if( res == -1 ) {
+            int k = 0;
+            while( startupFields[k] && strcmp(startupFields[k], f->name) != 0 )
+                k++;
+            if( startupFields[k] == NULL ) {
+                LOG(MOD_SYS|WARNING, "Reload: ignoring field: %s", f->name);
+                continue;
+            }
+            conffield_t* o = findConfField(orig, norig, f->name);
+            if( !o || o->raw.bufsize != f->raw.bufsize || memcmp(o->raw.buf, f->raw.buf, f->raw.bufsize) != 0 )
+                f->kind = CONF_RESTART;
+        }
+    }
+    // Removed settings keep their current value until restart
+    for( int i=0; i<norig; i++ ) {
+        if( !findConfField(curr, ncurr, orig[i].name) )
+            addConfName(restart, sizeof(restart), orig[i].name);
+    }
+    for( struct conf_param* p = conf_params; p->name; p++ ) {
+        if( strcmp(p->src, filename) == 0 && !findConfField(curr, ncurr, p->name) && !findConfField(orig, norig, p->name) )
+            addConfName(restart, sizeof(restart), p->name);
+    }
+    // Apply all at once
+    for( int i=0; i<ncurr; i++ ) {
+        conffield_t* f = &curr[i];
+        switch( f->kind ) {
+        case CONF_HOT: {
+            s2conf_set(filename, f->name, rt_strdupn(f->raw.buf, f->raw.bufsize));
+            addConfName(applied, sizeof(applied), f->name);
+            break;
+        }
+        case CONF_LOGLEVEL: {
+            decodeConfValue(f, 0, value, sizeof(value));
+            log_parseLevels(value);
+            break;
+        }
+        case CONF_FLAG: {
+            u1_t flag = decodeConfValue(f, 1, NULL, 0) ? 2 : 0;   // same encoding as parseStationConf
+            u1_t* pflag = strcmp(f->name, "nocca") == 0 ? &s2e_ccaDisabled
+                : strcmp(f->name, "nodc") == 0 ? &s2e_dcDisabled
+                : &s2e_dwellDisabled;
+            if( *pflag != flag ) {
+                *pflag = flag;
+                addConfName(applied, sizeof(applied), f->name);
+            }
+            break;
+        }
+        case CONF_RESTART: {
+            addConfName(restart, sizeof(restart), f->name);
+            break;
+        }
+        }
+    }
+    s2conf_validate();
+    if( CONF_RELOAD_INTV > 0 && confTmr.next == TMR_NIL )   // polling turned on by this reload
+        rt_setTimerCb(&confTmr, rt_micros_ahead(CONF_RELOAD_INTV), checkConfChange);
+    LOG(MOD_SYS|INFO, "Reloaded %s - applied: %s", filename, applied[0] ? applied : "(no changes)");
+    if( restart[0] )
+        LOG(MOD_SYS|WARNING, "Reloaded %s - changes need a restart: %s", filename, restart);
+    ok = 1;
+  done:
+    rt_free(curr);
+    rt_free(orig);
+    rt_free(origbuf);
+    rt_free(jbuf.buf);
+    return ok;
+}
+
+
+static void checkConfChange (tmr_t* tmr) {
+    str_t fpath = makeFilepath("station.conf","",NULL,0);
+    struct stat st;
+    if( stat(fpath, &st) == 0 && st.st_mtime != confMtime ) {
+        if( confMtime != 0 )
+            sys_reloadStationConf();
+        confMtime = st.st_mtime;
+    }
+    rt_free((void*)fpath);
+    if( CONF_RELOAD_INTV > 0 )   // reload may have turned polling off
+        rt_setTimer(tmr, rt_micros_ahead(CONF_RELOAD_INTV));
+}
+
+
 static struct opts {
     str_t logLevel;
     str_t logFile;
@@ -1028,6 +1226,12 @@ static void startupMaster2 (tmr_t* tmr) {
     rt_addFeature("prod");  // 添加生产环境特性，某些开发/测试/调试特性不被接受
 #endif
     sys_enableCmdFIFO(makeFilepath("~/cmd",".fifo",NULL,0)); // 启用命令FIFO，用于进程间通信
+    if( DNLOCAL_SOCKET[0] )
+        sys_enableDnlocal(makeFilepath(DNLOCAL_SOCKET,"",NULL,0));
+    if( TIMEREFS[0] )
+        sys_iniTimerefs(TIMEREFS);
+    if( CONF_RELOAD_INTV > 0 )
+        rt_yieldTo(&confTmr, checkConfChange);
     if( gpsDevice ) {
         rt_addFeature("gps"); // 如果存在GPS设备，添加GPS特性
         sys_enableGPS(gpsDevice); // 启用GPS设备
@@ -1048,6 +1252,13 @@ static void startupMaster (tmr_t* tmr) {
     }
     // 终止任何旧的进程 - 创建一个包含当前进程ID的文件
     writePid();
+#if defined(CFG_trace)
+    // Dump trace buffer on SIGUSR2 - see also cmdfifo command 'trace'
+    trace_ini(makeFilepath("~temp/station", ".trace", NULL, 0));
+    signal(SIGUSR2, handle_traceSignal);
+#endif // defined(CFG_trace)
+    if( RECORD_FILE[0] )
+        rec_ini(makeFilepath(RECORD_FILE, "", NULL, 0));
     // 如果有待处理的更新 - 执行更新
     sys_runUpdate();
     ral_ini(); // 初始化无线电抽象层，准备与无线电硬件进行通信
@@ -54,5 +54,8 @@ void     sys_writeFile (str_t filename, dbuf_t* data);
 void     sys_startupSlave (int rdfd, int wrfd);
 int      sys_enableGPS (str_t device);
 void     sys_enableCmdFIFO (str_t file);
+void     sys_enableDnlocal (str_t path);
+void     sys_iniTimerefs (str_t specs);
+int      sys_reloadStationConf ();
 
 #endif // _sys_linux_h_
@@ -0,0 +1,305 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if defined(CFG_linux)
+#define _GNU_SOURCE
+#endif // defined(CFG_linux)
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "rt.h"
+#include "sys.h"
+#include "sys_linux.h"
+
+extern char* makeFilepath (const char* prefix, const char* suffix, char** pCachedFile, int isReadable); // sys.c
+
+// Firmware updates are staged by a writer thread so the event loop does not wait
+// for storage while data arrives: CUPS chunks are copied into a ring and written
+// behind, and writeback is kicked off as data comes in. Commit waits for the
+// writer, which makes only the update file and its directory durable (no global
+// sync). The staged file is read back and checked against the CRC of the
+// received data before it is renamed into place.
+
+#define UPD_RING      (256*1024)      // write-behind buffer - must be a power of 2
+#define UPD_KICK      (1024*1024)     // start writeback every so many bytes
+#define UPD_VERIFYBUF (16*1024)
+
+enum { UPD_IDLE, UPD_STAGING, UPD_COMMITTED, UPD_FAILED };
+
+static pthread_mutex_t mx      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  cvWork  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t  cvSpace = PTHREAD_COND_INITIALIZER;
+static pthread_t       thr;
+static int             thrUp;
+
+static u1_t     ring[UPD_RING];
+static u4_t     rhead;          // bytes queued by event loop
+static u4_t     rtail;          // bytes written by writer thread
+static u1_t     commit;         // event loop is done - finish file
+static u1_t     state;
+static int      updfd = -1;
+static u4_t     updlen;         // expected length
+static u4_t     updcrc;         // CRC of data handed to write() - checked against read back
+static str_t    failop;         // writer thread failure: operation and errno
+static int      failerr;
+static ustime_t stalled;        // event loop time spent waiting for ring space
+static char*    updfile;
+static char*    temp_updfile;
+
+
+static int fsyncDir (str_t path) {
+    char dir[strlen(path)+1];
+    strcpy(dir, path);
+    int fd = open(dirname(dir), O_RDONLY|O_DIRECTORY);
+    if( fd == -1 )
+        return 0;
+    int ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+
+// Runs without lock - only touches state owned by writer until commit is seen
+static int verifyStaged () {
+    // File size is no proof - posix_fallocate already extended the file to updlen
+    if( rtail != updlen ) {
+        failop = "size check";
+        failerr = EIO;
+        return 0;
+    }
+    u1_t buf[UPD_VERIFYBUF];
+    u4_t crc = 0;
+    for( u4_t off=0; off < updlen; ) {
+        int n = pread(updfd, buf, min(sizeof(buf), updlen-off), off);
+        if( n <= 0 ) {
+            failop = "read back";
+            failerr = n == 0 ? EIO : errno;
+            return 0;
+        }
+        crc = rt_crc32(crc, buf, n);
+        off += n;
+    }
+    if( crc != updcrc ) {
+        failop = "CRC check";
+        failerr = EIO;
+        return 0;
+    }
+    return 1;
+}
+
+
+static void* thread_update (void* arg) {
+    u4_t kicked = 0;
+    pthread_mutex_lock(&mx);
+    while(1) {
+        while( rtail == rhead && !commit )
+            pthread_cond_wait(&cvWork, &mx);
+        if( rtail == rhead )
+            break;   // commit and all data written
+        u4_t off = rtail & (UPD_RING-1);
+        u4_t n = min(rhead - rtail, UPD_RING - off);
+        pthread_mutex_unlock(&mx);
+        int w = write(updfd, &ring[off], n);
+        int werr = w == 0 ? EIO : errno;
+        if( w > 0 )
+            updcrc = rt_crc32(updcrc, &ring[off], w);
+        if( w > 0 && rtail + w - kicked >= UPD_KICK ) {
+            // Start writeback now so commit only has little left to flush
+            sync_file_range(updfd, kicked, rtail + w - kicked, SYNC_FILE_RANGE_WRITE);
+            kicked = rtail + w;
+        }
+        pthread_mutex_lock(&mx);
+        if( w <= 0 ) {
+            failop = "write";
+            failerr = werr;
+            rtail = rhead;    // drop - event loop must not block on a dead writer
+            commit = 1;
+            pthread_cond_broadcast(&cvSpace);   // event loop may wait for space right now
+            break;
+        }
+        rtail += w;
+        pthread_cond_signal(&cvSpace);
+    }
+    pthread_mutex_unlock(&mx);
+    if( failop == NULL ) {
+        if( fdatasync(updfd) == -1 ) {
+            failop = "fdatasync";
+            failerr = errno;
+        }
+        else if( verifyStaged() ) {
+            if( rename(temp_updfile, updfile) == -1 ) {
+                failop = "rename";
+                failerr = errno;
+            }
+            else if( !fsyncDir(updfile) ) {
+                failop = "directory sync";
+                failerr = errno;
+            }
+        }
+    }
+    close(updfd);
+    updfd = -1;
+    if( failop )
+        unlink(temp_updfile);
+    return NULL;
+}
+
+
+// Wait for the writer thread - returns 1 if an update file is in place
+static int updateWait () {
+    if( !thrUp )
+        return state == UPD_COMMITTED;
+    pthread_mutex_lock(&mx);
+    commit = 1;
+    pthread_cond_signal(&cvWork);
+    pthread_mutex_unlock(&mx);
+    ustime_t t = rt_getTime();
+    pthread_join(thr, NULL);
+    thrUp = 0;
+    t = rt_getTime() - t;
+    if( failop ) {
+        LOG(MOD_SYS|ERROR, "Staging update '%s' failed - %s: %s", temp_updfile, failop, strerror(failerr));
+        state = UPD_FAILED;
+        return 0;
+    }
+    if( state == UPD_STAGING ) {
+        LOG(MOD_SYS|INFO, "Update staged in '%s' (%u bytes) - waited %~T for storage, ring stalls %~T",
+            updfile, updlen, t, stalled);
+        state = UPD_COMMITTED;
+    }
+    return state == UPD_COMMITTED;
+}
+
+
+void sys_updateStart (int len) {
+    if( thrUp ) {
+        // Previous staging still running - abandon it
+        updlen = ~0;     // fails verification
+        updateWait();
+    }
+    state = UPD_IDLE;
+    if( len == 0 )
+        return;
+    makeFilepath("/tmp/update", ".bi_", &temp_updfile, 0);
+    makeFilepath("/tmp/update", ".bin", &updfile, 0);
+    updfd = open(temp_updfile, O_CREAT|O_TRUNC|O_RDWR|O_CLOEXEC, S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
+    if( updfd == -1 ) {
+        LOG(MOD_SYS|ERROR, "Failed to open '%s': %s", temp_updfile, strerror(errno));
+        state = UPD_FAILED;
+        return;
+    }
+    // Reserve space up front - fail early instead of midway through the download
+    int err = posix_fallocate(updfd, 0, len);
+    if( err != 0 && err != EOPNOTSUPP && err != EINVAL ) {
+        LOG(MOD_SYS|ERROR, "Failed to allocate %d bytes for '%s': %s", len, temp_updfile, strerror(err));
+        close(updfd);
+        updfd = -1;
+        unlink(temp_updfile);
+        state = UPD_FAILED;
+        return;
+    }
+    rhead = rtail = 0;
+    commit = 0;
+    updlen = len;
+    updcrc = 0;
+    failop = NULL;
+    stalled = 0;
+    if( pthread_create(&thr, NULL, thread_update, NULL) != 0 ) {
+        LOG(MOD_SYS|ERROR, "Failed to start update writer: %s", strerror(errno));
+        close(updfd);
+        updfd = -1;
+        unlink(temp_updfile);
+        state = UPD_FAILED;
+        return;
+    }
+    thrUp = 1;
+    state = UPD_STAGING;
+}
+
+
+void sys_updateWrite (u1_t* data, int off, int len) {
+    if( state != UPD_STAGING )
+        return;
+    pthread_mutex_lock(&mx);
+    while( len > 0 && !commit ) {
+        u4_t space = UPD_RING - (rhead - rtail);
+        if( space == 0 ) {
+            // Storage slower than download - only now the event loop has to wait
+            ustime_t t = rt_getTime();
+            pthread_cond_wait(&cvSpace, &mx);
+            stalled += rt_getTime() - t;
+            continue;
+        }
+        u4_t roff = rhead & (UPD_RING-1);
+        u4_t n = min(min((u4_t)len, space), UPD_RING - roff);
+        memcpy(&ring[roff], data, n);
+        rhead += n;
+        data += n;
+        len -= n;
+        pthread_cond_signal(&cvWork);
+    }
+    pthread_mutex_unlock(&mx);
+}
+
+
+int sys_updateCommit (int len) {
+    if( len == 0 )
+        return 1;
+    if( state != UPD_STAGING )
+        return 0;
+    if( rhead != len ) {
+        LOG(MOD_SYS|ERROR, "Update incomplete: %u of %d bytes", rhead, len);
+        updlen = ~0;     // writer discards file
+    }
+    return updateWait();
+}
+
+
+void sys_runUpdate () {
+    if( thrUp && !updateWait() )
+        return;
+    makeFilepath("/tmp/update", ".bin", &updfile, 0);
+    if( access(updfile, X_OK) != 0 )
+        return; // no such file or not executable
+    str_t argv[2] = { updfile, NULL };
+    sys_execCommand(0, argv);  // 0=detach, don't wait for update to finish
+}
+
+
+void sys_abortUpdate () {
+    updateWait();
+    state = UPD_IDLE;
+    makeFilepath("/tmp/update", ".bin", &updfile, 0);
+    if( unlink(updfile) == 0 )
+        fsyncDir(updfile);   // must not run at next start
+}
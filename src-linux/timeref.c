@@ -0,0 +1,264 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if defined(CFG_linux)
+#define _GNU_SOURCE  // CLOCK_TAI, struct timex.tai
+
+// Time reference sources feeding timesync (see ts_addTimeref):
+//   /dev/ppsN  kernel PPS (RFC 2783) - edges are timestamped by the kernel in CLOCK_REALTIME,
+//              the second label is taken from the system clock (must be within +/-0.2s)
+//   tai        system clock disciplined by chrony/ptp4l read as CLOCK_TAI
+//   utc        system clock read as CLOCK_REALTIME plus leap seconds
+//   sim        synthetic PPS edges derived from CLOCK_REALTIME - for tests
+// Leap seconds come from the kernel's TAI offset, otherwise from TIMEREF_LEAPS.
+// Apart from 'sim' all sources require the kernel to consider the system clock synchronized.
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/timex.h>
+#include <linux/pps.h>
+
+#include "s2conf.h"
+#include "rt.h"
+#include "sys_linux.h"
+#include "timesync.h"
+
+#define GPS_EPOCH_UNIX   315964800   // GPS epoch in UNIX seconds
+#define TAI_GPS_SECS            19   // TAI - GPS, constant
+#define NS                ((sL_t)1000000000)
+#define PPS_MAX_LABEL_ERR (NS/5)     // max distance of a PPS edge to the system clock second
+#define PPS_MAX_AGE       (2*NS)     // ignore edges older than this when fetched
+#define SIM_JITTER              2    // us
+
+enum { MAX_SYSREFS = 4 };
+enum { REF_PPS, REF_TAI, REF_UTC, REF_SIM };
+
+typedef struct sysref {
+    ts_timeref_t ref;       // must be first
+    int          kind;
+    int          fd;        // kernel PPS device
+    u4_t         seq;       // last PPS assert sequence / sim second
+    u1_t         unsync;    // system clock unsynchronized - reported once
+    u1_t         notai;     // kernel TAI offset not set - reported once
+    char         name[24];
+} sysref_t;
+
+static sysref_t sysrefs[MAX_SYSREFS];
+static int      n_sysrefs;
+
+
+static sL_t timespec2ns (const struct timespec* ts) {
+    return ts->tv_sec*NS + ts->tv_nsec;
+}
+
+// Read clock between two reads of CLOCK_MONOTONIC - keep the narrowest of a few tries.
+// Returns the clock in ns, the matching ustime and half the bracket as error.
+static sL_t readClock (clockid_t clk, ustime_t* ustime, ustime_t* err) {
+    sL_t best_w = -1, best_t = 0, best_u = 0;
+    for( int i=0; i<3; i++ ) {
+        struct timespec a, t, b;
+        clock_gettime(CLOCK_MONOTONIC, &a);
+        clock_gettime(clk, &t);
+        clock_gettime(CLOCK_MONOTONIC, &b);
+        sL_t w = timespec2ns(&b) - timespec2ns(&a);
+        if( best_w < 0 || w < best_w ) {
+            best_w = w;
+            best_u = timespec2ns(&a) + w/2;
+            best_t = timespec2ns(&t);
+        }
+    }
+    *ustime = best_u / 1000;
+    *err = best_w / 2000 + 1;
+    return best_t;
+}
+
+// Query kernel NTP state: GPS-UTC leap seconds and estimated error of the system clock.
+static int kernelClock (sysref_t* r, int* leaps, ustime_t* esterr) {
+    struct timex tx = { .modes = 0 };
+    int state = adjtimex(&tx);
+    if( state == -1 || state == TIME_ERROR || (tx.status & STA_UNSYNC) ) {
+        if( !r->unsync )
+            LOG(MOD_SYN|WARNING, "Time reference %s: system clock not synchronized", r->name);
+        r->unsync = 1;
+        return 0;
+    }
+    if( r->unsync )
+        LOG(MOD_SYN|INFO, "Time reference %s: system clock synchronized (esterror=%ldus)", r->name, tx.esterror);
+    r->unsync = 0;
+    *leaps = tx.tai > TAI_GPS_SECS ? tx.tai - TAI_GPS_SECS : (int)TIMEREF_LEAPS;
+    *esterr = tx.esterror;
+    if( r->kind == REF_TAI && tx.tai <= TAI_GPS_SECS ) {
+        if( !r->notai )
+            LOG(MOD_SYN|ERROR, "Time reference %s: kernel TAI offset not set (%d) - use 'utc' instead", r->name, tx.tai);
+        r->notai = 1;
+        return 0;
+    }
+    r->notai = 0;
+    return 1;
+}
+
+// Label a PPS edge (CLOCK_REALTIME ns) with the second of the system clock
+// and translate it into ustime.
+static int ppsEdge (sysref_t* r, sL_t edge_ns, int leaps) {
+    ustime_t ustime, err;
+    sL_t now_ns = readClock(CLOCK_REALTIME, &ustime, &err);
+    sL_t age_ns = now_ns - edge_ns;
+    if( age_ns < 0 || age_ns > PPS_MAX_AGE )
+        return 0;
+    sL_t secs = (edge_ns + NS/2) / NS;
+    sL_t frac = edge_ns - secs*NS;
+    if( abs(frac) > PPS_MAX_LABEL_ERR ) {
+        LOG(MOD_SYN|VERBOSE, "Time reference %s: PPS edge %ldns off the system clock second - ignored", r->name, frac);
+        return 0;
+    }
+    r->ref.ustime  = ustime - age_ns/1000;
+    r->ref.gpstime = (secs - GPS_EPOCH_UNIX + leaps) * (sL_t)1000000;
+    r->ref.err     = err + 1;
+    return 1;
+}
+
+static int samplePps (ts_timeref_t* ref) {
+    sysref_t* r = (sysref_t*)ref;
+    struct pps_fdata fdata = { 0 };   // zero timeout - do not block
+    if( ioctl(r->fd, PPS_FETCH, &fdata) == -1 ) {
+        LOG(MOD_SYN|ERROR, "Time reference %s: PPS_FETCH failed: %s", r->name, strerror(errno));
+        return 0;
+    }
+    if( fdata.info.assert_sequence == r->seq )
+        return 0;
+    r->seq = fdata.info.assert_sequence;
+    int leaps;
+    ustime_t esterr;
+    if( !kernelClock(r, &leaps, &esterr) )
+        return 0;
+    return ppsEdge(r, fdata.info.assert_tu.sec*NS + fdata.info.assert_tu.nsec, leaps);
+}
+
+#if !defined(CFG_prod)
+static int sampleSim (ts_timeref_t* ref) {
+    sysref_t* r = (sysref_t*)ref;
+    ustime_t ustime, err;
+    sL_t now_ns = readClock(CLOCK_REALTIME, &ustime, &err);
+    if( (u4_t)(now_ns / NS) == r->seq )
+        return 0;
+    r->seq = (u4_t)(now_ns / NS);
+    sL_t jitter = (rand() % (2*SIM_JITTER+1)) - SIM_JITTER;
+    return ppsEdge(r, now_ns / NS * NS + jitter*1000, TIMEREF_LEAPS);
+}
+#endif // !defined(CFG_prod)
+
+static int sampleClock (ts_timeref_t* ref) {
+    sysref_t* r = (sysref_t*)ref;
+    int leaps;
+    ustime_t esterr, ustime, err;
+    if( !kernelClock(r, &leaps, &esterr) )
+        return 0;
+    sL_t t_ns = readClock(r->kind == REF_TAI ? CLOCK_TAI : CLOCK_REALTIME, &ustime, &err);
+    sL_t gps_ns = r->kind == REF_TAI
+        ? t_ns - (GPS_EPOCH_UNIX + TAI_GPS_SECS)*NS
+        : t_ns - (GPS_EPOCH_UNIX - leaps)*NS;
+    r->ref.ustime  = ustime;
+    r->ref.gpstime = gps_ns / 1000;
+    r->ref.err     = err + esterr;
+    return 1;
+}
+
+
+static int addSysref (str_t spec, int len) {
+    if( n_sysrefs >= MAX_SYSREFS ) {
+        LOG(MOD_SYN|ERROR, "Too many time references: %.*s", len, spec);
+        return 0;
+    }
+    sysref_t* r = &sysrefs[n_sysrefs];
+    memset(r, 0, sizeof(*r));
+    snprintf(r->name, sizeof(r->name), "%.*s", len, spec);
+    r->fd = -1;
+    if( strncmp(r->name, "/dev/", 5) == 0 ) {
+        if( (r->fd = open(r->name, O_RDONLY|O_CLOEXEC)) == -1 ) {
+            LOG(MOD_SYN|ERROR, "Time reference %s: cannot open: %s", r->name, strerror(errno));
+            return 0;
+        }
+        struct pps_kparams params;
+        if( ioctl(r->fd, PPS_GETPARAMS, &params) == 0 && !(params.mode & PPS_CAPTUREASSERT) ) {
+            params.mode |= PPS_CAPTUREASSERT;
+            if( ioctl(r->fd, PPS_SETPARAMS, &params) == -1 )
+                LOG(MOD_SYN|WARNING, "Time reference %s: cannot enable assert capture: %s", r->name, strerror(errno));
+        }
+        r->kind = REF_PPS;
+        r->ref.sample = samplePps;
+    }
+    else if( strcmp(r->name, "tai") == 0 ) {
+        r->kind = REF_TAI;
+        r->ref.sample = sampleClock;
+    }
+    else if( strcmp(r->name, "utc") == 0 ) {
+        r->kind = REF_UTC;
+        r->ref.sample = sampleClock;
+    }
+#if !defined(CFG_prod)
+    else if( strcmp(r->name, "sim") == 0 ) {
+        r->kind = REF_SIM;
+        r->ref.sample = sampleSim;
+    }
+#endif // !defined(CFG_prod)
+    else {
+        LOG(MOD_SYN|ERROR, "Unknown time reference: %s", r->name);
+        return 0;
+    }
+    r->ref.name = r->name;
+    if( !ts_addTimeref(&r->ref) ) {
+        if( r->fd >= 0 )
+            close(r->fd);
+        return 0;
+    }
+    n_sysrefs += 1;
+    return 1;
+}
+
+
+void sys_iniTimerefs (str_t specs) {
+    while( *specs ) {
+        str_t e = strchr(specs, ',');
+        int len = e ? e - specs : strlen(specs);
+        while( len > 0 && specs[0] == ' ' ) { specs++; len--; }
+        while( len > 0 && specs[len-1] == ' ' ) len--;
+        if( len > 0 )
+            addSysref(specs, len);
+        if( !e )
+            break;
+        specs = e+1;
+    }
+    if( n_sysrefs )
+        rt_addFeature("timeref");
+}
+
+#endif // defined(CFG_linux)
@@ -33,8 +33,6 @@
 #include "s2conf.h"
 
 static int handle_config_GET(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* b) {
-    b->buf = _rt_malloc(2048,0);
-    b->bufsize = 2048;
     uj_encOpen(b, '{');
     uj_encKey(b, "config");
     uj_encOpen(b, '[');
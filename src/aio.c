@@ -31,6 +31,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include "rt.h"
+#include "trace.h"
 
 
 enum { N_AIO_HANDLES = 10 };
@@ -144,6 +145,7 @@ void aio_loop () {
             }
             n = select(maxfd+1, &rdset, &wrset, NULL, ptimeout);
         } while( n == -1 && errno == EINTR );
+        TRACE(AIO_WAKE, n);
 #if defined(CFG_timerfd)
         if( FD_ISSET(timerFD, &rdset) ) {
             u1_t buf[8];
@@ -46,6 +46,7 @@ static tmr_t   cups_sync_tmr;
 static cups_t* CUPS;
 static int     cups_credset = SYS_CRED_REG;
 static int     cups_failCnt;
+static ustime_t cups_backoff;  // last retry delay after a failure - decorrelated jitter state
 static s1_t    cstateLast;
 
 struct cups_sig {
@@ -59,13 +60,27 @@ struct cups_sig {
     };
 };
 
+// Only one CUPS session exists at a time - signature state does not need the heap
+static cups_sig_t cupsSig;
+
 static int cups_verifySig (cups_sig_t* sig) {
     int verified = 0;
     dbuf_t key;
-    int keyid = -1;
+    // CUPS tells us which key signed the update - go straight for it.
+    // Only if no local key has a matching CRC try all of them.
+    int keyid = sys_findSigkey(sig->keycrc);
+    int onlyone = keyid >= 0;
+    if( onlyone ) {
+        keyid -= 1;
+    } else {
+        LOG(MOD_CUP|WARNING, "No key with CRC %08X - trying all keys", sig->keycrc);
+    }
     while ( (key = sys_sigKey(++keyid)).buf != NULL && !verified ) {
-        if ( key.bufsize != 64 )
+        if ( key.bufsize != 64 ) {
+            if( onlyone )
+                break;
             continue;
+        }
 
         mbedtls_ecp_keypair k;
         mbedtls_ecp_keypair_init(&k);
@@ -88,14 +103,26 @@ static int cups_verifySig (cups_sig_t* sig) {
         mbedtls_ecdsa_free(&ecdsa);
 
         LOG(MOD_CUP|INFO, "ECDSA key#%d -> %s", keyid, verified? "VERIFIED" : "NOT verified");
+        if( onlyone )
+            break;
     }
     sys_sigKey(-1); // Release memory
     if (!verified) {
-        LOG(MOD_CUP|WARNING, "No key could verify signature. Tried %d keys", keyid);
+        if( onlyone ) {
+            LOG(MOD_CUP|WARNING, "Key#%d with CRC %08X could not verify signature", keyid, sig->keycrc);
+        } else {
+            LOG(MOD_CUP|WARNING, "No key could verify signature. Tried %d keys", keyid);
+        }
     }
     return verified;
 }
 
+// Regular check-ins are spread over the last eighth of the interval - a fleet
+// which connected at the same time would otherwise come back all at once.
+static ustime_t cups_okSyncIntv () {
+    return rt_randSpan(CUPS_OKSYNC_INTV - CUPS_OKSYNC_INTV/8, CUPS_OKSYNC_INTV);
+}
+
 static void cups_ondone (tmr_t* tmr) {
     if( CUPS == NULL ) {
         sys_triggerCUPS(0);
@@ -118,6 +145,10 @@ static void cups_ondone (tmr_t* tmr) {
         cups_failCnt += 1;
         if (CUPS->cstate == CUPS_ERR_NOURI)
             log = 0; // already logged
+        // Jitter retries so that gateways do not storm a recovering CUPS in lockstep
+        ahead = cups_backoff = rt_backoff(cups_backoff, CUPS_RESYNC_INTV, max(CUPS_RESYNC_INTV, CUPS_RESYNC_MAX));
+        if( CUPS->hc.c.retryAfter )
+            ahead = max(ahead, min(rt_seconds(CUPS->hc.c.retryAfter), CUPS_OKSYNC_INTV));
     } else {
         // Successful interaction with CUPS
         u1_t uflags = CUPS->uflags;
@@ -166,13 +197,14 @@ static void cups_ondone (tmr_t* tmr) {
         } else {
             detail = uflags ? "" : " (no updates)";
             msg = "Interaction with CUPS done%s - next regular check in %~T";
-            ahead = CUPS_OKSYNC_INTV;
+            ahead = cups_okSyncIntv();
         }
         cups_credset = SYS_CRED_REG;
         cups_failCnt = 0;
+        cups_backoff = 0;
     }
     if( TC && sys_statusTC() == TC_MUXS_CONNECTED )
-        ahead = CUPS_OKSYNC_INTV;
+        ahead = cups_okSyncIntv();
     cups_free(CUPS);
     CUPS = NULL;
     if (log)
@@ -344,12 +376,13 @@ static void cups_update_info (conn_t* _conn, int ev) {
                     LOG(MOD_CUP|INFO, "[Segment] TC Credentials (%d bytes)", segm_len);
                 } else if( cstate == CUPS_FEED_SIGNATURE ) {
                     LOG(MOD_CUP|INFO, "[Segment] FW Signature (%d bytes)", segm_len);
-                    rt_free(cups->sig);
-                    if( segm_len < 8 || segm_len > sizeof(cups->sig->signature) + SIGCRC_LEN ) {
-                        LOG(MOD_CUP|ERROR, "Illegal signature segment length (must be 8-%d bytes): %d", sizeof(cups->sig->signature) + SIGCRC_LEN, segm_len);
+                    cups->sig = NULL;
+                    if( segm_len < 8 || segm_len > sizeof(cupsSig.signature) + SIGCRC_LEN ) {
+                        LOG(MOD_CUP|ERROR, "Illegal signature segment length (must be 8-%d bytes): %d", sizeof(cupsSig.signature) + SIGCRC_LEN, segm_len);
                         goto proto_err;
                     }
-                    cups->sig = rt_malloc(cups_sig_t);
+                    memset(&cupsSig, 0, sizeof(cupsSig));
+                    cups->sig = &cupsSig;
                 } else { // cstate == CUPS_FEED_UPDATE
                     assert(cstate == CUPS_FEED_UPDATE);
                     sys_commitConfigUpdate(); 
@@ -449,7 +482,7 @@ void cups_free (cups_t* cups) {
     cups->cstate = CUPS_ERR_DEAD;
     if (cups->sig) {
         mbedtls_sha512_free(&cups->sig->sha);
-        rt_free(cups->sig);
+        cups->sig = NULL;
     }
     rt_free(cups);
 }
@@ -509,7 +542,7 @@ void sys_triggerCUPS (int delay) {
     }
 #endif // defined(CFG_cups_exclusive)
     if( delay < 0 ) { // 如果延迟时间为负数
-        delay = CUPS_RESYNC_INTV/1000000; // 使用默认重新同步间隔
+        delay = rt_randSpan(CUPS_RESYNC_INTV/2, CUPS_RESYNC_INTV)/1000000; // 使用默认重新同步间隔（加抖动）
     }
     LOG(MOD_CUP|INFO, "Starting a CUPS session in %d seconds.", delay); // 记录CUPS会话启动延迟日志
     sys_inState(SYSIS_CUPS_INTERACT); // 设置系统状态为CUPS交互中
@@ -529,8 +562,9 @@ void sys_clearCUPS () {
 
 void sys_delayCUPS () {
     if( sys_statusCUPS() < 0 ) {
-        LOG(MOD_CUP|INFO, "Next CUPS interaction delayed by %~T.", CUPS_OKSYNC_INTV);
-        rt_setTimer(&cups_sync_tmr, rt_micros_ahead(CUPS_OKSYNC_INTV));
+        ustime_t ahead = cups_okSyncIntv();
+        LOG(MOD_CUP|INFO, "Next CUPS interaction delayed by %~T.", ahead);
+        rt_setTimer(&cups_sync_tmr, rt_micros_ahead(ahead));
     }
 }
 
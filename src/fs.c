@@ -71,6 +71,16 @@
 // End of GC is marked with a FILE record and a filename word 002f2f00 and
 // fncrc=0 ctime=0.
 //
+// Checkpoints are DATA records with the reserved ino CKPT_INO which
+// is never handed out to a file (GC drops them like dead data):
+//
+// [begtag] [CKPT_MAGIC] [faddr] [section magic] [nextIno] [digest] [mac] [endtag]
+//
+// faddr is the address of the checkpoint itself, digest summarizes all FILE/RENAME/DELETE
+// records in front of it and mac is keyed with the flash key. Mount looks for the
+// latest valid checkpoint walking backwards from the end of written flash and
+// only validates the records behind it. Without one it falls back to a full scan.
+//
 
 
 
@@ -99,6 +109,10 @@ static inline u4_t FSTAG_mkEnd(u2_t crc, u2_t len, u1_t pad) {
     return ((crc&0xFFFF)<<16) | (len&0xFFFC)|(pad&3);
 }
 
+#define CKPT_INO   MAX_INO
+#define CKPT_MAGIC 0x54504B43  // CKPT
+#define CKPT_LEN   24
+
 #define FSCMD_FILE   0
 #define FSCMD_DATA   1
 #define FSCMD_RENAME 2
@@ -115,6 +129,7 @@ typedef struct fh {
     u2_t droff;   // offset inside data record
     u4_t faddr;
     u4_t foff;    // file read offset
+    u2_t wblen;   // bytes pending in write buffer
 } fh_t;
 
 
@@ -142,7 +157,15 @@ static u2_t   nextIno;
 static s1_t   fsSection = -1;   // 0|1, -1 no fs_ini called yet
 static const char DEFAULT_CWD[] = "/s2/";
 static str_t  cwd = DEFAULT_CWD;
+static u4_t   flashWritten;     // bytes written since boot (incl. GC copies)
+static u4_t   lastCkpt;         // faddr of last checkpoint (or section start)
+static u4_t   metaDigest;       // digest of all FILE/RENAME/DELETE records in section
 static fh_t   fhTable[FS_MAX_FD];
+// Write buffers - coalesce small appends into one DATA record.
+// Buffered data reaches flash when the buffer fills up, on fs_close, on fs_sync,
+// or before any other operation which could observe it (open/read/stat/rename/unlink).
+// A crash loses only data still buffered - flushed records are always complete.
+static u1_t   wbufTable[FS_MAX_FD][FS_WBUF_SIZE];
 
 static inline u4_t flashFsBeg() {
     return fsSection ? FLASH_BEG_B+4 : FLASH_BEG_A+4;
@@ -176,6 +199,7 @@ void wrFlash1 (u4_t faddr, u4_t data) {
     assert(faddr < (faddr >= FLASH_BEG_B ? FLASH_END_B : FLASH_END_A));
     data = encrypt1(faddr, data);
     sys_writeFlash(faddr, &data, 1);
+    flashWritten += 4;
 }
 
 static void wrFlash1wp (u4_t data) {
@@ -195,6 +219,7 @@ void wrFlashN (u4_t faddr, u4_t* daddr, uint u4cnt, int keepData) {
     assert(faddr + u4cnt*4 <= (faddr >= FLASH_BEG_B ? FLASH_END_B : FLASH_END_A));
     encryptN(faddr, daddr, u4cnt);
     sys_writeFlash(faddr, daddr, u4cnt);
+    flashWritten += u4cnt*4;
     if( keepData )
         decryptN(faddr, daddr, u4cnt);
 }
@@ -249,6 +274,41 @@ static u4_t fnCrc (const char* fn) {
     return UJ_FINISH_CRC(crc);
 }
 
+static u4_t digestMeta (u4_t digest, u4_t begtag, u4_t fncrc) {
+    digest = (digest ^ begtag) * 0x01000193;
+    return (digest ^ fncrc) * 0x01000193;
+}
+
+static u4_t ckptMac (const u4_t* ck) {
+    // Keyed check over checkpoint payload - ties it to this flash key
+    u4_t mac = CRC_INI;
+    for( int i=0; i<4; i++ )
+        mac = (mac ^ flashKey[i]) * 0x01000193;
+    for( int i=0; i<CKPT_LEN/4-1; i++ )
+        mac = (mac ^ ck[i]) * 0x01000193;
+    return mac ^ (mac >> 15);
+}
+
+// Write a checkpoint if enough data accumulated since the last one (or if forced).
+// Only call at record boundaries. Does not touch auxbuf.
+static void fs_checkpoint (int force) {
+    if( !force && flashWP - lastCkpt < FS_CKPT_INTV )
+        return;
+    if( flashWP + CKPT_LEN + 8 > flashFsMax() )
+        return;  // no space - next GC writes one
+    u4_t ck[CKPT_LEN/4+2];
+    ck[0] = FSTAG_mkBeg(FSCMD_DATA, CKPT_INO, CKPT_LEN, 0);
+    ck[1] = CKPT_MAGIC;
+    ck[2] = flashWP;
+    ck[3] = rdFlash1(flashFsBeg()-4);
+    ck[4] = nextIno;
+    ck[5] = metaDigest;
+    ck[6] = ckptMac(&ck[1]);
+    ck[7] = FSTAG_mkEnd(dataCrc(CRC_INI, (u1_t*)&ck[1], CKPT_LEN), CKPT_LEN, 0);
+    lastCkpt = flashWP;
+    wrFlashNwp(ck, SIZE_ARRAY(ck), 0);
+}
+
 static int isFlashFull (u4_t reqbytes) {
     int emergency = 0;
     reqbytes = (reqbytes + 3) & ~3;
@@ -418,7 +478,9 @@ static int fs_handleFile (const char* fn, const char* fn2, u1_t cmd, u2_t ino) {
     auxbuf.u4[0] = FSTAG_mkBeg(cmd, ino, fnlen, 0);
     u4_t dlen4 = fnlen/4+2;
     auxbuf.u4[dlen4-1] = FSTAG_mkEnd(dataCrc(CRC_INI, &auxbuf.u1[4], fnlen), fnlen, 0);
+    metaDigest = digestMeta(metaDigest, auxbuf.u4[0], auxbuf.u4[1]);
     wrFlashNwp(auxbuf.u4, dlen4, 1);
+    fs_checkpoint(0);
     return 0;
 }
 
@@ -448,6 +510,68 @@ static fh_t* fd2fh (int fd) {
 }
 
 
+static int fs_writeRecord (fh_t* fh, const u1_t* data, int dlen) {
+    if( isFlashFull(dlen+8) == -1 )
+        return -1;
+    if( fh->ino > MAX_INO ) {
+        // File did not survive GC triggered above
+        errno = EBADF;
+        return -1;
+    }
+    auxbuf.u4[0] = 0;
+    u2_t  dlenCeil = (dlen+3) & ~3;
+    //u2_t  dcrc = dataCrc(dataCrc(CRC_INI, data, dlen), auxbuf.u1, dlenCeil-dlen);
+    u2_t  dcrc = dataCrc(CRC_INI, data, dlen);
+    int   doff = 0;
+    u1_t  tbeg=0, tend=0;
+    u1_t* tb = &auxbuf.u1[4];
+    int   tblen = sizeof(auxbuf.u1)-8;
+    auxbuf.u4[0] = FSTAG_mkBeg(FSCMD_DATA, fh->ino, dlenCeil, 0);
+    while( !tend ) {
+        int cpylen = dlen-doff;
+        if( cpylen > tblen )
+            cpylen = tblen;
+        doff += cpylen;
+        int cpylen4 = (cpylen+3)/4;
+        if( doff == dlen ) {
+            auxbuf.u4[0+cpylen4] = 0;  // proactively padding
+            auxbuf.u4[1+cpylen4] = FSTAG_mkEnd(dcrc, dlenCeil, dlenCeil-dlen);
+            tend = 1;
+        }
+        memcpy(tb, data+doff-cpylen, cpylen);
+        wrFlashNwp(&auxbuf.u4[tbeg], (1-tbeg)+cpylen4+tend, 0);
+        tbeg = 1;
+    }
+    fs_checkpoint(0);
+    return dlen;
+}
+
+
+static int fs_flushWbuf (fh_t* fh) {
+    int wblen = fh->wblen;
+    if( wblen == 0 )
+        return 0;
+    if( fs_writeRecord(fh, wbufTable[fh-fhTable], wblen) == -1 ) {
+        if( errno == EBADF )
+            fh->wblen = 0;  // file is gone - nothing to keep
+        return -1;
+    }
+    fh->wblen = 0;
+    return 0;
+}
+
+
+// Flush pending write buffers - of all files if ino==0.
+// Must be called before auxbuf is loaded with a filename.
+static void fs_flushAll (u2_t ino) {
+    for( int fdi=0; fdi < FS_MAX_FD; fdi++ ) {
+        fh_t* fh = &fhTable[fdi];
+        if( fh->wblen && fh->ino <= MAX_INO && (ino == 0 || fh->ino == ino) )
+            fs_flushWbuf(fh);
+    }
+}
+
+
 static int fs_findNextDataRecord (fctx_t* fctx, u2_t ino) {
     u4_t faddr = fctx->faddr;
     if( faddr >= flashWP )
@@ -485,6 +609,7 @@ int fs_read (int fd, void* dp, int dlen) {
         errno = EBADF;
         return -1;
     }
+    fs_flushAll(fh->ino);
     fctx_t* fctx = &fctxCache;
     fctx_setTo(fctx, fh->faddr);
     int rlen = 0;
@@ -547,33 +672,32 @@ int fs_write (int fd, const void* dp, int dlen) {
     if( dlen == 0 )
         return 0;
 
-    if( isFlashFull(dlen+8) == -1 )
-        return -1;
-
-    auxbuf.u4[0] = 0;
-    u2_t  dlenCeil = (dlen+3) & ~3;
-    //u2_t  dcrc = dataCrc(dataCrc(CRC_INI, data, dlen), auxbuf.u1, dlenCeil-dlen);
-    u2_t  dcrc = dataCrc(CRC_INI, data, dlen);
-    int   doff = 0;
-    u1_t  tbeg=0, tend=0;
-    u1_t* tb = &auxbuf.u1[4];
-    int   tblen = sizeof(auxbuf.u1)-8;
-    auxbuf.u4[0] = FSTAG_mkBeg(FSCMD_DATA, fh->ino, dlenCeil, 0);
-    while( !tend ) {
-        int cpylen = dlen-doff;
-        if( cpylen > tblen )
-            cpylen = tblen;
-        doff += cpylen;
-        int cpylen4 = (cpylen+3)/4;
-        if( doff == dlen ) {
-            auxbuf.u4[0+cpylen4] = 0;  // proactively padding
-            auxbuf.u4[1+cpylen4] = FSTAG_mkEnd(dcrc, dlenCeil, dlenCeil-dlen);
-            tend = 1;
+    u1_t* wbuf = wbufTable[fh-fhTable];
+    int doff = 0;
+    if( fh->wblen ) {
+        // Top up pending buffer first - flush if full
+        int cpylen = min(dlen, FS_WBUF_SIZE - fh->wblen);
+        memcpy(wbuf + fh->wblen, data, cpylen);
+        fh->wblen += cpylen;
+        doff = cpylen;
+        if( fh->wblen < FS_WBUF_SIZE )
+            return dlen;
+        if( fs_flushWbuf(fh) == -1 ) {
+            if( fh->wblen )
+                fh->wblen -= cpylen;  // caller sees write failed - retract
+            return -1;
         }
-        memcpy(tb, data+doff-cpylen, cpylen);
-        wrFlashNwp(&auxbuf.u4[tbeg], (1-tbeg)+cpylen4+tend, 0);
-        tbeg = 1;
+        if( doff == dlen )
+            return dlen;
+    }
+    if( dlen-doff >= FS_WBUF_SIZE ) {
+        // Large writes bypass the buffer
+        if( fs_writeRecord(fh, data+doff, dlen-doff) == -1 )
+            return doff ? doff : -1;
+        return dlen;
     }
+    memcpy(wbuf, data+doff, dlen-doff);
+    fh->wblen = dlen-doff;
     return dlen;
 }
 
@@ -601,6 +725,7 @@ int fs_chdir (str_t dir) {
 
 
 int fs_unlink (const char* fn) {
+    fs_flushAll(0);
     int fnlen = checkFilename(fn);
 #if defined(CFG_linux)
     if( fnlen == -1 ) {
@@ -616,6 +741,7 @@ int fs_unlink (const char* fn) {
 
 
 int fs_rename (const char* from, const char* to) {
+    fs_flushAll(0);
     int fnlen2 = checkFilename(to);
     int fnlen = checkFilename(from);
     if( fnlen == 0 || fnlen2 == 0 )
@@ -651,6 +777,7 @@ int fs_access (str_t fn, int mode) {
 
 
 int fs_open (str_t fn, int mode, ...) {
+    fs_flushAll(0);
     int fnlen = checkFilename(fn);
 #if defined(CFG_linux)
     if( fnlen == -1 ) {
@@ -678,6 +805,7 @@ int fs_open (str_t fn, int mode, ...) {
         errno = ENFILE;
         return -1;
     }
+    fh->wblen = 0;
 
     if( mode == (O_CREAT|O_WRONLY|O_TRUNC) ) {
         if( fs_createFile(fh, NULL) == -1 )
@@ -730,12 +858,14 @@ int fs_close(int fd) {
 #endif
         return -1;
     }
+    int err = fs_flushWbuf(fh);
     memset(fh, 0, sizeof(*fh));
-    return 0;
+    return err;
 }
 
 
 int fs_stat (str_t fn, struct stat* st) {
+    fs_flushAll(0);
     int fnlen = checkFilename(fn);
 #if defined(CFG_linux)
     if( fnlen == -1 ) {
@@ -798,6 +928,7 @@ int fs_lseek (int fd, int offset, int whence) {
 
 
 void fs_sync () {
+    fs_flushAll(0);
 #if defined(CFG_linux)
     sync();
 #endif // defined(CFG_linux)
@@ -861,12 +992,57 @@ static void fs_smartErase (u4_t pgaddr, u4_t pagecnt) {
 }
 
 
+// Locate latest valid checkpoint in current section.
+// *pfend is set to the end of written flash - everything behind is erased.
+// Returns faddr of checkpoint and payload in ck, or 0 if none found.
+static u4_t fs_findCheckpoint (u4_t* ck, u4_t* pfend) {
+    u4_t fbeg = flashFsBeg();
+    u4_t faddr = flashFsMax();
+    while( faddr > fbeg ) {
+        u4_t len = faddr - fbeg;
+        if( len > AUXBUF_SZ4 )
+            len = AUXBUF_SZ4;
+        int wi = len/4;
+        sys_readFlash(faddr-len, auxbuf.u4, wi);
+        while( wi > 0 && auxbuf.u4[wi-1] == FLASH_ERASED )
+            wi--;
+        if( wi > 0 ) {
+            faddr = faddr - len + wi*4;
+            break;
+        }
+        faddr -= len;
+    }
+    *pfend = faddr;
+    // Walk records backwards - any inconsistency means torn/dirty flash
+    while( faddr > fbeg ) {
+        u4_t len = FSTAG_len(rdFlash1(faddr-4));
+        if( len == 0 || faddr < fbeg + len + 8 )
+            return 0;
+        faddr -= len + 8;
+        u4_t begtag = rdFlash1(faddr);
+        if( FSTAG_len(begtag) != len )
+            return 0;
+        if( FSTAG_cmd(begtag) != FSCMD_DATA || FSTAG_ino(begtag) != CKPT_INO || len != CKPT_LEN )
+            continue;
+        fctx_setTo(&fctxCache, faddr);
+        if( fs_validateRecord(&fctxCache) != CKPT_INO )
+            continue;
+        rdFlashN(faddr+4, ck, CKPT_LEN/4);
+        if( ck[0] == CKPT_MAGIC && ck[1] == faddr && ck[2] == rdFlash1(fbeg-4) &&
+            ck[3] <= MAX_INO && ck[5] == ckptMac(ck) )
+            return faddr;
+        LOG(MOD_SYS|WARNING, "FSCK ignoring invalid checkpoint at 0x%08X", faddr);
+    }
+    return 0;
+}
+
+
 // return:
 //   0 - pristine flash
 //   1 - section recovered as is
 //   2 - GC was required
 //
-int fs_ck () {
+static int fsck (int full) {
     u4_t magic[2];
 
     fsSection = 1;
@@ -881,6 +1057,8 @@ int fs_ck () {
         flashWP = flashFsBeg()-4;
         wrFlash1wp(FLASH_MAGIC<<16);
         nextIno = 1;
+        metaDigest = 0;
+        lastCkpt = flashWP;
         LOG(MOD_SYS|INFO, "FSCK initializing pristine flash");
         return 0;
     }
@@ -902,20 +1080,52 @@ int fs_ck () {
             fsSection+'A', magic[fsSection] & 0xFFFF);
     }
 
-    // Validate current section
+    // Validate current section - from latest checkpoint if there is one
     uint rcnt=0, maxino=0; int ino;
-    fctx_setTo(&fctxCache, flashFsBeg());
-    while( (ino = fs_validateRecord(&fctxCache)) >= 0 ) {
-        if( ino > maxino ) maxino = ino;
+    u4_t ck[CKPT_LEN/4];
+    u4_t wend = 0;
+    u4_t ckaddr = full ? 0 : fs_findCheckpoint(ck, &wend);
+    if( ckaddr ) {
+        maxino = ck[3]-1;
+        metaDigest = ck[4];
+        lastCkpt = ckaddr;
+        fctx_setTo(&fctxCache, ckaddr + CKPT_LEN + 8);
+    } else {
+        metaDigest = 0;
+        lastCkpt = flashFsBeg()-4;
+        fctx_setTo(&fctxCache, flashFsBeg());
+    }
+    while( 1 ) {
+        u4_t faddr = fctxCache.faddr;
+        if( (ino = fs_validateRecord(&fctxCache)) < 0 )
+            break;
         rcnt++;
+        u4_t begtag = rdFlash1(faddr);
+        if( FSTAG_cmd(begtag) != FSCMD_DATA ) {
+            metaDigest = digestMeta(metaDigest, begtag, rdFlash1(faddr+4));
+        }
+        else if( ino == CKPT_INO ) {
+            lastCkpt = faddr;
+            if( rdFlash1(faddr+4+4*4) != metaDigest ) {
+                LOG(MOD_SYS|WARNING, "FSCK checkpoint at 0x%08X does not match file table", faddr);
+            }
+            continue;
+        }
+        if( ino > maxino ) maxino = ino;
     }
     nextIno = maxino+1;           // unlikely ino rollover! -> emergency gc
     flashWP = fctxCache.faddr;
-    LOG(MOD_SYS|INFO, "FSCK section %c: %d records, %d bytes used, %d bytes free",
-        fsSection+'A', rcnt, flashWP - (flashFsBeg()-4), flashFsMax()-flashWP);
+    if( ckaddr ) {
+        LOG(MOD_SYS|INFO, "FSCK section %c: checkpoint at 0x%08X + %d records, %d bytes used, %d bytes free",
+            fsSection+'A', ckaddr, rcnt, flashWP - (flashFsBeg()-4), flashFsMax()-flashWP);
+    } else {
+        LOG(MOD_SYS|INFO, "FSCK section %c: %d records, %d bytes used, %d bytes free",
+            fsSection+'A', rcnt, flashWP - (flashFsBeg()-4), flashFsMax()-flashWP);
+    }
 
+    // Backwards scan of checkpoint search already proved flash behind wend to be erased
     u4_t fend = flashFsMax();
-    u4_t faddr = fctxCache.faddr;
+    u4_t faddr = flashWP == wend ? fend : fctxCache.faddr;
     while( faddr < fend ) {
         u4_t len = fend - faddr;
         if( len > AUXBUF_SZ4 )
@@ -936,9 +1146,18 @@ int fs_ck () {
     // Do a smart erase of the other section
     fs_smartErase(fsSection ? FLASH_BEG_A : FLASH_BEG_B, FS_PAGE_CNT/2);
     LOG(MOD_SYS|INFO, "FSCK section %c followed by erased flash - all clear.", fsSection+'A');
+    fs_checkpoint(0);
     return 1;
 }
 
+int fs_ck () {
+    return fsck(0);
+}
+
+int fs_ckFull () {
+    return fsck(1);
+}
+
 
 void fs_info(fsinfo_t* infop) {
     infop->fbasep   = sys_ptrFlash();
@@ -949,6 +1168,7 @@ void fs_info(fsinfo_t* infop) {
     infop->gcCycles = rdFlash1(flashFsBeg()-4) & 0xFFFF;
     infop->used = flashWP - flashFsBeg() + 4;
     infop->free = flashFsMax() - flashWP;
+    infop->written = flashWritten;
     u4_t rcnt = 0;
     u4_t faddr = flashFsBeg();
     while( faddr < flashWP ) {
@@ -976,6 +1196,7 @@ void fs_gc (int emergency) {
     fsSection ^= 1;
     wrFlash1wp(rdFlash1(flashFsBeg()-4) + 1);
     nextIno = 1;
+    metaDigest = 0;
 
     while( faddrCont < faddrEnd ) {
         // Start a new collect phase - gather a set inodes
@@ -1072,6 +1293,7 @@ void fs_gc (int emergency) {
                     continue; // do not copy over any log files
             }
             auxbuf.u4[0] = FSTAG_mkBeg(FSCMD_FILE, nextIno+ui, len, 0);
+            metaDigest = digestMeta(metaDigest, auxbuf.u4[0], auxbuf.u4[1]);
             wrFlashNwp(auxbuf.u4, len/4+2, 0);
 
             // Fixup open file table
@@ -1106,6 +1328,7 @@ void fs_gc (int emergency) {
     }
     sys_eraseFlash(flashFsBeg()-4, FS_PAGE_CNT/2);
     fsSection ^= 1;
+    fs_checkpoint(1);
 
     for( int fdi=0; fdi < FS_MAX_FD; fdi++ ) {
         if( fhTable[fdi].ino != 0 &&
@@ -1307,6 +1530,7 @@ int fs_shell (char* cmdline) {
     if( strcmp(argv[0], "?") == 0 || strcmp(argv[0], "h") == 0 || strcmp(argv[0], "help") == 0 ) {
         printf("fscmd command list:\n"
                " dump fsck ersase gc info (no arguments)\n"
+               " fsck full (ignore checkpoints)\n"
                " unlink access stat read write (args: FILE)\n"
                " rename (args: OLDFILE NEWFILE)\n"
                );
@@ -1316,7 +1540,7 @@ int fs_shell (char* cmdline) {
         return fs_dump(NULL) == 1 ? 0 : 1;
     }
     if( strcmp(argv[0], "fsck") == 0 ) {
-        return fs_ck();
+        return argv[1] != NULL && strcmp(argv[1], "full") == 0 ? fs_ckFull() : fs_ck();
     }
     if( strcmp(argv[0], "erase") == 0 ) {
         fs_erase();
@@ -1335,11 +1559,12 @@ int fs_shell (char* cmdline) {
                "records=%d\n"
                "used=%d bytes\n"
                "free=%d bytes\n"
+               "written=%u bytes\n"
                "key=%08X-%08X-%08X-%08X\n",
                i.fbase, i.pagecnt, i.pagesize,
                i.activeSection+'A',
                i.gcCycles,
-               i.records, i.used, i.free,
+               i.records, i.used, i.free, i.written,
                i.key[0], i.key[1], i.key[2], i.key[3]);
         return 0;
     }
@@ -1401,9 +1626,9 @@ int fs_shell (char* cmdline) {
         int n, fd = err = fs_open(argv[1], O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP);
         while( err >= 0 && (n=fread(buf, 1, sizeof(buf), stdin)) > 0 )
             err = fs_write(fd, buf, n);
+        if( fd >= 0 && fs_close(fd) == -1 && err >= 0 )
+            err = -1;  // flushing buffered data failed
         goto check_err;
-        //fs_close(fd);
-        //return fd>=0 && n == 0 && err > 0 ? 0 : 1;
     }
 
     printf("Unknown command: %s\n", argv[0]);
@@ -57,6 +57,7 @@ int  fs_fnNormalize (const char* fn, char* wb, int maxsz);
 
 int  fs_ini   (u4_t key[4]);
 int  fs_ck    ();
+int  fs_ckFull ();
 void fs_erase ();
 void fs_gc    (int emergency);
 int  fs_dump  (void (*logfn)(u1_t mod_level, const char* fmt, ...));
@@ -72,6 +73,7 @@ typedef struct fsinfo {
     u4_t  records;
     u4_t  used;
     u4_t  free;
+    u4_t  written;   // flash bytes written since boot
     u4_t  key[4];
 } fsinfo_t;
 
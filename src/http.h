@@ -86,6 +86,7 @@ int    http_statusCode (char* p);
 int    http_icaseCmp   (const char* p, const char* what);
 char*  http_findHeader (char* p, const char* field);
 int    http_findContentLength (char* p);
+int    http_findRetryAfter    (char* p);
 int    http_setContentLength  (char* p, int clen);
 dbuf_t http_statusText (dbuf_t* hdr);
 int    http_unquote    (char** p);
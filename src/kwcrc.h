@@ -124,6 +124,11 @@
 #define J_web_port             ((ujcrc_t)(0xA9963701))
 #define J_web_dir              ((ujcrc_t)(0xCDD77DAA))
 #define J_xtime                ((ujcrc_t)(0x759DF115))
+#define J_jreq_dedup           ((ujcrc_t)(0xFD8EEDF5))
+#define J_window               ((ujcrc_t)(0xEF061CF1))
+#define J_entries              ((ujcrc_t)(0x84795CF1))
+#define J_linkstats            ((ujcrc_t)(0xE3988488))
+#define J_interval             ((ujcrc_t)(0x306C7E89))
 #define J_bandwidth            ((ujcrc_t)(0x0188BDD4))
 #define J_chan_FSK             ((ujcrc_t)(0x399777C1))
 #define J_chan_Lora_std        ((ujcrc_t)(0xAE60A484))
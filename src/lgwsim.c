@@ -121,6 +121,43 @@ static sL_t xticks () {
 }
 
 
+// Real HAL calls are a series of blocking SPI transactions.
+// Model their cost as a base latency with jitter plus a share
+// proportional to the data moved (RX frames read, TX bytes loaded).
+static ustime_t halCost (u4_t units, u4_t unitCost) {
+    ustime_t us = LGWSIM_HAL_LATENCY + (ustime_t)units * unitCost;
+    if( LGWSIM_HAL_JITTER )
+        us += rand() % (LGWSIM_HAL_JITTER+1);
+    return us;
+}
+
+// Registers are sampled amid the transactions of a call:
+// halEnter blocks for the first half of the cost, halLeave for the rest.
+static ustime_t halEnter () {
+    ustime_t us = halCost(0, 0);
+    sys_usleep(us/2);
+    return us - us/2;
+}
+
+static void halLeave (ustime_t us) {
+    sys_usleep(us);
+}
+
+// Frame must be in the radio before its TX time - otherwise it is lost.
+// Without a cost model frames are taken as is.
+static int txLoaded (sL_t txtime, int plen) {
+    ustime_t us = halCost(plen, LGWSIM_TXBYTE_COST);
+    if( us == 0 )
+        return 1;
+    sys_usleep(us);
+    sL_t late = xticks() - txtime;
+    if( late < 0 )
+        return 1;
+    LOG(MOD_SIM|ERROR, "LGWSIM(%s): TX frame loaded %ldus too late", sockAddr.sun_path, late);
+    return 0;
+}
+
+
 static u4_t airtime (int datarate, int bandwidth, int plen) {
     int sf, bw;
 #if defined(CFG_lgw1)
@@ -269,6 +306,7 @@ int lgw_receive (uint8_t max_pkt, struct lgw_pkt_rx_s *pkt_data) {
         rx_ridx = (rx_ridx+sizeof(rx_pkts[0])) % rxblen;
         npkts += 1;
     }
+    sys_usleep(halCost(npkts, LGWSIM_RXPKT_COST));
     if( npkts )
         LOG(MOD_SIM|DEBUG, "LGWSIM(%s): received %d packets", sockAddr.sun_path, npkts);
     return npkts;
@@ -281,6 +319,10 @@ int lgw_send (struct lgw_pkt_tx_s pkt_data) {
     txend = txbeg + airtime(pkt_data.datarate, pkt_data.bandwidth, pkt_data.size);
     if( !cca(txbeg, pkt_data.freq_hz) )
         return LGW_LBT_ISSUE;
+    if( !txLoaded(txbeg, pkt_data.size) ) {
+        txbeg = txend = 0;
+        return LGW_HAL_ERROR;
+    }
     tx_pkt = pkt_data;
     if( !aio || aio->ctx == NULL || aio->fd == 0 )
         return LGW_HAL_ERROR;
@@ -291,7 +333,9 @@ int lgw_send (struct lgw_pkt_tx_s pkt_data) {
 
 
 int lgw_status (uint8_t select, uint8_t *code) {
+    ustime_t rest = halEnter();
     sL_t t = xticks();
+    halLeave(rest);
     if( t <= txbeg )
         *code = TX_SCHEDULED;
     else if( t <= txend )
@@ -318,9 +362,11 @@ int lgw_stop (void) {
 
 
 int lgw_get_trigcnt(uint32_t* trig_cnt_us) {
+    ustime_t rest = halEnter();
     sL_t t = xticks();
     if( ppsLatched )
         t -= sys_utc()%1000000;
+    halLeave(rest);
     trig_cnt_us[0] = t;
     return LGW_HAL_SUCCESS;
 }
@@ -1138,6 +1184,7 @@ int sx1301ar_fetch( uint8_t brd, sx1301ar_rx_pkt_t * p, uint8_t max_nb, uint8_t
         rx_ridx = (rx_ridx+sizeof(rx_pkts[0])) % rxblen;
         npkts += 1;
     }
+    sys_usleep(halCost(npkts, LGWSIM_RXPKT_COST));
     if( npkts )
         LOG(MOD_SIM|DEBUG, "LGWSIM(%s): received %d packets", sockAddr.sun_path, npkts);
     *nb_pkt = npkts;
@@ -1150,6 +1197,10 @@ int sx1301ar_send( uint8_t brd, const sx1301ar_tx_pkt_t * p ) {
     txend = txbeg + airtime(p->modrate, p->bandwidth, p->size);
     if( !cca(txbeg, p->freq_hz) )
         return -1;
+    if( !txLoaded(txbeg, p->size) ) {
+        txbeg = txend = 0;
+        return -1;
+    }
     tx_pkt = *p;
     if( !aio || aio->ctx == NULL || aio->fd == 0 )
         return -1;
@@ -1159,7 +1210,9 @@ int sx1301ar_send( uint8_t brd, const sx1301ar_tx_pkt_t * p ) {
 }
 
 int sx1301ar_tx_status( uint8_t brd, sx1301ar_tstat_t * s ) {
+    ustime_t rest = halEnter();
     sL_t t = xticks();
+    halLeave(rest);
     if( t <= txbeg )
         *s = TX_SCHEDULED;
     else if( t <= txend )
@@ -1180,14 +1233,18 @@ int sx1301ar_abort_tx( uint8_t brd ) {
 // }
 
 int sx1301ar_get_instcnt( uint8_t brd, uint32_t * cnt_us ) {
+    ustime_t rest = halEnter();
     sL_t t = xticks();
+    halLeave(rest);
     cnt_us[0] = t & 0xFFffFFff;
     return 0;
 }
 
 int sx1301ar_get_trigcnt( uint8_t brd, uint32_t * cnt_us ) {
+    ustime_t rest = halEnter();
     sL_t t = xticks();
     t -= sys_utc()%1000000;
+    halLeave(rest);
     cnt_us[0] = t  & 0xFFffFFff;
     return 0;
 }
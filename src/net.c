@@ -35,6 +35,7 @@
 #include "httpd.h"
 #include "tls.h"
 #include "kwcrc.h"
+#include "trace.h"
 
 str_t const SUFFIX2CT[] = {
     "txt",  "text/plain",
@@ -275,6 +276,27 @@ int http_findContentLength (char* p) {
     return http_readDec(http_findHeader(p, "content-length"));
 }
 
+// Retry-After in delta seconds - HTTP-date form is not supported (returns 0)
+int http_findRetryAfter (char* p) {
+    int secs = http_readDec(http_findHeader(p, "retry-after"));
+    return max(secs, 0);
+}
+
+// Servers may put "retry-after=<secs>" into the text of a WS close frame
+static u4_t ws_closeRetryAfter (const u1_t* p, int len) {
+    static const char KEY[] = "retry-after";
+    for( int i=0; i+(int)sizeof(KEY) < len; i++ ) {
+        int n = http_icaseCmp((const char*)p+i, KEY);
+        if( n && (p[i+n] == '=' || p[i+n] == ':') ) {
+            int secs = 0, c;
+            for( i += n+1; i < len && (c=p[i]) >= '0' && c <= '9'; i++ )
+                secs = min(secs*10 + (c-'0'), 86400);
+            return secs;
+        }
+    }
+    return 0;
+}
+
 // Find content-length header and replace subsequent stretch of 00000
 // with actual length clearing excess zeros with blanks. You must provide
 // enough 0s so that the actual length will fit in.
@@ -330,6 +352,73 @@ enum { WSHDR_FIN    = 0x80,
 };
 
 
+// Masking keys are drawn from a xorshift64* generator seeded once from
+// the system's entropy source. Keys need to be unpredictable to
+// intermediaries (RFC 6455 section 5.3) but are not secrets themselves.
+static uL_t maskState;
+
+static u4_t ws_nextMaskKey () {
+    uL_t x = maskState;
+    while( x == 0 ) {
+        sys_seed((u1_t*)&x, sizeof(x));
+        if( x == 0 )
+            x = sys_time();
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    maskState = x;
+    return (u4_t)((x * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+#if defined(__GNUC__)
+typedef u1_t wsmask_v16_t __attribute__((vector_size(16)));
+#endif
+
+// XOR len bytes at buf with the 4 byte masking key.
+// Bulk of the data is processed 16 bytes at a time (vector registers where the
+// compiler supports them), the remainder byte by byte. Since 16 is a multiple
+// of 4 the key phase is preserved across the two loops.
+void ws_mask (u1_t* buf, int len, const u1_t key[4]) {
+    int i = 0;
+    if( len >= 16 ) {
+        u1_t k16[16];
+        for( int j=0; j<16; j++ )
+            k16[j] = key[j&3];
+#if defined(__GNUC__)
+        wsmask_v16_t m, w;
+        memcpy(&m, k16, 16);
+        for( ; i+16 <= len; i+=16 ) {
+            memcpy(&w, buf+i, 16);
+            w ^= m;
+            memcpy(buf+i, &w, 16);
+        }
+#else
+        uL_t m[2], w[2];
+        memcpy(m, k16, 16);
+        for( ; i+16 <= len; i+=16 ) {
+            memcpy(w, buf+i, 16);
+            w[0] ^= m[0];
+            w[1] ^= m[1];
+            memcpy(buf+i, w, 16);
+        }
+#endif
+    }
+    for( ; i < len; i++ )
+        buf[i] ^= key[i&3];
+}
+
+// Write a fresh masking key at buf[-4..-1] and mask the following len bytes
+static void ws_maskFrame (u1_t* buf, int len) {
+    u4_t k = ws_nextMaskKey();
+    buf[-4] = k;
+    buf[-3] = k>>8;
+    buf[-2] = k>>16;
+    buf[-1] = k>>24;
+    ws_mask(buf, len, buf-4);
+}
+
+
 // Write data between wpos..wend
 static int writeData (conn_t* conn) {
     int ret;
@@ -339,8 +428,10 @@ static int writeData (conn_t* conn) {
                 log_mbedError(MOD_AIO|ERROR, ret, "[%d] Send failed", conn->netctx.fd);
                 return IO_ERROR;
             }
+            TRACE(WS_WRPEND, conn->wend - conn->wpos);
             return IO_WRPEND;
         }
+        TRACE(WS_WRITE, ret);
         LOG(MOD_AIO|XDEBUG, "[%d] socket write bytes=%d", conn->netctx.fd, ret);
         conn->wpos += ret;
     }
@@ -491,9 +582,9 @@ static void ws_closing_w (aio_t* aio) {
         u1_t* p = conn->wbuf;
         p[0] = WSHDR_FIN | WSHDR_CLOSE;
         p[1] = 2 | WSHDR_MASK;
-        p[2] = p[3] = p[4] = p[5] = 0;
         p[6] = conn->creason>>8;
         p[7] = conn->creason;
+        ws_maskFrame(p+6, 2);
         conn->state += WS_CLOSING_SENDCLOSE - WS_CLOSING_DRAINC;
         LOG(MOD_AIO|DEBUG, "%s close - reason=%d",
             conn->state == WS_CLOSING_DRAINC ? "Initiating" : "Echoing", conn->creason);
@@ -550,10 +641,8 @@ static void ws_connected_w (aio_t* aio) {
         conn->wpos = wend-8;
     }
     conn->wend = wend + dlen;
-    // Masking value - 0
-    wbuf[wend-4] = wbuf[wend-3] = wbuf[wend-2] = wbuf[wend-1] = 1;
-    for( int i=0; i<dlen; i++ )
-        wbuf[wend+i] ^= 1;
+    ws_maskFrame(wbuf+wend, dlen);
+    TRACE(WS_FRAME_TX, dlen | (ftype<<16));
     goto again;
 }
 
@@ -573,6 +662,7 @@ static void ws_connected_r (aio_t* aio) {
     assert(e==IO_RDDONE);
     u1_t* p = &conn->rbuf[conn->rbeg];
     u1_t opcode = p[-1];
+    TRACE(WS_FRAME_RX, (conn->rend - conn->rbeg) | (opcode<<16));
     switch(opcode) {
     case WSHDR_PING: {
         int plen = conn->rend-conn->rbeg;
@@ -614,8 +704,11 @@ static void ws_connected_r (aio_t* aio) {
         break;
     }
     case WSHDR_CLOSE: {
+        int plen = conn->rend - conn->rbeg;
         u2_t reason = rt_rmsbf2(p);
-        LOG(MOD_AIO|DEBUG, "[%d|WS] Server sent close: reason=%d", conn->netctx.fd, reason);
+        if( plen > 2 )
+            conn->retryAfter = ws_closeRetryAfter(p+2, plen-2);
+        LOG(MOD_AIO|DEBUG, "[%d|WS] Server sent close: reason=%d retry-after=%ds", conn->netctx.fd, reason, conn->retryAfter);
         if( conn->state > WS_CONNECTED ) {
             ws_shutdown(conn);
             return;
@@ -752,7 +845,9 @@ static void ws_connecting (aio_t* aio) {
         // IO_RDDONE - check header
         int scode = http_statusCode((char*)conn->rbuf);
         if( scode != 101 ) {
-            LOG(MOD_AIO|ERROR, "[%d] WS upgrade failed with HTTP status code: %d", conn->netctx.fd, scode);
+            conn->retryAfter = http_findRetryAfter((char*)conn->rbuf);
+            LOG(MOD_AIO|ERROR, "[%d] WS upgrade failed with HTTP status code: %d%s", conn->netctx.fd, scode,
+                conn->retryAfter ? " (server requested retry-after)" : "");
             ws_shutdown(conn);
             return;
         }
@@ -818,6 +913,7 @@ void ws_sendData (ws_t* conn, dbuf_t* b, int binaryData) {
     if( conn->state != WS_CONNECTED )
         return;
     int n = b->pos;
+    TRACE(WS_SEND, n | (binaryData<<16));
     b->buf[0-WSHDR_INTRA] = n>>8;
     b->buf[1-WSHDR_INTRA] = n;
     b->buf[2-WSHDR_INTRA] = binaryData ? WSHDR_BINARY : WSHDR_TEXT;
@@ -984,6 +1080,7 @@ static void http_read (aio_t* aio) {
             conn->extra.coff = conn->extra.clen = clen = 0;
         }
         conn->c.creason = http_statusCode(hdr);
+        conn->c.retryAfter = http_findRetryAfter(hdr);
         conn->c.rbeg = conn->c.rend;  // remember end header / start of body
         conn->c.rend += clen;
         conn->c.state = HTTP_READING_BODY;
@@ -1481,13 +1578,17 @@ int conn_setup_tls (conn_t* conn, int cred_cat, int cred_set, const char* server
     }
     if( auth == SYS_AUTH_TOKEN ) {
         errmsg = "%s%s has no cert configured - running server auth and client auth with token";
-        dbuf_t dbuf = sys_readFile(elems[SYS_CRED_MYKEY]);
-        if( dbuf.buf == NULL ) {
-            errmsg = "%s%s has unreadable client auth token";
-            goto errexit;
+        if( elemslen[SYS_CRED_MYKEY] > 0 ) {
+            conn->authtoken = validateAuthToken(elems[SYS_CRED_MYKEY]);
+        } else {
+            dbuf_t dbuf = sys_readFile(elems[SYS_CRED_MYKEY]);
+            if( dbuf.buf == NULL ) {
+                errmsg = "%s%s has unreadable client auth token";
+                goto errexit;
+            }
+            conn->authtoken = validateAuthToken(dbuf.buf);
+            rt_free(dbuf.buf);
         }
-        conn->authtoken = validateAuthToken(dbuf.buf);
-        rt_free(dbuf.buf);
         if( !conn->authtoken ) {
             errmsg = "%s%s contains malformed auth token - expecting: {header: value{\\r\\n|\\n}}*";
             goto errexit;
@@ -56,6 +56,7 @@ typedef struct conn {
     u1_t     state;
     s1_t     optemp;   // some temp value related to opctx
     u2_t     creason;  // close reason
+    u4_t     retryAfter; // server asked us to stay away this long [s] (0=no hint)
     evcb_t   evcb;
 
     netctx_t   netctx;
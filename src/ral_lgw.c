@@ -38,6 +38,7 @@
 #include "sys.h"
 #include "sx130xconf.h"
 #include "ral.h"
+#include "trace.h"
 #include "lgw/loragw_reg.h"
 #include "lgw/loragw_hal.h"
 #if defined(CFG_sx1302)
@@ -189,6 +190,7 @@ static tmr_t      syncTmr;
 static void synctime (tmr_t* tmr) {
     timesync_t timesync;
     int quality = ral_getTimesync(pps_en, &last_xtime, &timesync);
+    TRACE(TS_RADIO, quality);
     ustime_t delay = ts_updateTimesync(0, quality, &timesync);
     rt_setTimer(&syncTmr, rt_micros_ahead(delay));
 }
@@ -298,6 +300,7 @@ static void log_rawpkt(u1_t level, str_t msg, struct lgw_pkt_rx_s * pkt_rx) {
 //ATTR_FASTCODE 
 static void rxpolling (tmr_t* tmr) {
     int rounds = 0;
+    TRACE(RXPOLL_BEG, 0);
     while(rounds++ < RAL_MAX_RXBURST) {
         struct lgw_pkt_rx_s pkt_rx;
         int n = lgw_receive(1, &pkt_rx);
@@ -348,9 +351,11 @@ static void rxpolling (tmr_t* tmr) {
             log_rawpkt(XDEBUG, "", &pkt_rx);
         }
 
+        TRACE(RX_FRAME, rxjob->len | (rxjob->dr<<8) | (rxjob->rctx<<16));
         s2e_addRxjob(&TC->s2ctx, rxjob);
 
     }
+    TRACE(RXPOLL_END, rounds-1);
     s2e_flushRxjobs(&TC->s2ctx);
     rt_setTimer(tmr, rt_micros_ahead(RX_POLL_INTV));
 }
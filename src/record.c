@@ -0,0 +1,244 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "s2conf.h"
+#include "sys.h"
+#include "uj.h"
+#include "xq.h"
+#include "record.h"
+
+#define REC_MAGIC      { 'S','2','R','C' }
+#define REC_VERSION    1
+#define REC_FLUSH_INTV rt_seconds(1)
+#define REC_MAXHDR     (1+10+5)    // type + varint dt + varint len
+
+struct rec_hdr {
+    char magic[4];
+    u2_t version;
+    u2_t _reserved;
+    sL_t ustime;
+    sL_t utcOffset;
+};
+
+u1_t rec_on;
+
+static int      recFd = -1;
+static pid_t    recPid;         // child processes must not flush the inherited buffer
+static u4_t     recSize;        // bytes written to file
+static u4_t     recFill;        // bytes pending in recBuf
+static ustime_t recLast;        // time of previous record
+static ustime_t recFlushed;
+static u1_t     recBuf[16*1024];
+
+
+static int writeAll (int fd, const void* data, int len) {
+    const u1_t* p = data;
+    while( len > 0 ) {
+        int n = write(fd, p, len);
+        if( n <= 0 )
+            return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+
+static void recStop () {
+    close(recFd);
+    recFd = -1;
+    rec_on = 0;
+}
+
+
+void rec_flush () {
+    if( recFd < 0 || recFill == 0 || getpid() != recPid )
+        return;
+    if( !writeAll(recFd, recBuf, recFill) ) {
+        LOG(MOD_SYS|ERROR, "Recording stopped - write failed: %s", strerror(errno));
+        recStop();
+        return;
+    }
+    recSize += recFill;
+    recFill = 0;
+    recFlushed = rt_getTime();
+}
+
+
+static void putLsbf (u1_t* p, uL_t v, int n) {
+    for( int i=0; i<n; i++, v>>=8 )
+        p[i] = v;
+}
+
+
+static u1_t* putVarint (u1_t* p, uL_t v) {
+    while( v >= 0x80 ) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+
+static void addRecord (u1_t type, const u1_t* fix, int fixlen, const void* data, int datalen) {
+    ustime_t now = rt_getTime();
+    u4_t len = fixlen + datalen;
+    if( recSize + recFill + REC_MAXHDR + len > RECORD_MAXSIZE ) {
+        rec_flush();
+        LOG(MOD_SYS|WARNING, "Recording stopped - file reached %u bytes", recSize);
+        recStop();
+        return;
+    }
+    u1_t hdr[REC_MAXHDR];
+    u1_t* p = hdr;
+    *p++ = type;
+    p = putVarint(p, now - recLast);
+    p = putVarint(p, len);
+    int hdrlen = p - hdr;
+    recLast = now;
+    if( recFill + hdrlen + len > sizeof(recBuf) ) {
+        rec_flush();
+        if( !rec_on )
+            return;
+        if( hdrlen + len > sizeof(recBuf) ) {
+            // Oversized record (e.g. large router_config) - bypass buffer
+            if( !writeAll(recFd, hdr, hdrlen) || !writeAll(recFd, fix, fixlen) || !writeAll(recFd, data, datalen) ) {
+                LOG(MOD_SYS|ERROR, "Recording stopped - write failed: %s", strerror(errno));
+                recStop();
+                return;
+            }
+            recSize += hdrlen + len;
+            return;
+        }
+    }
+    u1_t* b = &recBuf[recFill];
+    memcpy(b, hdr, hdrlen);
+    memcpy(b+hdrlen, fix, fixlen);
+    memcpy(b+hdrlen+fixlen, data, datalen);
+    recFill += hdrlen + len;
+    if( now - recFlushed >= REC_FLUSH_INTV )
+        rec_flush();
+}
+
+
+void rec_ini (str_t file) {
+    if( recFd >= 0 )
+        recStop();
+    int fd = open(file, O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if( fd == -1 ) {
+        LOG(MOD_SYS|ERROR, "Failed to open record file '%s': %s", file, strerror(errno));
+        return;
+    }
+    ustime_t now = rt_getTime();
+    struct rec_hdr hdr = {
+        .magic     = REC_MAGIC,
+        .version   = REC_VERSION,
+        .ustime    = now,
+        .utcOffset = rt_utcOffset,
+    };
+    if( !writeAll(fd, &hdr, sizeof(hdr)) ) {
+        LOG(MOD_SYS|ERROR, "Failed to write record file '%s': %s", file, strerror(errno));
+        close(fd);
+        return;
+    }
+    recFd = fd;
+    recPid = getpid();
+    recSize = sizeof(hdr);
+    recFill = 0;
+    recLast = recFlushed = now;
+    rec_on = 1;
+    static int once;
+    if( !once ) {
+        once = 1;
+        atexit(rec_flush);
+    }
+    char json[128];
+    ujbuf_t b = { .buf = json, .bufsize = sizeof(json), .pos = 0 };
+    uj_encOpen(&b, '{');
+    uj_encKVn(&b,
+              "station",  's', CFG_version,
+              "model",    's', CFG_platform,
+              "eui",      'E', sys_eui(),
+              NULL);
+    uj_encClose(&b, '}');
+    addRecord(REC_SESSION, NULL, 0, json, b.pos);
+    LOG(MOD_SYS|INFO, "Recording session to '%s' (max %u bytes)", file, RECORD_MAXSIZE);
+}
+
+
+void rec_rx (const rxjob_t* rxjob, u1_t rps, const u1_t* frame) {
+    u1_t fix[8+8+4+3];
+    putLsbf(&fix[0], rxjob->xtime, 8);
+    putLsbf(&fix[8], rxjob->rctx, 8);
+    putLsbf(&fix[16], rxjob->freq, 4);
+    fix[20] = rps;
+    fix[21] = rxjob->rssi;
+    fix[22] = rxjob->snr;
+    addRecord(REC_RX, fix, sizeof(fix), frame, rxjob->len);
+}
+
+
+void rec_text (u1_t type, const char* text, int len) {
+    addRecord(type, NULL, 0, text, len);
+}
+
+
+void rec_timesync (u1_t txunit, int quality, ustime_t ustime, sL_t xtime, sL_t pps_xtime) {
+    u1_t fix[1+4+8+8+8];
+    fix[0] = txunit;
+    putLsbf(&fix[1], quality, 4);
+    putLsbf(&fix[5], ustime, 8);
+    putLsbf(&fix[13], xtime, 8);
+    putLsbf(&fix[21], pps_xtime, 8);
+    addRecord(REC_TIMESYNC, fix, sizeof(fix), NULL, 0);
+}
+
+
+void rec_timer (tmrcb_t cb) {
+    u1_t fix[4];
+    putLsbf(&fix[0], (s4_t)((ptrdiff_t)cb - (ptrdiff_t)rt_processTimerQ), 4);
+    addRecord(REC_TIMER, fix, sizeof(fix), NULL, 0);
+}
+
+
+void rec_tx (u1_t what, const txjob_t* txjob) {
+    u1_t fix[1+8+1+1+4+4+1];
+    fix[0] = what;
+    putLsbf(&fix[1], txjob->diid, 8);
+    fix[9]  = txjob->txunit;
+    fix[10] = txjob->dr;
+    putLsbf(&fix[11], txjob->freq, 4);
+    putLsbf(&fix[15], (s4_t)(txjob->txtime - rt_getTime()), 4);
+    fix[19] = txjob->len;
+    addRecord(REC_TX, fix, sizeof(fix), NULL, 0);
+}
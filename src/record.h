@@ -0,0 +1,71 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _record_h_
+#define _record_h_
+
+#include "rt.h"
+
+struct rxjob;
+struct txjob;
+
+// Session recorder - captures the inputs of a running station (radio frames,
+// muxs messages, timesync samples, GPS sentences, timers) together with the
+// TX decisions taken, so a field session can be replayed against a simulated
+// radio and muxs (pysys/replay.py) and the outputs compared.
+//
+// File layout (little endian):
+//   header : "S2RC" u2:version u2:reserved sL:ustime of header sL:utcOffset
+//   records: u1:type varint:dt varint:len payload[len]
+//            dt is in micros since the previous record (header for the first one)
+enum {
+    REC_SESSION = 0,   // JSON: station version and EUI
+    REC_RX,            // sL:xtime sL:rctx u4:freq u1:rps u1:rssi s1:snr frame[]
+    REC_WSRX,          // text message from muxs
+    REC_WSTX,          // text message to muxs
+    REC_TIMESYNC,      // u1:txunit s4:quality sL:ustime sL:xtime sL:pps_xtime
+    REC_GPS,           // NMEA sentence
+    REC_TIMER,         // s4:callback address relative to rt_processTimerQ
+    REC_TX,            // u1:what sL:diid u1:txunit u1:dr u4:freq s4:txtime-now u1:len
+};
+enum { RECTX_PLACED, RECTX_REJECTED, RECTX_MISSED, RECTX_SENT };
+
+extern u1_t rec_on;
+
+void rec_ini      (str_t file);
+void rec_flush    ();
+void rec_rx       (const struct rxjob* rxjob, u1_t rps, const u1_t* frame);
+void rec_text     (u1_t type, const char* text, int len);
+void rec_timesync (u1_t txunit, int quality, ustime_t ustime, sL_t xtime, sL_t pps_xtime);
+void rec_timer    (tmrcb_t cb);
+void rec_tx       (u1_t what, const struct txjob* txjob);
+
+// Hooks cost a single test if recording is off
+#define REC(what, ...) do { if( rec_on ) rec_##what(__VA_ARGS__); } while(0)
+
+#endif // _record_h_
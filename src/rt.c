@@ -28,6 +28,7 @@
 
 #include "sys.h"
 #include "rt.h"
+#include "record.h"
 
 // More recent version of protocol uses standards compliant
 // fields with capital EUI spelling
@@ -66,6 +67,21 @@ ustime_t rt_getUTC () {
     return rt_utcOffset + rt_getTime();
 }
 
+// Uniformly distributed in [lo,hi]
+ustime_t rt_randSpan (ustime_t lo, ustime_t hi) {
+    if( hi <= lo )
+        return lo;
+    uL_t r = ((uL_t)(rand() & 0x7FFFFFFF) << 31) | (uL_t)(rand() & 0x7FFFFFFF);
+    return lo + (ustime_t)(r % (uL_t)(hi-lo+1));
+}
+
+// Decorrelated jitter: next delay is random in [base, 3*prev] capped at cap
+// (prev=0 starts a new series). Gateways which lost the same server at the
+// same instant drift apart quickly instead of coming back in synchronized waves.
+ustime_t rt_backoff (ustime_t prev, ustime_t base, ustime_t cap) {
+    return min(cap, rt_randSpan(base, 3*max(prev, base)));
+}
+
 
 // Non leap year days per month
 static const unsigned char DAYSPERMONTH[12] = { 31,28,31,30,31,30,31,31,30,31,30,31 };
@@ -152,6 +168,7 @@ ustime_t rt_processTimerQ () {
         timerQ = expired->next;
         expired->next = TMR_NIL;
         if (expired->callback) {
+            REC(timer, expired->callback);
             expired->callback(expired);
         } else {
             LOG(ERROR, "Timer due with NULL callback (tmr %p)", expired);
@@ -231,7 +248,24 @@ uL_t rt_rlsbf8 (const u1_t* buf) {
 }
 
 
+#if defined(CFG_selftests)
+static u1_t heapLocked;
+#endif // defined(CFG_selftests)
+
+// Test mode: any heap allocation while locked is fatal.
+// Used by selftests to verify that steady state paths do not touch the heap.
+// Selftest sources are compiled in all variants - hence defined as a no-op there.
+void rt_lockHeap (int lock) {
+#if defined(CFG_selftests)
+    heapLocked = lock;
+#endif // defined(CFG_selftests)
+}
+
 void* _rt_malloc(int size, int zero) {
+#if defined(CFG_selftests)
+    if( heapLocked )
+        rt_fatal("Heap locked - attempt to allocate %d bytes", size);
+#endif // defined(CFG_selftests)
     void* p = malloc(size);
     if( p == NULL )
         rt_fatal("Out of memory - requesting %d bytes", size);
@@ -196,6 +196,8 @@ ustime_t rt_getTime ();
 ustime_t rt_getUTC ();
 ustime_t rt_ustime2utc (ustime_t ustime);
 struct datetime rt_datetime (ustime_t ustime);
+ustime_t rt_randSpan (ustime_t lo, ustime_t hi);
+ustime_t rt_backoff  (ustime_t prev, ustime_t base, ustime_t cap);
 
 #define rt_seconds(n) ((ustime_t)((n)*(ustime_t)1000000))
 #define rt_millis(n)  ((ustime_t)((n)*(ustime_t)1000))
@@ -215,6 +217,7 @@ char*   rt_strdupq  (str_t s);
 void*  _rt_malloc   (int size, int zero);
 void*  _rt_malloc_d (int size, int zero, const char* f, int l);
 void   _rt_free_d   (void* p, const char* f, int l);
+void    rt_lockHeap (int lock);   // make any rt_malloc fatal - test mode (no-op w/o selftests)
 
 #if defined(CFG_variant_debug)
 #define rt_malloc(type)      ((type*)_rt_malloc_d(sizeof(type), 1, __FILE__, __LINE__))
@@ -59,6 +59,29 @@ struct conf_param conf_params[] = {
     { NULL }
 };
 
+// Params which are only consumed at startup - changes on reload need a restart
+static const char* const restart_params[] = {
+    "RADIODEV",
+    "LOGFILE_SIZE",
+    "LOGFILE_ROTATE",
+    "MAX_JOINEUI_RANGES",
+    "CUPS_BUFSZ",
+    "DNLOCAL_SOCKET",
+    "TIMEREFS",
+    "RECORD_FILE",
+    "LINKSTATS_INTV",        // taken over only by s2e_ini/router_config
+    "LINKSTATS_ENTRIES",
+#if defined(CFG_ral_master_slave)
+    "RX_POLL_INTV",          // used by slave processes
+    "TIMESYNC_FANOUT_LEAD",
+    "LGWSIM_HAL_LATENCY",
+    "LGWSIM_HAL_JITTER",
+    "LGWSIM_RXPKT_COST",
+    "LGWSIM_TXBYTE_COST",
+#endif // defined(CFG_ral_master_slave)
+    NULL
+};
+
 
 static int parse_bool (struct conf_param* param) {
     ujdec_t D;
@@ -232,6 +255,56 @@ int s2conf_set (str_t src, str_t name, str_t value) {
 }
 
 
+int s2conf_check (str_t src, str_t name, str_t value) {
+    struct conf_param* p = s2conf_get(name);
+    if( p == NULL )
+        return -1;
+    union { u4_t u4; ustime_t ustime; str_t str; } v = { 0 };
+    struct conf_param n = *p;
+    n.src = src;
+    n.value = value;
+    n.pvalue = &v;
+    if( !n.parseFn(&n) )
+        return 0;
+    int same;
+    if( strcmp(p->type, "str") == 0 ) {
+        same = strcmp(v.str, *(str_t*)p->pvalue) == 0;
+        rt_free((void*)v.str);
+    }
+    else if( strcmp(p->type, "ustime") == 0 ) {
+        same = v.ustime == *(ustime_t*)p->pvalue;
+    }
+    else {
+        same = v.u4 == *(u4_t*)p->pvalue;
+    }
+    return same ? 1 : 2;
+}
+
+
+// Constraints spanning several params - values are checked individually
+// when parsed. Inconsistent settings are reported and fixed up.
+int s2conf_validate () {
+    int ok = 1;
+    if( DNLAT_RX2PREF_ON && DNLAT_RX2PREF_OFF >= DNLAT_RX2PREF_ON ) {
+        // Hysteresis needed - otherwise RX2 preference flips with every downlink
+        LOG(ERROR, "DNLAT_RX2PREF_OFF (%d) must be below DNLAT_RX2PREF_ON (%d) - using %d",
+            DNLAT_RX2PREF_OFF, DNLAT_RX2PREF_ON, DNLAT_RX2PREF_ON-1);
+        DNLAT_RX2PREF_OFF = DNLAT_RX2PREF_ON-1;
+        ok = 0;
+    }
+    return ok;
+}
+
+
+int s2conf_needsRestart (str_t name) {
+    for( int i=0; restart_params[i]; i++ ) {
+        if( strcmp(restart_params[i], name) == 0 )
+            return 1;
+    }
+    return 0;
+}
+
+
 void s2conf_printAll () {
     for( struct conf_param* p = conf_params; p->name; p++ ) {
         fprintf(stderr, "%6s %-20s = %-10s %-12s %s\n",
@@ -37,6 +37,7 @@
 /* TC */
 #define DFLT_MAX_RXDATA           (10*1024)
 #define DFLT_MAX_TXDATA           (16*1024)
+#define DFLT_TXDATA_OVERFLOW       (8*1024)   // part of MAX_TXDATA shared by all txunits
 #define DFLT_MAX_WSSDATA               2048
 #define DFLT_TC_RECV_BUFSZ        (40*1024)
 #define DFLT_TC_SEND_BUFSZ        (80*1024)
@@ -45,11 +46,14 @@
 #define DFLT_MAX_130X                     8
 #define DFLT_MAX_TXJOBS                 128
 #define DFLT_MAX_RXJOBS                  64
+#define DFLT_MAX_JREQ_DEDUP             128
+#define DFLT_MAX_LINKSTATS             2048
 #define DFLT_RADIODEV  "\"/dev/spidev?.0\""
 #define DFLT_TX_MIN_GAP          "\"10ms\""   // worst case for ODU as of 07.2018 (horrible SPI performance)
 #define DFLT_TX_AIM_GAP          "\"20ms\""   //  -ditto-
 #define DFLT_TX_MAX_AHEAD        "\"600s\""
 #define DFLT_TXCHECK_FUDGE        "\"5ms\""
+#define DFLT_TX_PIPELINE_GAP         "0"   // pipelined TX off
 /* TCP keepalive */
 #define DFLT_TCP_KEEPALIVE              "1"   // Connections use keep alive
 #define DFLT_TCP_KEEPIDLE              "60"   // Connection idle time (in seconds) before sending keepalive probes
@@ -94,6 +98,8 @@
 #define FS_PAGE_START    (512)
 #define FS_PAGE_CNT      (500)
 #define FS_MAX_FD        8
+#define FS_WBUF_SIZE     512    // per handle write buffer - coalesces small appends
+#define FS_CKPT_INTV     (32*1024)  // flash bytes between mount checkpoints
 #define FS_MAX_FNSIZE    256
 
 // --------------------------------------------------------------------------------
@@ -129,9 +135,12 @@ enum {  MAX_TXJOBS      = DFLT_MAX_TXJOBS  };
 enum {  MAX_TXFRAME_LEN =  255 };
 enum {  MAX_RXFRAME_LEN =  255 };
 enum {  MAX_RXJOBS      = DFLT_MAX_RXJOBS };
+enum {  MAX_JREQ_DEDUP  = DFLT_MAX_JREQ_DEDUP };
+enum {  MAX_LINKSTATS   = DFLT_MAX_LINKSTATS };
 enum {  TXPOW_SCALE     =   10 };   // keep TX power internally as s2_t scaled by this
 enum {  MAX_RXDATA      = DFLT_MAX_RXDATA };
 enum {  MAX_TXDATA      = DFLT_MAX_TXDATA };
+enum {  TXDATA_OVERFLOW = DFLT_TXDATA_OVERFLOW };
 enum {  MAX_WSSDATA     = DFLT_MAX_WSSDATA };
 
 struct conf_param {
@@ -148,6 +157,9 @@ extern struct conf_param conf_params[];
 
 void  s2conf_ini ();
 int   s2conf_set (str_t src, str_t name, str_t value);
+int   s2conf_check (str_t src, str_t name, str_t value);  // parse w/o applying: -1 no such param, 0 illegal, 1 unchanged, 2 changed
+int   s2conf_validate ();   // check constraints between params - fix up and report
+int   s2conf_needsRestart (str_t name);   // param only consumed at startup?
 void* s2conf_get (str_t name);   // it name a config param?
 void  s2conf_printAll ();
 
@@ -168,30 +180,68 @@ CONF_PARAM(TCP_KEEPALIVE_IDLE  , u4    , u4      ,    DFLT_TCP_KEEPIDLE, "TCP ke
 CONF_PARAM(TCP_KEEPALIVE_INTVL , u4    , u4      ,   DFLT_TCP_KEEPINTVL, "TCP keepalive TCP_KEEPINTVL [s]")
 CONF_PARAM(TCP_KEEPALIVE_CNT   , u4    , u4      ,     DFLT_TCP_KEEPCNT, "TCP keepalive TCP_KEEPCNT")
 CONF_PARAM(MAX_JOINEUI_RANGES  , u4    , u4      ,                 "10", "max ranges to suppress unwanted join requests")
+CONF_PARAM(JREQ_DEDUP_WINDOW   , ustime, tspan_s ,             "\"5s\"", "suppress copies of the same join request within this window (0=off)")
+CONF_PARAM(JREQ_DEDUP_ENTRIES  , u4    , u4      ,                 "64", "max join requests tracked for deduplication")
+CONF_PARAM(LINKSTATS_INTV      , ustime, tspan_s ,                  "0", "interval of per device link statistics summaries (0=only on request)")
+CONF_PARAM(LINKSTATS_ENTRIES   , u4    , u4      ,               "1024", "max devices tracked for link statistics (0=off)")
 CONF_PARAM(CUPS_CONN_TIMEOUT   , ustime, tspan_s ,            "\"60s\"", "connection timeout")
 CONF_PARAM(CUPS_OKSYNC_INTV    , ustime, tspan_h ,            "\"24h\"", "regular check-in with CUPS for updates")
 CONF_PARAM(CUPS_RESYNC_INTV    , ustime, tspan_m ,             "\"1m\"", "check-in with CUPS for updates after a failure")
+CONF_PARAM(CUPS_RESYNC_MAX     , ustime, tspan_m ,            "\"10m\"", "max delay of repeated check-ins with CUPS after failures")
 CONF_PARAM(CUPS_BUFSZ          , u4    , size_kb ,      DFLT_CUPS_BUFSZ, "read from CUPS in chunks of this size")
 CONF_PARAM(GPS_REPORT_DELAY    , ustime, tspan_s ,           "\"120s\"", "delay GPS reports and consolidate")
+CONF_PARAM(GPS_GGA_INTV        , ustime, tspan_ms,          "\"900ms\"", "min interval between processed GGA sentences (faster ones are dropped, keep below NMEA period)")
 CONF_PARAM(GPS_REOPEN_TTY_INTV , ustime, tspan_ms,             "\"1s\"", "recheck TTY open if it failed")
 CONF_PARAM(GPS_REOPEN_FIFO_INTV, ustime, tspan_ms,             "\"1s\"", "recheck if FIFO writer fake GPS")
+CONF_PARAM(DNLOCAL_SOCKET      , str   , str     ,               "\"\"", "unix socket for downlinks from local applications (empty=off)")
 CONF_PARAM(CMD_REOPEN_FIFO_INTV, ustime, tspan_ms,             "\"1s\"", "recheck if FIFO writer")
+CONF_PARAM(RECORD_FILE         , str   , str     ,               "\"\"", "record radio/muxs/timesync/GPS inputs and TX decisions for replay (empty=off)")
+CONF_PARAM(RECORD_MAXSIZE      , u4    , size_mb ,          "\"64MB\"", "stop recording when the record file reaches this size")
+CONF_PARAM(CONF_RELOAD_INTV    , ustime, tspan_s ,                  "0", "check station.conf for changes and reload tunables (0=off)")
 CONF_PARAM(RX_POLL_INTV        , ustime, tspan_ms,           "\"20ms\"", "interval to poll SX1301 RX FIFO")
 CONF_PARAM(TC_TIMEOUT          , ustime, tspan_s ,            "\"60s\"", "reconnected to muxs")
+CONF_PARAM(TC_MUXS_BACKOFF_BASE, ustime, tspan_s ,             "\"1s\"", "min delay before reconnecting to muxs")
+CONF_PARAM(TC_MUXS_BACKOFF_MAX , ustime, tspan_s ,            "\"30s\"", "max delay before reconnecting to muxs")
+CONF_PARAM(TC_INFOS_BACKOFF_BASE,ustime, tspan_s ,            "\"10s\"", "min delay before going back to infos")
+CONF_PARAM(TC_INFOS_BACKOFF_MAX, ustime, tspan_s ,            "\"60s\"", "max delay before going back to infos")
+CONF_PARAM(TC_RETRY_AFTER_MAX  , ustime, tspan_s ,             "\"1h\"", "cap for a retry-after requested by infos/muxs")
+CONF_PARAM(TC_CONNECT_BURST    , u4    , u4      ,                  "5", "max infos/muxs handshake attempts per TC_CONNECT_WINDOW (0=no limit)")
+CONF_PARAM(TC_CONNECT_WINDOW   , ustime, tspan_s ,            "\"60s\"", "window of handshake rate limit")
 CONF_PARAM(CLASS_C_BACKOFF_BY  , ustime, tspan_s ,          "\"100ms\"", "retry interval for class C TX attempts")
 CONF_PARAM(CLASS_C_BACKOFF_MAX , u4    , u4      ,                 "10", "max number of class C TX attempts")
 CONF_PARAM(RADIO_INIT_WAIT     , ustime, tspan_s , DFLT_RADIO_INIT_WAIT, "max wait for radio init command to finish")
 CONF_PARAM(PPS_VALID_INTV      , ustime, tspan_ms,            "\"10m\"", "max age of last PPS sync for GPS time conversions")
 CONF_PARAM(TIMESYNC_RADIO_INTV , ustime, tspan_ms,         "\"2100ms\"", "interval to resync MCU/SX1301")
+CONF_PARAM(TIMESYNC_FANOUT_LEAD, ustime, tspan_ms,            "\"3ms\"", "lead time of a batched timesync request to all slaves")
+CONF_PARAM(TIMESYNC_BATCH_WAIT , ustime, tspan_ms,          "\"100ms\"", "max wait for slave responses of a batched timesync")
 CONF_PARAM(TIMESYNC_LNS_RETRY  , ustime, tspan_s ,           "\"71ms\"", "resend timesync message to server")
 CONF_PARAM(TIMESYNC_LNS_PAUSE  , ustime, tspan_s ,             "\"5s\"", "pause after unsuccessful volley of timesync messages")
 CONF_PARAM(TIMESYNC_LNS_BURST  , u4    , u4      ,                 "10", "volley of timesync messages before pausing")
 CONF_PARAM(TIMESYNC_REPORTS    , ustime, tspan_s ,             "\"5m\"", "report interval for current timesync status")
+CONF_PARAM(TIMEREFS            , str   , str     ,               "\"\"", "time reference sources: comma separated /dev/ppsN, tai, utc, sim (empty=off)")
+CONF_PARAM(TIMEREF_POLL_INTV   , ustime, tspan_ms,             "\"1s\"", "interval to sample time reference sources")
+CONF_PARAM(TIMEREF_MAX_AGE     , ustime, tspan_s ,            "\"10s\"", "max age of a time reference sample to be used")
+CONF_PARAM(TIMEREF_MAX_ERR     , ustime, tspan_ms,            "\"1ms\"", "max estimated error of combined time references to derive GPS time")
+CONF_PARAM(TIMEREF_LEAPS       , u4    , u4      ,                 "18", "GPS-UTC leap seconds if the kernel does not know the TAI offset")
 CONF_PARAM(TX_MIN_GAP          , ustime, tspan_s ,      DFLT_TX_MIN_GAP, "min distance between two frames being TXed")
 CONF_PARAM(TX_AIM_GAP          , ustime, tspan_s ,      DFLT_TX_AIM_GAP, "aim for this TX lead time, if delayed should not fall under min")
 CONF_PARAM(TX_MAX_AHEAD        , ustime, tspan_s ,    DFLT_TX_MAX_AHEAD, "maximum time message can be scheduled into the future")
 CONF_PARAM(TXCHECK_FUDGE       , ustime, tspan_s ,   DFLT_TXCHECK_FUDGE, "check radio state this time into ongoing TX")
+CONF_PARAM(TX_PIPELINE_GAP     , ustime, tspan_s , DFLT_TX_PIPELINE_GAP, "min gap of a frame staged behind an ongoing TX (0=pipelining off)")
+CONF_PARAM(TX_BALANCE_WINDOW   , ustime, tspan_s ,                  "0", "window of queued airtime weighed when placing frames on antennas (0=off)")
+CONF_PARAM(TX_BALANCE_RXBONUS  , ustime, tspan_s ,          "\"50ms\"", "placement bonus for the antenna which received the uplink")
+CONF_PARAM(DNLAT_REPORTS       , ustime, tspan_s ,                  "0", "report interval for downlink latency histograms (0=off)")
+CONF_PARAM(DNLAT_SLACK_MIN     , ustime, tspan_ms,           "\"50ms\"", "RX1 slack at dnmsg arrival below which a downlink counts as at risk")
+CONF_PARAM(DNLAT_RX2PREF_ON    , u4    , u4      ,                  "8", "at risk downlinks out of last 32 to tell LNS we prefer RX2 (0=never)")
+CONF_PARAM(DNLAT_RX2PREF_OFF   , u4    , u4      ,                  "2", "at risk downlinks out of last 32 to withdraw RX2 preference (below ON)")
 CONF_PARAM(BEACON_INTVL        , ustime, tspan_s ,    DFLT_BEACON_INTVL, "beaconing interval")
+CONF_PARAM(BEACON_GUARD        , ustime, tspan_ms,           "\"20ms\"", "keep other frames this far away from beacons (beyond TX gaps)")
+#if defined(CFG_lgwsim)
+CONF_PARAM(LGWSIM_HAL_LATENCY  , u4    , u4      ,                  "0", "simulated SPI cost of each HAL call [us]")
+CONF_PARAM(LGWSIM_HAL_JITTER   , u4    , u4      ,                  "0", "random extra SPI cost of each HAL call up to this [us]")
+CONF_PARAM(LGWSIM_RXPKT_COST   , u4    , u4      ,                  "0", "simulated SPI cost of reading one frame from the RX FIFO [us]")
+CONF_PARAM(LGWSIM_TXBYTE_COST  , u4    , u4      ,                  "0", "simulated SPI cost of loading one TX payload byte [us]")
+#endif // defined(CFG_lgwsim)
 CONF_PARAM(TLS_SNI             ,     u4,    bool ,               "true", "Set and verify server name of TLS connections")
 
 #endif // _s2conf_x_
@@ -33,6 +33,8 @@
 #include "s2e.h"
 #include "kwcrc.h"
 #include "timesync.h"
+#include "trace.h"
+#include "record.h"
 
 
 u1_t s2e_dcDisabled;    // no duty cycle limits - override for test/dev
@@ -69,6 +71,8 @@ static int s2e_canTxOK (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled) {
 }
 
 
+static void lstatIni (s2ctx_t* s2ctx, int cap);  // fwd decl
+
 void s2e_ini (s2ctx_t* s2ctx) {
     if( s2e_joineuiFilter == NULL )
         s2e_joineuiFilter = rt_mallocN(uL_t, 2*MAX_JOINEUI_RANGES+2);  // need min one trailing 0 entry
@@ -89,6 +93,10 @@ void s2e_ini (s2ctx_t* s2ctx) {
     }
     rt_iniTimer(&s2ctx->bcntimer, s2e_bcntimeout);
     s2ctx->bcntimer.ctx = s2ctx;
+    s2ctx->jreqWindow = JREQ_DEDUP_WINDOW;
+    s2ctx->jreqCap = min(JREQ_DEDUP_ENTRIES, MAX_JREQ_DEDUP);
+    s2ctx->lstatIntv = LINKSTATS_INTV;
+    lstatIni(s2ctx, min(LINKSTATS_ENTRIES, MAX_LINKSTATS));
 }
 
 
@@ -117,8 +125,10 @@ rxjob_t* s2e_nextRxjob (s2ctx_t* s2ctx) {
 
 
 void s2e_addRxjob (s2ctx_t* s2ctx, rxjob_t* rxjob) {
+    REC(rx, rxjob, s2e_dr2rps(s2ctx, rxjob->dr), &s2ctx->rxq.rxdata[rxjob->off]);
     // Add newly received frame to rxq
     // Check for mirror frame (reflection on a neighboring frequency)
+    rxjob->mirrors = 0;
     for( rxjob_t* p = &s2ctx->rxq.rxjobs[s2ctx->rxq.first]; p < rxjob; p++ ) {
         if( p->dr == rxjob->dr &&
             p->len == rxjob->len &&
@@ -130,43 +140,308 @@ void s2e_addRxjob (s2ctx_t* s2ctx, rxjob_t* rxjob) {
                     p->freq, p->snr/4.0, -p->rssi, rxjob->freq, rxjob->snr/4.0, -rxjob->rssi,
                     p->dr, (s4_t)rt_rlsbf4(&s2ctx->rxq.rxdata[p->off]+rxjob->len-4), p->len);
 
+                rxjob->mirrors = min(p->mirrors+1, 255);
                 rxq_commitJob(&s2ctx->rxq, rxjob);
                 rxjob = rxq_dropJob(&s2ctx->rxq, p);
             } else {
+                p->mirrors = min(p->mirrors+1, 255);
                 // else: Drop newly retrieved frame - aka don't commit it
                 LOG(MOD_S2E|DEBUG, "Dropped mirror frame freq=%F snr=%5.1f rssi=%d (vs. freq=%F snr=%5.1f rssi=%d) - DR%d mic=%d (%d bytes)",
                     rxjob-> freq, rxjob->snr/4.0, -rxjob->rssi, p->freq, p->snr/4.0, -p->rssi,
                     rxjob->dr, (s4_t)rt_rlsbf4(&s2ctx->rxq.rxdata[rxjob->off]+rxjob->len-4), rxjob->len);
             }
+            TRACE(RX_MIRROR, rxjob->len);
             return;
         }
     }
     // No mirror frame found
     rxq_commitJob(&s2ctx->rxq, rxjob);
+    TRACE(RX_ADDJOB, s2ctx->rxq.next - s2ctx->rxq.first);
+}
+
+// Signal quality used to pick among identical frames (higher is better)
+static inline int rxjob_quality (rxjob_t* j) {
+    return 8*j->snr - j->rssi;
+}
+
+// Join request flood protection.
+// The same join request (JoinEUI/DevEUI/DevNonce) is forwarded only once per
+// dedup window. If more copies are already queued in rxq, the metadata of the
+// copy with the best signal is reported. Later copies are folded into a counter.
+// Returns the rxjob whose metadata should be reported or NULL if suppressed.
+// *pslot is the cache entry to claim with jreq_record once the frame passed
+// the JoinEUI filter - NULL if the frame is not subject to dedup.
+static rxjob_t* jreq_dedup (s2ctx_t* s2ctx, rxjob_t* j, s2jreq_t** pslot) {
+    const u1_t* frame = &s2ctx->rxq.rxdata[j->off];
+    *pslot = NULL;
+    if( s2ctx->jreqWindow <= 0 || s2ctx->jreqCap == 0 || j->len != 23 || frame[0] != 0x00 )
+        return j;  // disabled or not a LoRaWAN 1.x join request
+    ustime_t now = rt_getTime();
+    uL_t joineui  = rt_rlsbf8(&frame[1]);
+    uL_t deveui   = rt_rlsbf8(&frame[9]);
+    u2_t devnonce = rt_rlsbf2(&frame[17]);
+    s2jreq_t* slot = &s2ctx->jreqs[0];
+    for( int i=0; i<s2ctx->jreqCap; i++ ) {
+        s2jreq_t* e = &s2ctx->jreqs[i];
+        if( e->expires > now && e->devnonce == devnonce && e->deveui == deveui && e->joineui == joineui ) {
+            e->dups += 1;
+            LOG(MOD_S2E|DEBUG, "Suppressed copy #%d of join request %s=%:E DevNonce=%d - freq=%F DR%d snr=%.1f rssi=%d",
+                e->dups, rt_deveui, deveui, devnonce, j->freq, j->dr, j->snr/4.0, -j->rssi);
+            return NULL;
+        }
+        if( e->expires < slot->expires )
+            slot = e;  // free, stale or oldest entry
+    }
+    rxjob_t* best = j;
+    for( rxjob_t* p = j+1; p < &s2ctx->rxq.rxjobs[s2ctx->rxq.next]; p++ ) {
+        if( p->len == j->len &&
+            memcmp(&s2ctx->rxq.rxdata[p->off], frame, j->len) == 0 &&
+            rxjob_quality(p) > rxjob_quality(best) ) {
+            best = p;
+        }
+    }
+    *pslot = slot;
+    return best;
+}
+
+// Remember a forwarded join request - filtered ones do not occupy the cache.
+static void jreq_record (s2ctx_t* s2ctx, s2jreq_t* slot, const u1_t* frame) {
+    if( slot->dups ) {
+        LOG(MOD_S2E|VERBOSE, "Join request %s=%:E DevNonce=%d - %d copies suppressed",
+            rt_deveui, slot->deveui, slot->devnonce, slot->dups);
+    }
+    slot->joineui  = rt_rlsbf8(&frame[1]);
+    slot->deveui   = rt_rlsbf8(&frame[9]);
+    slot->devnonce = rt_rlsbf2(&frame[17]);
+    slot->dups     = 0;
+    slot->expires  = rt_getTime() + s2ctx->jreqWindow;
+}
+
+// --------------------------------------------------------------------------------
+//
+// Per device link statistics
+//
+// --------------------------------------------------------------------------------
+//
+// RSSI/SNR, frame/mirror counts, FCnt range and DR usage are aggregated per DevAddr
+// so an LNS can run ADR from compact summaries instead of per uplink metadata.
+// Entries live in a fixed table with hash chains and an LRU list. If the table is
+// full the least recently seen device is evicted.
+// Summaries are sent every lstatIntv or on request ('linkstats' message) in chunks
+// of LSTAT_PER_MSG devices - whenever there is space on the websocket.
+//
+//  {"msgtype":"linkstats", "interval":secs, "evicted":n, "final":bool,
+//   "devs":[{"DevAddr":.., "frames":.., "mirrors":.., "FCnt":[first,last],
+//            "rssi":[min,avg,max], "snr":[min,avg,max], "DRs":[[dr,frames],..]},..]}
+//
+
+enum { LSTAT_PER_MSG = 16 };
+enum { LSTAT_MSGSIZE = LSTAT_PER_MSG*320 + 128 };
+
+static inline u4_t lstatBucket (u4_t devaddr) {
+    return ((devaddr * 0x9E3779B1) >> 7) % MAX_LINKSTATS;
 }
 
+static void lstatIni (s2ctx_t* s2ctx, int cap) {
+    s2ctx->lstatCap = cap;
+    s2ctx->lstatUsed = 0;
+    s2ctx->lstatHead = s2ctx->lstatTail = s2ctx->lstatFlush = LSTAT_NIL;
+    s2ctx->lstatEvicted = 0;
+    s2ctx->lstatBeg = 0;
+    memset(s2ctx->lstatHash, 0xFF, sizeof(s2ctx->lstatHash));
+}
+
+static void lstatUnlinkLru (s2ctx_t* s2ctx, u2_t idx) {
+    s2lstat_t* e = &s2ctx->lstats[idx];
+    if( e->lprev == LSTAT_NIL ) s2ctx->lstatHead = e->lnext; else s2ctx->lstats[e->lprev].lnext = e->lnext;
+    if( e->lnext == LSTAT_NIL ) s2ctx->lstatTail = e->lprev; else s2ctx->lstats[e->lnext].lprev = e->lprev;
+}
+
+static void lstatPushLru (s2ctx_t* s2ctx, u2_t idx) {
+    s2lstat_t* e = &s2ctx->lstats[idx];
+    e->lprev = LSTAT_NIL;
+    e->lnext = s2ctx->lstatHead;
+    if( e->lnext == LSTAT_NIL ) s2ctx->lstatTail = idx; else s2ctx->lstats[e->lnext].lprev = idx;
+    s2ctx->lstatHead = idx;
+}
+
+static s2lstat_t* lstatLookup (s2ctx_t* s2ctx, u4_t devaddr) {
+    u2_t* phash = &s2ctx->lstatHash[lstatBucket(devaddr)];
+    for( u2_t idx = *phash; idx != LSTAT_NIL; idx = s2ctx->lstats[idx].hnext ) {
+        if( s2ctx->lstats[idx].devaddr == devaddr ) {
+            if( s2ctx->lstatHead != idx ) {
+                lstatUnlinkLru(s2ctx, idx);
+                lstatPushLru(s2ctx, idx);
+            }
+            return &s2ctx->lstats[idx];
+        }
+    }
+    u2_t idx;
+    if( s2ctx->lstatUsed < s2ctx->lstatCap ) {
+        idx = s2ctx->lstatUsed++;
+    } else {
+        // Evict least recently seen device
+        idx = s2ctx->lstatTail;
+        s2lstat_t* e = &s2ctx->lstats[idx];
+        if( e->frames )
+            s2ctx->lstatEvicted += 1;
+        u2_t* p = &s2ctx->lstatHash[lstatBucket(e->devaddr)];
+        while( *p != idx )
+            p = &s2ctx->lstats[*p].hnext;
+        *p = e->hnext;
+        lstatUnlinkLru(s2ctx, idx);
+    }
+    s2lstat_t* e = &s2ctx->lstats[idx];
+    memset(e, 0, sizeof(*e));
+    e->devaddr = devaddr;
+    e->hnext = *phash;
+    *phash = idx;
+    lstatPushLru(s2ctx, idx);
+    return e;
+}
+
+void s2e_lstatUpdate (s2ctx_t* s2ctx, rxjob_t* j, const u1_t* frame) {
+    int ftype = frame[0] >> 5;
+    if( s2ctx->lstatCap == 0 || j->len < 12 || (ftype != 2 && ftype != 4) )
+        return;  // disabled or not a data uplink
+    if( s2ctx->lstatBeg == 0 )
+        s2ctx->lstatBeg = rt_getTime();
+    s2lstat_t* e = lstatLookup(s2ctx, rt_rlsbf4(frame+1));
+    u2_t fcnt = rt_rlsbf2(frame+6);
+    s2_t rssi = -(s2_t)j->rssi;
+    if( e->frames == 0 ) {
+        e->fcnt0 = fcnt;
+        e->rssiMin = e->rssiMax = rssi;
+        e->snrMin = e->snrMax = j->snr;
+    } else {
+        e->rssiMin = min(e->rssiMin, rssi);
+        e->rssiMax = max(e->rssiMax, rssi);
+        e->snrMin = min(e->snrMin, j->snr);
+        e->snrMax = max(e->snrMax, j->snr);
+    }
+    e->fcnt1 = fcnt;
+    if( e->frames < 0xFFFF ) {
+        e->frames += 1;
+        e->rssiSum += rssi;
+        e->snrSum += j->snr;
+    }
+    e->mirrors = min(e->mirrors + j->mirrors, 0xFFFF);
+    if( j->dr < DR_CNT && e->drs[j->dr] < 0xFFFF )
+        e->drs[j->dr] += 1;
+}
+
+static void lstatEncode (ujbuf_t* b, s2lstat_t* e) {
+    uj_encOpen(b, '{');
+    uj_encKVn(b,
+              "DevAddr", 'i', (s4_t)e->devaddr,
+              "frames",  'u', e->frames,
+              "mirrors", 'u', e->mirrors,
+              "FCnt",    '[', 'u', e->fcnt0, 'u', e->fcnt1, ']',
+              "rssi",    '[', 'i', e->rssiMin, 'g', (double)e->rssiSum/e->frames, 'i', e->rssiMax, ']',
+              "snr",     '[', 'g', e->snrMin/4.0, 'g', e->snrSum/4.0/e->frames, 'g', e->snrMax/4.0, ']',
+              NULL);
+    uj_encKey(b, "DRs");
+    uj_encOpen(b, '[');
+    for( int dr=0; dr<DR_CNT; dr++ ) {
+        if( e->drs[dr] ) {
+            uj_encOpen(b, '[');
+            uj_encInt(b, dr);
+            uj_encUint(b, e->drs[dr]);
+            uj_encClose(b, ']');
+        }
+    }
+    uj_encClose(b, ']');
+    uj_encClose(b, '}');
+}
+
+// Send pending summary chunks - continued from s2e_flushRxjobs if websocket is busy
+static void lstatFlush (s2ctx_t* s2ctx) {
+    while( s2ctx->lstatFlush != LSTAT_NIL ) {
+        ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, LSTAT_MSGSIZE);
+        if( sendbuf.buf == NULL )
+            return;  // WS will call again
+        ustime_t now = rt_getTime();
+        u2_t idx = s2ctx->lstatFlush;
+        uj_encOpen(&sendbuf, '{');
+        uj_encKVn(&sendbuf,
+                  "msgtype",  's', "linkstats",
+                  "interval", 'T', (now - s2ctx->lstatBeg)/1e6,
+                  "evicted",  'u', s2ctx->lstatEvicted,
+                  NULL);
+        uj_encKey(&sendbuf, "devs");
+        uj_encOpen(&sendbuf, '[');
+        for( int n=0; idx < s2ctx->lstatUsed && n < LSTAT_PER_MSG; idx++ ) {
+            s2lstat_t* e = &s2ctx->lstats[idx];
+            if( e->frames == 0 )
+                continue;
+            lstatEncode(&sendbuf, e);
+            e->frames = e->mirrors = 0;
+            e->rssiSum = e->snrSum = 0;
+            memset(e->drs, 0, sizeof(e->drs));
+            n++;
+        }
+        uj_encClose(&sendbuf, ']');
+        int final = idx >= s2ctx->lstatUsed;
+        uj_encKV(&sendbuf, "final", 'b', final);
+        uj_encClose(&sendbuf, '}');
+        if( final ) {
+            LOG(MOD_S2E|VERBOSE, "Link stats summary of %d devices (%d evicted) after %~T",
+                s2ctx->lstatUsed, s2ctx->lstatEvicted, now - s2ctx->lstatBeg);
+            s2ctx->lstatFlush = LSTAT_NIL;
+            s2ctx->lstatBeg = now;
+            s2ctx->lstatEvicted = 0;
+        } else {
+            s2ctx->lstatFlush = idx;
+        }
+        if( !xeos(&sendbuf) ) {
+            LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
+        } else {
+            (*s2ctx->sendText)(s2ctx, &sendbuf);
+        }
+    }
+}
+
+// Start a summary of all devices seen since the last one
+void s2e_lstatSummary (s2ctx_t* s2ctx) {
+    if( s2ctx->lstatCap == 0 )
+        return;
+    if( s2ctx->lstatFlush == LSTAT_NIL )
+        s2ctx->lstatFlush = 0;
+    lstatFlush(s2ctx);
+}
+
+
 void s2e_flushRxjobs (s2ctx_t* s2ctx) {
+    TRACE(RX_FLUSH_BEG, s2ctx->rxq.next - s2ctx->rxq.first);
     while( s2ctx->rxq.first < s2ctx->rxq.next ) {
         // Get a send buffer - parse frame / check filter
         ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE);
         if( sendbuf.buf == NULL ) {
             // Websocket has no space - WS will call again
-            return;
+            break;
         }
-        rxjob_t* j = &s2ctx->rxq.rxjobs[s2ctx->rxq.first++];
+        rxjob_t* f = &s2ctx->rxq.rxjobs[s2ctx->rxq.first++];
+        s2jreq_t* jslot;
+        rxjob_t* j = jreq_dedup(s2ctx, f, &jslot);  // metadata of this frame is reported
+        if( j == NULL )
+            continue;
         dbuf_t lbuf = { .buf = NULL };
         if( log_special(MOD_S2E|VERBOSE, &lbuf) )
             xprintf(&lbuf, "RX %F DR%d %R snr=%.1f rssi=%d xtime=0x%lX - ",
                     j->freq, j->dr, s2e_dr2rps(s2ctx, j->dr), j->snr/4.0, -j->rssi, j->xtime);
 
         uj_encOpen(&sendbuf, '{');
-        if( !s2e_parse_lora_frame(&sendbuf, &s2ctx->rxq.rxdata[j->off], j->len, lbuf.buf ? &lbuf : NULL) ) {
+        if( !s2e_parse_lora_frame(&sendbuf, &s2ctx->rxq.rxdata[f->off], f->len, lbuf.buf ? &lbuf : NULL) ) {
             // Frame failed sanity checks or stopped by filters
+            TRACE(RX_FILTERED, f->len);
             sendbuf.pos = 0;
             continue;
         }
+        if( jslot )
+            jreq_record(s2ctx, jslot, &s2ctx->rxq.rxdata[f->off]);
         if( lbuf.buf )
             log_specialFlush(lbuf.pos);
+        s2e_lstatUpdate(s2ctx, j, &s2ctx->rxq.rxdata[f->off]);
         double reftime = 0.0;
         if( s2ctx->muxtime ) {
             reftime = s2ctx->muxtime +
@@ -190,10 +465,17 @@ void s2e_flushRxjobs (s2ctx_t* s2ctx) {
         if( !xeos(&sendbuf) ) {
             LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
         } else {
+            TRACE(RX_UPJSON, sendbuf.pos);
             (*s2ctx->sendText)(s2ctx, &sendbuf);
             assert(sendbuf.buf==NULL);
         }
     }
+    TRACE(RX_FLUSH_END, s2ctx->rxq.next - s2ctx->rxq.first);
+    if( s2ctx->lstatFlush == LSTAT_NIL && s2ctx->lstatIntv > 0 && s2ctx->lstatBeg &&
+        rt_getTime() >= s2ctx->lstatBeg + s2ctx->lstatIntv ) {
+        s2ctx->lstatFlush = 0;  // start periodic summary
+    }
+    lstatFlush(s2ctx);
 }
 
 
@@ -268,7 +550,14 @@ ustime_t s2e_calcUpAirTime (rps_t rps, u1_t plen) {
 static void send_dntxed (s2ctx_t* s2ctx, txjob_t* txjob) {
     if( txjob->deveui ) {
         // Note: dnsched does not have deveui field set - don't report dntxed
-        ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE/2);
+        // Frames from local clients are confirmed to the client and not to the LNS
+        char localbuf[MIN_UPJSON_SIZE/2];
+        ujbuf_t sendbuf;
+        if( txjob->origin ) {
+            sendbuf = (ujbuf_t){ .buf = localbuf, .bufsize = sizeof(localbuf), .pos = 0 };
+        } else {
+            sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE/2);
+        }
         if( sendbuf.buf == NULL ) {
             LOG(MOD_S2E|ERROR, "%J - failed to send dntxed, no buffer space", txjob);
             return;
@@ -287,7 +576,12 @@ static void send_dntxed (s2ctx_t* s2ctx, txjob_t* txjob) {
                   "gpstime",   'I', txjob->gpstime,
                   NULL);
         uj_encClose(&sendbuf, '}');
-        (*s2ctx->sendText)(s2ctx, &sendbuf);
+        TRACE(TX_DNTXED, txjob->diid);
+        if( txjob->origin ) {
+            sys_dnlocalTxed(txjob->origin-1, &sendbuf);
+        } else {
+            (*s2ctx->sendText)(s2ctx, &sendbuf);
+        }
     }
     LOG(MOD_S2E|INFO, "TX %J - %s: %F %.1fdBm ant#%d(%d) DR%d %R frame=%12.4H (%u bytes)",
         txjob, txjob->deveui ? "dntxed" : "on air",
@@ -507,11 +801,110 @@ static int s2e_canTxPerChnlDC (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled)
 }
 
 
+// Min distance of a frame to a preceding frame on the same txunit.
+// In pipelined mode the follower is staged while the preceding frame is on air
+// and only needs the time to be handed to the radio.
+static inline ustime_t txFollowGap () {
+    return TX_PIPELINE_GAP > 0 ? TX_PIPELINE_GAP : TX_MIN_GAP;
+}
+
+
+// Beacons are known long before s2e_bcntimeout queues them. Their airtime plus
+// gaps is a permanent reservation on the beacon txunit - frames overlapping
+// any future beacon are moved to alternatives when they are admitted instead
+// of being displaced when the beacon is queued or starts.
+static int bcnConflict (s2ctx_t* s2ctx, txjob_t* txjob, u1_t txunit) {
+    s2bcn_t* bcn = &s2ctx->bcn;
+    if( bcn->txtime == 0 || (txjob->txflags & TXFLAG_BCN) || txunit != ral_rctx2txunit(0) )
+        return 0;
+    ustime_t gap = txFollowGap() + BEACON_GUARD;
+    // First beacon not ending (incl. gap) before txjob starts
+    ustime_t b = bcn->txtime;
+    ustime_t after = txjob->txtime - bcn->airtime - gap;
+    if( b <= after )
+        b += ((after - b) / BEACON_INTVL + 1) * BEACON_INTVL;
+    if( b - gap >= txjob->txtime + txjob->airtime )
+        return 0;
+    LOG(MOD_S2E|DEBUG, "%J - overlaps beacon reservation at %>.3T", txjob, rt_ustime2utc(b));
+    return 1;
+}
+
+
+// Score txunit as a place for txjob - higher is better.
+// Combines remaining duty cycle headroom, airtime already queued on this txunit
+// around txtime (heavy penalty if overlapping) and a bonus for the board which
+// received the uplink (mirror frames are deduped keeping the best RSSI/SNR copy).
+static sL_t scoreTxunit (s2ctx_t* s2ctx, txjob_t* txjob, u1_t txunit, u1_t rxunit) {
+    ustime_t win = TX_BALANCE_WINDOW;
+    ustime_t txtime = txjob->txtime;
+    ustime_t txend = txtime + txjob->airtime + txFollowGap();
+    s2txunit_t* tu = &s2ctx->txunits[txunit];
+    ustime_t dcfree = tu->dc_perChnl[txjob->dnchnl];
+    if( s2ctx->region == J_EU868 )
+        dcfree = max(dcfree, tu->dc_eu868bands[freq2band(txjob->freq)]);
+    sL_t score;
+    if( s2e_dcDisabled || dcfree == USTIME_MIN )
+        score = win;
+    else if( dcfree == USTIME_MAX )
+        score = -win;
+    else
+        score = min(txtime - dcfree, win);
+    for( txjob_t* j = txq_idx2job(&s2ctx->txq, tu->head); j; j = txq_idx2job(&s2ctx->txq, j->next) ) {
+        if( j->txtime >= txtime + win )
+            break;  // queue is ordered by txtime
+        ustime_t jend = j->txtime + j->airtime + txFollowGap();
+        if( jend <= txtime - win )
+            continue;
+        score -= j->airtime;
+        if( txtime < jend && j->txtime < txend )
+            score -= 2*win;  // would collide
+    }
+    if( txunit == rxunit )
+        score += TX_BALANCE_RXBONUS;
+    return score;
+}
+
+
+// Pick best txunit among the candidates - ties favor the receiving board
+// and then lower txunit numbers.
+u1_t s2e_pickTxunit (s2ctx_t* s2ctx, txjob_t* txjob, u1_t rxunit, u1_t cands) {
+    u1_t best = MAX_TXUNITS;
+    sL_t bestScore = 0;
+    if( (cands & (1<<rxunit)) ) {
+        best = rxunit;
+        bestScore = scoreTxunit(s2ctx, txjob, rxunit, rxunit);
+    }
+    for( u1_t u=0; u<MAX_TXUNITS; u++ ) {
+        if( u == rxunit || (cands & (1<<u)) == 0 )
+            continue;
+        sL_t score = scoreTxunit(s2ctx, txjob, u, rxunit);
+        if( best == MAX_TXUNITS || score > bestScore ) {
+            best = u;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+
+// Choose initial txunit for txjob and set up its alternative antennas.
+static u1_t placeTxjob (s2ctx_t* s2ctx, txjob_t* txjob) {
+    u1_t rxunit = ral_rctx2txunit(txjob->rctx);
+    u1_t alts = ral_altAntennas(rxunit);
+    u1_t txunit = rxunit;
+    if( alts && TX_BALANCE_WINDOW > 0 && !(txjob->txflags & TXFLAG_BCN) )  // beacons stay on reserved txunit
+        txunit = s2e_pickTxunit(s2ctx, txjob, rxunit, alts | (1<<rxunit));
+    txjob->txunit = txunit;
+    txjob->altAnts = (alts | (1<<rxunit)) & ~(1<<txunit);
+    return txunit;
+}
+
+
 // Add a txjob to the TX queue and insert ordered by txtime.
 // Only basic exclusion constraints are checked for newly arriving txjobs:
 // Independent on antenna choice:
 //  - if too late, try alternative TX times, if out of alternatives drop it
-// Per antenna, start with preferred antenna and then try alternative antennas:
+// Per antenna, start with the best scored antenna (see scoreTxunit) and then try alternative antennas:
 //  - definitely no duty cycle, thus the frame can't be sent for sure. If it could be sent under CCA enter it
 //  - collision with ongoing TX on current antenna (never stop a running TX)
 // If not excluded enter based on txtime. If txtime is head of txunit queue reset processing timer
@@ -520,21 +913,26 @@ static int s2e_canTxPerChnlDC (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled)
 int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
     ustime_t earliest = now + TX_AIM_GAP;
     u1_t txunit;
+    txjob->txflags &= ~TXFLAG_STAGED;
+    TRACE(TX_ADD, txjob->diid);
     if( !relocate ) {
         // txjob is fresh entry from LNS and not one that got reschduled due to TX conflicts
         ustime_t txtime = txjob->txtime;    //
-        txunit = txjob->txunit = ral_rctx2txunit(txjob->rctx);
-        txjob->altAnts = ral_altAntennas(txunit);
+        txjob->txunit = ral_rctx2txunit(txjob->rctx);
+        txjob->altAnts = 0;
         updateAirtimeTxpow(s2ctx, txjob);
 
         if( txtime > now + TX_MAX_AHEAD ) {
             LOG(MOD_S2E|WARNING, "%J - Tx job too far ahead: %~T", txjob, txtime-now);
+            REC(tx, RECTX_REJECTED, txjob);
             return 0;
         }
 
-        if( txtime < earliest  &&  !altTxTime(s2ctx, txjob, earliest) )
-            
+        if( txtime < earliest  &&  !altTxTime(s2ctx, txjob, earliest) ) {
+            REC(tx, RECTX_REJECTED, txjob);
             return 0;
+        }
+        txunit = placeTxjob(s2ctx, txjob);
         goto start;
     }
   check_alt: {
@@ -543,17 +941,20 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
             // No more alternative antennas - try later TX time
             if( !altTxTime(s2ctx, txjob, earliest) ) {
                 LOG(MOD_S2E|WARNING, "%J - unable to place frame", txjob);
-                
+                REC(tx, RECTX_REJECTED, txjob);
                 return 0;
             }
             // and reset antenna options
-            txunit = txjob->txunit = ral_rctx2txunit(txjob->rctx);
-            txjob->altAnts = ral_altAntennas(txunit);
+            txunit = placeTxjob(s2ctx, txjob);
         } else {
             // Try to find alternative antenna
-            txunit = 0;
-            while( (alts & (1<<txunit)) == 0 )
-                txunit += 1;
+            if( TX_BALANCE_WINDOW > 0 ) {
+                txunit = s2e_pickTxunit(s2ctx, txjob, ral_rctx2txunit(txjob->rctx), alts);
+            } else {
+                txunit = 0;
+                while( (alts & (1<<txunit)) == 0 )
+                    txunit += 1;
+            }
             txjob->txunit = txunit;
             txjob->altAnts &= ~(1<<txunit);
         }
@@ -562,11 +963,14 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
         int ccaDisabled = 0;
         if( !s2e_dcDisabled && !(*s2ctx->canTx)(s2ctx, txjob, &ccaDisabled) )
             goto check_alt;
+        if( bcnConflict(s2ctx, txjob, txunit) )
+            goto check_alt;
         ustime_t txtime = txjob->txtime;
         txidx_t* pidx = &s2ctx->txunits[txunit].head;
         txidx_t  idx  = pidx[0];
         txjob_t* curr = txq_idx2job(&s2ctx->txq, idx);
-        if( curr && (curr->txflags & TXFLAG_TXING) && txtime < curr->txtime + curr->airtime + TX_MIN_GAP ) {
+        txjob_t* head = curr;
+        if( curr && (curr->txflags & TXFLAG_TXING) && txtime < curr->txtime + curr->airtime + txFollowGap() ) {
             // Would interfer with currently ongoing TX
             LOG(MOD_S2E|DEBUG, "%J - frame colliding with ongoing TX on ant#%d", txjob, txunit);
             goto check_alt;
@@ -580,6 +984,9 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
                 pidx[0] = txq_job2idx(&s2ctx->txq, txjob);
                 if( pidx == &s2ctx->txunits[txunit].head ) // new txjob is head of q?
                     rt_yieldTo(&s2ctx->txunits[txunit].timer, s2e_txtimeout);
+                else if( TX_PIPELINE_GAP > 0 && (head->txflags & TXFLAG_TXING) && pidx == &head->next )
+                    rt_yieldTo(&s2ctx->txunits[txunit].timer, s2e_txtimeout);  // stage behind ongoing TX
+                REC(tx, RECTX_PLACED, txjob);
                 return 1;
             }
             idx = (pidx = &curr->next)[0];
@@ -589,6 +996,56 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
 }
 
 
+// Re-calc exact xtime of a txjob about to be sent based on latest timesync data.
+// Returns 0 if there is no usable time sync.
+static int syncTxXtime (txjob_t* txjob, u1_t txunit) {
+    if( txjob->gpstime ) {
+        txjob->xtime = ts_gpstime2xtime(txunit, txjob->gpstime);
+        txjob->txtime = ts_xtime2ustime(txjob->xtime);
+    }
+    else if( ral_xtime2txunit(txjob->xtime) != txunit ) {
+        txjob->xtime = ts_xtime2xtime(txjob->xtime, txunit);
+    }
+    return txjob->xtime != 0;
+}
+
+
+// Pipelined TX: while curr is on air prepare the following txjob so it can be
+// handed to the radio as soon as curr ends - with a lead time of only TX_PIPELINE_GAP.
+// If the follower can't be sent it is relocated now while there is still time.
+static void stageNextTx (s2ctx_t* s2ctx, u1_t txunit, txjob_t* curr, ustime_t now) {
+    txjob_t* next = txq_idx2job(&s2ctx->txq, curr->next);
+    if( next == NULL || (next->txflags & TXFLAG_STAGED) )
+        return;
+    ustime_t txend = curr->txtime + curr->airtime;
+    if( next->txtime - txend > TX_AIM_GAP )
+        return;  // regular processing at txend is soon enough
+    // Follower's duty cycle check must see the airtime of curr - which is charged
+    // only after the TX check. Charge it tentatively and undo it: if curr turns out
+    // not to be on air it is relocated and must not leave a phantom charge behind.
+    s2txunit_t* tu = &s2ctx->txunits[curr->txunit];
+    u1_t band = freq2band(curr->freq);
+    ustime_t dcband = tu->dc_eu868bands[band];
+    ustime_t dcchnl = tu->dc_perChnl[curr->dnchnl];
+    update_DC(s2ctx, curr);
+    int ccaDisabled = s2e_ccaDisabled;
+    int ok = syncTxXtime(next, txunit) &&
+        (s2e_dcDisabled || (*s2ctx->canTx)(s2ctx, next, &ccaDisabled));
+    tu->dc_eu868bands[band] = dcband;
+    tu->dc_perChnl[curr->dnchnl] = dcchnl;
+    if( !ok ) {
+        LOG(MOD_S2E|DEBUG, "%J - cannot be staged behind %J - trying alternative", next, curr);
+        txq_unqJob(&s2ctx->txq, &curr->next);
+        if( !s2e_addTxjob(s2ctx, next, /*relocate*/1, now) )
+            txq_freeJob(&s2ctx->txq, next);
+        return;
+    }
+    next->txflags |= TXFLAG_STAGED;
+    TRACE(TX_STAGED, next->txtime - txend);
+    LOG(MOD_S2E|DEBUG, "%J - staged %~T behind %J", next, next->txtime - txend, curr);
+}
+
+
 // Analyze TX queue and decide on next action.
 // Return the time when the next action is due if the queue head is not changed.
 // This can be called any time to reevaluate actions.
@@ -604,7 +1061,7 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
 //
 // The return value makes a suggestion as to when the next call should be done.
 //
-ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
+static ustime_t nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
     ustime_t now = rt_getTime();
     txidx_t *phead = &s2ctx->txunits[txunit].head;
  again:
@@ -619,6 +1076,7 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
         if( now >= txend ) {
             // TX is over - drop job
             LOG(MOD_S2E|DEBUG, "Tx done diid=%ld", curr->diid);
+            TRACE(TX_DONE, curr->diid);
             if( !(curr->txflags & TXFLAG_TXCHECKED) ) {
                 update_DC(s2ctx, curr);
                 curr->txflags |= TXFLAG_TXCHECKED;
@@ -628,6 +1086,8 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
             txq_freeJob(&s2ctx->txq, curr);
             goto again;
         }
+        if( TX_PIPELINE_GAP > 0 )
+            stageNextTx(s2ctx, txunit, curr, now);
         // Frame is still being transmitted - come back at end of TX
         if( !(curr->txflags & TXFLAG_TXCHECKED) ) {
             if( txdelta > -TXCHECK_FUDGE )
@@ -641,6 +1101,8 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
                 goto check_alt;
             }
             // Looks like it's on air
+            TRACE(TX_CHECKED, txunit);
+            REC(tx, RECTX_SENT, curr);
             update_DC(s2ctx, curr);
             
             
@@ -656,9 +1118,15 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
         }
         return txend;
     }
-    if( txdelta < TX_MIN_GAP ) {
+    // A staged txjob is handed over right at the end of the preceding frame.
+    // Allow the timer to be late by half the pipeline gap.
+    int staged = (curr->txflags & TXFLAG_STAGED) != 0;
+    ustime_t minLead = staged ? TX_PIPELINE_GAP/2 : TX_MIN_GAP;
+    if( txdelta < minLead ) {
         // Missed TX start time - try alternative or drop frame
-        LOG(MOD_S2E|ERROR, "%J - missed TX time: txdelta=%~T min=%~T", curr, txdelta, TX_MIN_GAP);
+        LOG(MOD_S2E|ERROR, "%J - missed TX time: txdelta=%~T min=%~T", curr, txdelta, minLead);
+        TRACE(TX_MISSED, txdelta);
+        REC(tx, RECTX_MISSED, curr);
       check_alt:
         txq_unqJob(&s2ctx->txq, phead);
         if( !s2e_addTxjob(s2ctx, curr, /*relocate*/1, now) )  // note: might change queue head! (reload @ again)
@@ -673,19 +1141,11 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
     }
 
     // Re-calc exact xtime based on latest timesync data
-    if( curr->gpstime ) {
-        // Recalc xtime against latest time sync data
-        curr->xtime = ts_gpstime2xtime(txunit, curr->gpstime);
-        curr->txtime = ts_xtime2ustime(curr->xtime);
-        txdelta = curr->txtime - now;
-    }
-    else if( ral_xtime2txunit(curr->xtime) != txunit ) {
-        curr->xtime = ts_xtime2xtime(curr->xtime, txunit);
-    }
-    if( curr->xtime == 0 ) {
+    if( !syncTxXtime(curr, txunit) ) {
         LOG(MOD_S2E|ERROR, "%J - time sync problems - trying alternative", curr);
         goto check_alt;
     }
+    txdelta = curr->txtime - now;
     // Txtime close enough to make a decision
     // Check channel access
     int ccaDisabled = s2e_ccaDisabled;
@@ -702,7 +1162,7 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
         other_txjob = txq_idx2job(&s2ctx->txq, other_txjob->next);
         if( other_txjob == NULL )
             break;
-        if( txend < other_txjob->txtime - TX_MIN_GAP )
+        if( txend < other_txjob->txtime - txFollowGap() )
             break;  // no overlap
         int oprio = calcPriority(other_txjob);
         if( prio < oprio ) {
@@ -712,6 +1172,13 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
         }
     } while(1);
 
+    if( staged && ral_txstatus(txunit) == TXSTATUS_EMITTING ) {
+        // Radio still busy with preceding frame (clock drift) - never submit on top of it
+        LOG(MOD_S2E|DEBUG, "%J - radio still emitting - handover delayed", curr);
+        return now + min(rt_millis(1), txdelta - minLead);
+    }
+    curr->txflags &= ~TXFLAG_STAGED;
+
     LOG(MOD_S2E|VERBOSE, "%J - starting TX in %~T: %F %.1fdBm ant#%d(%d) DR%d %R frame=%12.4H (%u bytes)",
         curr, txdelta,
         curr->freq, (double)curr->txpow/TXPOW_SCALE,
@@ -719,7 +1186,9 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
         curr->dr, s2e_dr2rps(s2ctx, curr->dr),
         curr->len, &s2ctx->txq.txdata[curr->off], curr->len);
 
+    TRACE(RAL_TX_BEG, txunit);
     int txerr = ral_tx(curr, s2ctx, ccaDisabled);
+    TRACE(RAL_TX_END, txerr);
     if( txerr != RAL_TX_OK ) {
         if( txerr == RAL_TX_NOCA ) {
             LOG(MOD_S2E|ERROR, "%J - channel busy - trying alternative", curr);
@@ -734,9 +1203,9 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
     // If no alternatives drop txjob.
     while(1) {
         txjob_t* next_txjob = txq_idx2job(&s2ctx->txq, curr->next);
-        if( next_txjob == NULL || txend < next_txjob->txtime - TX_MIN_GAP )
+        if( next_txjob == NULL || txend < next_txjob->txtime - txFollowGap() )
             break;  // no next or no overlap
-        LOG(MOD_S2E|INFO, "%J - displaces %J due to %~T overlap", curr, next_txjob, next_txjob->txtime - TX_MIN_GAP - txend);
+        LOG(MOD_S2E|INFO, "%J - displaces %J due to %~T overlap", curr, next_txjob, next_txjob->txtime - txFollowGap() - txend);
         txq_unqJob(&s2ctx->txq, &curr->next);
         if( !s2e_addTxjob(s2ctx, next_txjob, /*relocate*/1, now) )  // note: might change next!
             txq_freeJob(&s2ctx->txq, next_txjob);
@@ -745,6 +1214,14 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
 }
 
 
+ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
+    TRACE(TX_ACTION_BEG, txunit);
+    ustime_t t = nextTxAction(s2ctx, txunit);
+    TRACE(TX_ACTION_END, txunit);
+    return t;
+}
+
+
 
 static void s2e_txtimeout (tmr_t* tmr) {
     s2ctx_t* s2ctx = tmr->ctx;
@@ -775,6 +1252,7 @@ static void s2e_bcntimeout (tmr_t* tmr) {
     }
     if( state != BCNING_OK ) {
         // We don't have PPS or we are not yet time synced -- retry after a while
+        s2ctx->bcn.txtime = 0;   // no reservations while not beaconing
         rt_setTimer(tmr, now + rt_seconds(10));
         return;
     }
@@ -782,6 +1260,8 @@ static void s2e_bcntimeout (tmr_t* tmr) {
     // Next beacon TX time is on upcoming multipl of 128s GPS time which is at least 1s ahead
     ustime_t ahead = BEACON_INTVL - gpstime % BEACON_INTVL;
     sL_t gpstxtime = gpstime + ahead;
+    s2ctx->bcn.txtime  = ts_xtime2ustime(ts_gpstime2xtime(0, gpstxtime));
+    s2ctx->bcn.airtime = s2e_calcDnAirTime(s2e_dr2rps(s2ctx, s2ctx->bcn.ctrl & 0xF), s2ctx->bcn.layout[2], 0, 0);
     txjob_t* txjob = txq_reserveJob(&s2ctx->txq);
     if( txjob == NULL ) {
         LOG(MOD_S2E|ERROR, "Out of TX jobs - cannot send beacon");
@@ -806,7 +1286,10 @@ static void s2e_bcntimeout (tmr_t* tmr) {
     txjob->len     = bcn_len;
     s2e_make_beacon(s2ctx->bcn.layout, epoch*128, 0, lat, lon, p);
 
-    txq_commitJob(&s2ctx->txq, txjob);
+    if( !txq_commitJob(&s2ctx->txq, txjob, ral_rctx2txunit(txjob->rctx)) ) {
+        LOG(MOD_S2E|ERROR, "Out of TX data space - cannot send beacon");
+        goto nextbcn;
+    }
     if( !s2e_addTxjob(s2ctx, txjob, /*initial placement*/0, now) )
         txq_freeJob(&s2ctx->txq, txjob);
 
@@ -869,6 +1352,11 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
     s2bcn_t bcn = { 0 };
 
     s2ctx->txpow = 14 * TXPOW_SCALE;  // builtin default
+    // Settings not repeated in this router_config fall back to station defaults
+    s2ctx->jreqWindow = JREQ_DEDUP_WINDOW;
+    s2ctx->jreqCap = min(JREQ_DEDUP_ENTRIES, MAX_JREQ_DEDUP);
+    s2ctx->lstatIntv = LINKSTATS_INTV;
+    int lstatCap = min(LINKSTATS_ENTRIES, MAX_LINKSTATS);
 
     while( (field = uj_nextField(D)) ) {
         switch(field) {
@@ -1097,6 +1585,64 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
             uj_skipValue(D);
             break;
         }
+        case J_linkstats: {
+            if( uj_null(D) ) {
+                lstatCap = 0;
+                break;
+            }
+            uj_enterObject(D);
+            while( (field = uj_nextField(D)) ) {
+                switch(field) {
+                case J_interval: {
+                    double iv = uj_num(D);   // 0=only on request
+                    if( iv != 0 && (iv < 10 || iv > 86400) )
+                        uj_error(D, "linkstats.interval out of range [0,10..86400]: %g", iv);
+                    s2ctx->lstatIntv = (ustime_t)(iv * 1e6);
+                    break;
+                }
+                case J_entries: {
+                    lstatCap = uj_intRange(D, 0, MAX_LINKSTATS);
+                    break;
+                }
+                default: {
+                    LOG(MOD_S2E|WARNING, "Unknown field in router_config.linkstats - ignored: %s (0x%X)", D->field.name, D->field.crc);
+                    uj_skipValue(D);
+                    break;
+                }
+                }
+            }
+            uj_exitObject(D);
+            break;
+        }
+        case J_jreq_dedup: {
+            if( uj_null(D) ) {
+                s2ctx->jreqWindow = 0;
+                break;
+            }
+            uj_enterObject(D);
+            while( (field = uj_nextField(D)) ) {
+                switch(field) {
+                case J_window: {
+                    double w = uj_num(D);
+                    if( w < 0 || w > 3600 )
+                        uj_error(D, "jreq_dedup.window out of range [0..3600]: %g", w);
+                    s2ctx->jreqWindow = (ustime_t)(w * 1e6);
+                    break;
+                }
+                case J_entries: {
+                    s2ctx->jreqCap = uj_intRange(D, 0, MAX_JREQ_DEDUP);
+                    break;
+                }
+                default: {
+                    LOG(MOD_S2E|WARNING, "Unknown field in router_config.jreq_dedup - ignored: %s (0x%X)", D->field.name, D->field.crc);
+                    uj_skipValue(D);
+                    break;
+                }
+                }
+            }
+            uj_exitObject(D);
+            break;
+        }
         case J_bcning: {
             if( uj_null(D) )
                 break;
@@ -1146,6 +1692,8 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
         }
         }
     }
+    if( lstatCap != s2ctx->lstatCap )
+        lstatIni(s2ctx, lstatCap);  // only a changed capacity discards collected stats
     if( !hwspec[0] ) {
         LOG(MOD_S2E|ERROR, "No 'hwspec' in 'router_config' message");
         return 0;
@@ -1216,6 +1764,16 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
         LOG(MOD_S2E|INFO, "  %s list: %d entries", rt_joineui, jlistlen);
         LOG(MOD_S2E|INFO, "  NetID filter: %08X-%08X-%08X-%08X",
             s2e_netidFilter[3], s2e_netidFilter[2], s2e_netidFilter[1], s2e_netidFilter[0]);
+        if( s2ctx->jreqWindow > 0 && s2ctx->jreqCap ) {
+            LOG(MOD_S2E|INFO, "  Join request dedup: window=%~T entries=%d", s2ctx->jreqWindow, s2ctx->jreqCap);
+        } else {
+            LOG(MOD_S2E|INFO, "  Join request dedup: disabled");
+        }
+        if( s2ctx->lstatCap ) {
+            LOG(MOD_S2E|INFO, "  Link stats: interval=%~T entries=%d", s2ctx->lstatIntv, s2ctx->lstatCap);
+        } else {
+            LOG(MOD_S2E|INFO, "  Link stats: disabled");
+        }
         LOG(MOD_S2E|INFO, "  Dev/test settings: nocca=%d nodc=%d nodwell=%d",
             (s2e_ccaDisabled!=0), (s2e_dcDisabled!=0), (s2e_dwellDisabled!=0));
     }
@@ -1227,6 +1785,10 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
             bcn.layout[0], bcn.layout[1], bcn.layout[2]);
         s2ctx->bcn = bcn;
         s2e_bcntimeout(&s2ctx->bcntimer);
+    } else {
+        // Engine may survive reconnects - drop beaconing of a previous config
+        rt_clrTimer(&s2ctx->bcntimer);
+        s2ctx->bcn = bcn;
     }
     return 1;
 }
@@ -1321,19 +1883,160 @@ void handle_dnframe (s2ctx_t* s2ctx, ujdec_t* D) {
         LOG(MOD_S2E|ERROR, "%J - dropped due to time conversion problems (MCU/GPS out of sync, obsolete input) - xtime=%ld", txjob, txjob->xtime);
         return;  // illegal/obsolete xtime
     }
-    txq_commitJob(&s2ctx->txq, txjob);
+    if( !txq_commitJob(&s2ctx->txq, txjob, ral_rctx2txunit(txjob->rctx)) ) {
+        LOG(MOD_S2E|ERROR, "%J - out of TX data space - dropped", txjob);
+        return;
+    }
     if( !s2e_addTxjob(s2ctx, txjob, /*initial placement*/0, now) )
         txq_freeJob(&s2ctx->txq, txjob);
 }
 
 
-void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
+// --------------------------------------------------------------------------------
+//
+// Downlink latency budget
+//
+// --------------------------------------------------------------------------------
+//
+// For each dnmsg answering an uplink we record how much of the RX1 delay
+// was eaten by backhaul and LNS (turnaround) and how much is left when
+// the frame enters the TX queue (slack). If too many recent frames arrive
+// with little or no RX1 slack, the LNS is told that we prefer RX2.
+//
+
+static const u2_t DNLAT_EDGES_MS[DNLAT_BINS-2] = { 25, 50, 100, 200, 300, 400, 500, 600, 700, 800, 1000, 1500, 2000 };
+
+// Bin 0: negative values, bin i: [edge[i-2],edge[i-1]), last bin: >= last edge
+static int dnlatBin (ustime_t v) {
+    if( v < 0 )
+        return 0;
+    int i = 0;
+    while( i < DNLAT_BINS-2 && v >= DNLAT_EDGES_MS[i] * (ustime_t)1000 )
+        i++;
+    return i+1;
+}
+
+static void dnlatLogHist (str_t what, const u4_t* hist) {
+    char line[160];
+    dbuf_t b = dbuf_ini(line);
+    xprintf(&b, "%u", hist[0]);
+    for( int i=1; i<DNLAT_BINS; i++ )
+        xprintf(&b, " %u", hist[i]);
+    xeos(&b);
+    LOG(MOD_S2E|INFO, "  %s [<0 <25 <50 <100 <200 <300 <400 <500 <600 <700 <800 <1000 <1500 <2000 >=2000ms]: %s", what, line);
+}
+
+static void dnlatEncHist (ujbuf_t* b, const char* key, const u4_t* hist) {
+    uj_encKey(b, key);
+    uj_encOpen(b, '[');
+    for( int i=0; i<DNLAT_BINS; i++ )
+        uj_encUint(b, hist[i]);
+    uj_encClose(b, ']');
+}
+
+void s2e_dnlatLog (s2ctx_t* s2ctx) {
+    s2dnlat_t* L = &s2ctx->dnlat;
+    u4_t n = 0;
+    for( int i=0; i<DNLAT_BINS; i++ )
+        n += L->turn[i];
+    LOG(MOD_S2E|INFO, "Downlink latency: %u dnmsgs turnaround max=%~T - RX1: %u dnmsgs, %u too late, slack min=%~T, %d/32 at risk%s",
+        n, L->turnMax, L->rx1cnt, L->rx1late, L->slackMin, __builtin_popcount(L->lowSlack), L->rx2pref ? " - preferring RX2" : "");
+    dnlatLogHist("turnaround", L->turn);
+    dnlatLogHist("RX1 slack ", L->slack);
+}
+
+// Log and send to LNS - periodically or right away if forced (change of RX2 preference)
+void s2e_dnlatReport (s2ctx_t* s2ctx, int force) {
+    s2dnlat_t* L = &s2ctx->dnlat;
+    ustime_t now = rt_getTime();
+    if( !force ) {
+        if( DNLAT_REPORTS <= 0 )
+            return;
+        if( L->lastReport == 0 ) {
+            L->lastReport = now;  // start of first report interval
+            return;
+        }
+        if( now < L->lastReport + DNLAT_REPORTS )
+            return;
+    }
+    L->lastReport = now;
+    s2e_dnlatLog(s2ctx);
+
+    if( s2ctx->getSendbuf == NULL )
+        return;
+    ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE);
+    if( sendbuf.buf == NULL ) {
+        LOG(MOD_S2E|ERROR, "Failed to send dnlat event, no buffer space");
+        return;
+    }
+    uj_encOpen(&sendbuf, '{');
+    uj_encKVn(&sendbuf,
+              "msgtype",   's', "event",
+              "evcat",     's', "dnlat",
+              "evmsg",     '{',
+              /**/ "rx2pref",  'b', L->rx2pref,
+              /**/ "rx1cnt",   'u', L->rx1cnt,
+              /**/ "rx1late",  'u', L->rx1late,
+              /**/ "risk",     'i', __builtin_popcount(L->lowSlack),
+              /**/ "turnMax",  'T', L->turnMax/1e6,
+              /**/ "slackMin", 'T', L->slackMin/1e6,
+              NULL);
+    uj_encKey(&sendbuf, "edges");
+    uj_encOpen(&sendbuf, '[');
+    for( int i=0; i<DNLAT_BINS-2; i++ )
+        uj_encUint(&sendbuf, DNLAT_EDGES_MS[i]);
+    uj_encClose(&sendbuf, ']');
+    dnlatEncHist(&sendbuf, "turn",  L->turn);
+    dnlatEncHist(&sendbuf, "slack", L->slack);
+    uj_encClose(&sendbuf, '}');
+    uj_encClose(&sendbuf, '}');
+    (*s2ctx->sendText)(s2ctx, &sendbuf);
+}
+
+// turn:  uplink reception to dnmsg arrival
+// slack: RX1 TX time minus earliest possible TX time (only if rx1)
+void s2e_dnlatSample (s2ctx_t* s2ctx, ustime_t turn, ustime_t slack, int rx1) {
+    s2dnlat_t* L = &s2ctx->dnlat;
+    L->turn[dnlatBin(turn)] += 1;
+    if( turn > L->turnMax )
+        L->turnMax = turn;
+    if( rx1 ) {
+        L->slack[dnlatBin(slack)] += 1;
+        if( L->rx1cnt == 0 || slack < L->slackMin )
+            L->slackMin = slack;
+        L->rx1cnt += 1;
+        if( slack < 0 )
+            L->rx1late += 1;
+        L->lowSlack = (L->lowSlack << 1) | (slack < DNLAT_SLACK_MIN);
+        u4_t risk = __builtin_popcount(L->lowSlack);
+        if( !L->rx2pref && DNLAT_RX2PREF_ON && risk >= DNLAT_RX2PREF_ON ) {
+            L->rx2pref = 1;
+            LOG(MOD_S2E|WARNING, "RX1 slack below %~T for %d of last 32 downlinks - telling LNS we prefer RX2", DNLAT_SLACK_MIN, risk);
+            s2e_dnlatReport(s2ctx, 1);
+            return;
+        }
+        if( L->rx2pref && risk <= DNLAT_RX2PREF_OFF ) {
+            L->rx2pref = 0;
+            LOG(MOD_S2E|INFO, "RX1 slack recovered (%d of last 32 downlinks at risk) - withdrawing RX2 preference", risk);
+            s2e_dnlatReport(s2ctx, 1);
+            return;
+        }
+    }
+    s2e_dnlatReport(s2ctx, 0);
+}
+
+
+// Parse a dnmsg and enter the frame into the TX queue.
+// origin: 0 if from LNS, else local client tag+1
+// Returns 1 if the frame was admitted.
+static int dnmsg (s2ctx_t* s2ctx, ujdec_t* D, u1_t origin, sL_t* pdiid) {
     ustime_t now = rt_getTime();
     txjob_t* txjob = txq_reserveJob(&s2ctx->txq);
     if( txjob == NULL ) {
         LOG(MOD_S2E|ERROR, "Out of TX jobs - dropping incoming message");
-        return;
+        return 0;
     }
+    txjob->origin = origin;
     int flags = 0;
     ujcrc_t field;
     while( (field = uj_nextField(D)) ) {
@@ -1370,12 +2073,12 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
             int xlen = D->str.len/2;
             if( xlen > 255 ) {
                 uj_error(D, "TX pdu too large. Maximum is 255 bytes.");
-                return;
+                return 0;
             }
             u1_t* p = txq_reserveData(&s2ctx->txq, xlen);
             if( p == NULL ) {
                 uj_error(D, "Out of TX data space");
-                return;
+                return 0;
             }
             txjob->len = uj_hexstr(D, p, xlen);
             flags |= 0x08;
@@ -1429,7 +2132,11 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
             break;
         }
         case J_MuxTime: {
-            s2e_updateMuxtime(s2ctx, uj_num(D), now);
+            if( origin ) {
+                uj_skipValue(D);  // local clients have no say in muxs time
+            } else {
+                s2e_updateMuxtime(s2ctx, uj_num(D), now);
+            }
             break;
         }
         case J_rctx: {
@@ -1468,7 +2175,7 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
         // flags & 0xC00 in {0x000,0x300}  -- ditto RX2
         ((1 << ((flags >> 10) & 3)) & ((1<<3)|(1<<0))) == 0 ) {
         LOG(MOD_S2E|WARNING, "Some mandatory fields are missing (flags=0x%X)", flags);
-        return;
+        return 0;
     }
     if( (flags & 0x1000) == 0 && txjob->xtime ) {
         // We have no rctx but xtime - set it with radio unit from xtime
@@ -1485,6 +2192,10 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
         if( txjob->xtime != 0 ) {
             txjob->xtime += txjob->rxdelay * 1000000;
             txjob->txtime = ts_xtime2ustime(txjob->xtime);
+            if( txjob->txtime != 0 && !origin ) {
+                s2e_dnlatSample(s2ctx, now - (txjob->txtime - txjob->rxdelay * 1000000),
+                                txjob->txtime - (now + TX_AIM_GAP), txjob->freq != 0);
+            }
         }
         if( txjob->freq == 0 ) {
             // Switch over to RX2:
@@ -1492,21 +2203,63 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
             //  class C spontaneous dn: - no RX1 provided
             if( txjob->rx2freq == 0 ) {
                 LOG(MOD_S2E|WARNING, "Ignoring 'dnmsg' with neither RX1/RX2 frequencies");
-                return;
+                return 0;
             }
             if( !altTxTime(s2ctx, txjob, now+TX_AIM_GAP) ) {
                 LOG(MOD_S2E|WARNING, "Ignoring 'dnmsg' with no viable RX2");
-                return;
+                return 0;
             }
         }
     }
     if( txjob->xtime == 0 || txjob->txtime == 0 ) {
         LOG(MOD_S2E|ERROR, "%J - dropped due to time conversion problems (MCU/GPS out of sync, obsolete input) - xtime=%ld", txjob, txjob->xtime);
-        return;
+        return 0;
     }
-    txq_commitJob(&s2ctx->txq, txjob);
-    if( !s2e_addTxjob(s2ctx, txjob, /*initial placement*/0, now) )
+    if( !txq_commitJob(&s2ctx->txq, txjob, ral_rctx2txunit(txjob->rctx)) ) {
+        LOG(MOD_S2E|ERROR, "%J - out of TX data space - dropped", txjob);
+        return 0;
+    }
+    if( pdiid )
+        *pdiid = txjob->diid;
+    if( !s2e_addTxjob(s2ctx, txjob, /*initial placement*/0, now) ) {
         txq_freeJob(&s2ctx->txq, txjob);
+        return 0;
+    }
+    return 1;
+}
+
+
+void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
+    dnmsg(s2ctx, D, 0, NULL);
+}
+
+
+// Downlink submitted by a local application (see src-linux/dnlocal.c).
+// Same format and admission path as dnmsg from the LNS - dntxed is routed
+// back to the local client via sys_dnlocalTxed.
+// Returns 1 if the frame was admitted.
+int s2e_localDnmsg (s2ctx_t* s2ctx, char* json, ujoff_t jsonlen, u1_t client, sL_t* pdiid) {
+    ujdec_t D;
+    uj_iniDecoder(&D, json, jsonlen);
+    ujcrc_t msgtype = uj_msgtype(&D);
+    if( uj_decode(&D) ) {
+        LOG(MOD_S2E|ERROR, "Parsing of local dnmsg failed - ignored");
+        return 0;
+    }
+    if( msgtype != J_dnmsg ) {
+        LOG(MOD_S2E|ERROR, "Local client may only send 'dnmsg' - ignored");
+        return 0;
+    }
+    if( s2ctx->region == 0 ) {
+        LOG(MOD_S2E|WARNING, "Local 'dnmsg' before 'router_config' - dropped");
+        return 0;
+    }
+    uj_nextValue(&D);
+    uj_enterObject(&D);
+    int ok = dnmsg(s2ctx, &D, client+1, pdiid);
+    uj_exitObject(&D);
+    uj_assertEOF(&D);
+    return ok;
 }
 
 
@@ -1616,9 +2369,12 @@ void handle_dnsched (s2ctx_t* s2ctx, ujdec_t* D) {
                     if( txjob->txtime != 0 ) {
                         LOG(MOD_S2E|INFO, "DNSCHED diid=%ld %>T %~T DR%-2d %F - %d bytes",
                             txjob->diid, rt_ustime2utc(txjob->txtime), txjob->txtime-now, txjob->dr, txjob->freq, txjob->len);
-                        txq_commitJob(&s2ctx->txq, txjob);
-                        if( !s2e_addTxjob(s2ctx, txjob, /*initial placement*/0, now) )
+                        if( !txq_commitJob(&s2ctx->txq, txjob, txunit) ) {
+                            LOG(MOD_S2E|ERROR, "%J - out of TX data space - dropped", txjob);
+                        }
+                        else if( !s2e_addTxjob(s2ctx, txjob, /*initial placement*/0, now) ) {
                             txq_freeJob(&s2ctx->txq, txjob);
+                        }
                     } else {
                         LOG(MOD_S2E|ERROR, "DNSCHED failed to convert %stime: %ld",
                             txjob->gpstime ? "gps":"x",
@@ -1677,6 +2433,7 @@ void handle_timesync (s2ctx_t* s2ctx, ujdec_t* D) {
     }
     if( xtime )
         ts_setTimesyncLns(xtime, gpstime);
+    TRACE(TS_LNS_RESP, txtime ? rxtime - txtime : 0);
     if( txtime && gpstime )
         ts_processTimesyncLns(txtime, rxtime, gpstime);
 }
@@ -1783,10 +2540,59 @@ void handle_runcmd (s2ctx_t* s2ctx, ujdec_t* D) {
 //
 // --------------------------------------------------------------------------------
 
+// CRC over all fields of a router_config except MuxTime.
+// Decodes in skip mode which leaves the JSON text untouched for the real parse.
+u4_t s2e_rconfCrc (char* json, ujoff_t jsonlen) {
+    ujdec_t D;
+    ujcrc_t field;
+    u4_t crc = 0;
+    uj_iniDecoder(&D, json, jsonlen);
+    if( uj_decode(&D) )
+        return 0;
+    uj_nextValue(&D);
+    uj_enterObject(&D);
+    while(1) {
+        // uj_skipValue leaves skip mode - field names must not be decoded in place either
+        D.mode |= UJ_MODE_SKIP;
+        if( !(field = uj_nextField(&D)) )
+            break;
+        ujbuf_t v = uj_skipValue(&D);
+        if( field != J_MuxTime ) {
+            crc = rt_crc32(crc, &field, sizeof(field));
+            crc = rt_crc32(crc, v.buf, v.bufsize);
+        }
+    }
+    return crc;
+}
+
+
+// A reconnect to muxs brings the same router_config again. Re-applying it would
+// restart the radio and timesync and strand everything queued for TX. If nothing
+// changed keep the engine running - only pick up the new MuxTime.
+static int keep_router_config (s2ctx_t* s2ctx, ujdec_t* D, u4_t crc) {
+    if( s2ctx->region == 0 || crc == 0 || crc != s2ctx->rconfCrc )
+        return 0;
+    ujcrc_t field;
+    while( (field = uj_nextField(D)) ) {
+        if( field == J_MuxTime ) {
+            s2e_updateMuxtime(s2ctx, uj_num(D), 0);
+            rt_utcOffset = s2ctx->muxtime*1e6 - s2ctx->reftime;
+            rt_utcOffset_ts = s2ctx->reftime;
+        } else {
+            uj_skipValue(D);
+        }
+    }
+    LOG(MOD_S2E|INFO, "Router config unchanged - radio kept running (%d buffered uplinks)",
+        s2ctx->rxq.next - s2ctx->rxq.first);
+    return 1;
+}
+
+
 int s2e_onMsg (s2ctx_t* s2ctx, char* json, ujoff_t jsonlen) {
     ujdec_t D;
     uj_iniDecoder(&D, json, jsonlen);
     ujcrc_t msgtype = uj_msgtype(&D);
+    u4_t crc = msgtype == J_router_config ? s2e_rconfCrc(json, jsonlen) : 0;
     if( uj_decode(&D) ) {
         LOG(MOD_S2E|ERROR, "Parsing of JSON message failed - ignored");
         return 1;   // return fail? would trigger a reconnect
@@ -1807,8 +2613,17 @@ int s2e_onMsg (s2ctx_t* s2ctx, char* json, ujoff_t jsonlen) {
         break;
     }
     case J_router_config: {
+        if( keep_router_config(s2ctx, &D, crc) ) {
+            sys_inState(SYSIS_TC_CONNECTED);
+            s2e_flushRxjobs(s2ctx);   // uplinks buffered while disconnected
+            break;
+        }
+        s2ctx->rconfCrc = 0;
         ok = handle_router_config(s2ctx, &D);
-        if( ok ) sys_inState(SYSIS_TC_CONNECTED);
+        if( ok ) {
+            s2ctx->rconfCrc = crc;
+            sys_inState(SYSIS_TC_CONNECTED);
+        }
         break;
     }
     case J_dnframe: {
@@ -1817,7 +2632,9 @@ int s2e_onMsg (s2ctx_t* s2ctx, char* json, ujoff_t jsonlen) {
         break;
     }
     case J_dnmsg: {
+        TRACE(DNMSG_BEG, 0);
         handle_dnmsg(s2ctx, &D);
+        TRACE(DNMSG_END, 0);
         break;
     }
     case J_dnsched: {
@@ -1832,6 +2649,12 @@ int s2e_onMsg (s2ctx_t* s2ctx, char* json, ujoff_t jsonlen) {
         handle_getxtime(s2ctx, &D);
         break;
     }
+    case J_linkstats: {
+        while( uj_nextField(&D) )
+            uj_skipValue(&D);
+        s2e_lstatSummary(s2ctx);
+        break;
+    }
     case J_runcmd: {
         handle_runcmd(s2ctx, &D);
         break;
@@ -67,6 +67,7 @@ enum {
     TXFLAG_PING      = 0x08,
     TXFLAG_CLSC      = 0x10,
     TXFLAG_BCN       = 0x20,  
+    TXFLAG_STAGED    = 0x40,  // prepared to follow an ongoing TX (pipelined mode)
 };
 
 
@@ -108,8 +109,55 @@ typedef struct s2bcn {
     u1_t     ctrl;      // 0x0F => DR, 0xF0 = n frequencies
     u1_t     layout[3]; // time_off, infodesc_off, bcn_len
     u4_t     freqs[8];  // 1 or up to 8 frequencies
+    ustime_t txtime;    // upcoming beacon (local time) - later ones follow every BEACON_INTVL / 0=none
+    ustime_t airtime;   // of one beacon frame
 } s2bcn_t;
 
+// Recently forwarded join requests - later copies are suppressed
+typedef struct s2jreq {
+    uL_t     joineui;
+    uL_t     deveui;
+    ustime_t expires;   // entry is free/stale if in the past
+    u2_t     devnonce;
+    u2_t     dups;      // copies suppressed since forwarded
+} s2jreq_t;
+
+// Link statistics of one device (DevAddr) aggregated since the last summary
+enum { LSTAT_NIL = 0xFFFF };
+typedef struct s2lstat {
+    u4_t     devaddr;
+    u2_t     hnext;     // hash chain
+    u2_t     lprev;     // LRU list - towards most recently seen
+    u2_t     lnext;     // LRU list - towards least recently seen
+    u2_t     frames;    // uplinks since last summary (0=nothing to report)
+    u2_t     mirrors;   // mirror copies folded into these uplinks
+    u2_t     fcnt0;     // FCnt of first uplink since last summary
+    u2_t     fcnt1;     // FCnt of last uplink
+    s2_t     rssiMin;   // dBm
+    s2_t     rssiMax;
+    s1_t     snrMin;    // scaled SNR (*4) as in rxjob_t
+    s1_t     snrMax;
+    s4_t     rssiSum;   // dBm
+    s4_t     snrSum;    // scaled SNR (*4)
+    u2_t     drs[DR_CNT];
+} s2lstat_t;
+
+// Downlink latency budget as seen at arrival of dnmsg (per TC session)
+//  turn:  uplink reception -> arrival of matching dnmsg (backhaul + LNS)
+//  slack: RX1 TX time minus earliest possible TX time (bin 0: RX1 missed)
+enum { DNLAT_BINS = 15 };
+typedef struct s2dnlat {
+    u4_t     turn[DNLAT_BINS];
+    u4_t     slack[DNLAT_BINS];
+    u4_t     rx1cnt;     // dnmsgs with RX1 parameters
+    u4_t     rx1late;    // ditto - too late for RX1 at arrival
+    ustime_t turnMax;
+    ustime_t slackMin;
+    ustime_t lastReport;
+    u4_t     lowSlack;   // last 32 RX1 dnmsgs - bit set if slack below DNLAT_SLACK_MIN
+    u1_t     rx2pref;    // LNS has been told we prefer RX2
+} s2dnlat_t;
+
 typedef struct s2ctx {
     dbuf_t (*getSendbuf) (struct s2ctx* s2ctx, int minsize);     // wired to TC/websocket
     void   (*sendText)   (struct s2ctx* s2ctx, dbuf_t* buf);     // ditto
@@ -127,6 +175,7 @@ typedef struct s2ctx {
     u4_t     txpow2_freq[2]; // freq range for txpow2      / 0,0 = no range
     ujcrc_t  region;
     char     region_s[16];
+    u4_t     rconfCrc;   // router_config in effect (w/o MuxTime) - see s2e_onMsg
     txq_t    txq;
     rxq_t    rxq;
     double   muxtime;    // time stamp from muxs
@@ -134,6 +183,20 @@ typedef struct s2ctx {
     s2txunit_t txunits[MAX_TXUNITS];
     s2bcn_t    bcn;      // beacon definition
     tmr_t      bcntimer;
+    ustime_t   jreqWindow;  // dedup window for join requests / 0=disabled
+    u2_t       jreqCap;     // max entries of jreqs[] in use
+    s2jreq_t   jreqs[MAX_JREQ_DEDUP];
+    s2dnlat_t  dnlat;
+    u2_t       lstatCap;    // max entries of lstats[] in use / 0=disabled
+    u2_t       lstatUsed;   // entries of lstats[] allocated
+    u2_t       lstatHead;   // most recently seen
+    u2_t       lstatTail;   // least recently seen - evicted first
+    u2_t       lstatFlush;  // next entry to report in current summary / LSTAT_NIL
+    u4_t       lstatEvicted;// entries with unreported data evicted since last summary
+    ustime_t   lstatIntv;   // summary interval / 0=only on request
+    ustime_t   lstatBeg;    // start of current summary interval
+    u2_t       lstatHash[MAX_LINKSTATS];
+    s2lstat_t  lstats[MAX_LINKSTATS];
 
 } s2ctx_t;
 
@@ -149,6 +212,7 @@ rps_t    s2e_dr2rps (s2ctx_t*, u1_t dr);
 u1_t     s2e_rps2dr (s2ctx_t*, rps_t rps);
 ustime_t s2e_calcUpAirTime (rps_t rps, u1_t plen);
 ustime_t s2e_calcDnAirTime (rps_t rps, u1_t plen, u1_t lcrc, u2_t preamble);
+u1_t     s2e_pickTxunit (s2ctx_t* s2ctx, txjob_t* txjob, u1_t rxunit, u1_t cands);
 ustime_t s2e_updateMuxtime(s2ctx_t* s2ctx, double muxstime, ustime_t now);   // now=0 => rt_getTime(), return now
 
 void     s2e_ini          (s2ctx_t*);
@@ -158,11 +222,19 @@ void     s2e_disableDC    (s2ctx_t*);
 rxjob_t* s2e_nextRxjob    (s2ctx_t*);
 void     s2e_addRxjob     (s2ctx_t*, rxjob_t* rxjob);
 void     s2e_flushRxjobs  (s2ctx_t*);
+int      s2e_addTxjob     (s2ctx_t*, txjob_t* txjob, int relocate, ustime_t now);
 int      s2e_onMsg        (s2ctx_t*, char* json, ujoff_t jsonlen);
+u4_t     s2e_rconfCrc     (char* json, ujoff_t jsonlen);
 int      s2e_onBinary     (s2ctx_t*, u1_t* data, ujoff_t datalen);
+int      s2e_localDnmsg   (s2ctx_t*, char* json, ujoff_t jsonlen, u1_t client, sL_t* pdiid);
 ustime_t s2e_nextTxAction (s2ctx_t*, u1_t txunit);
 int      s2e_handleCommands (ujcrc_t msgtype, s2ctx_t* s2ctx, ujdec_t* D);
 void     s2e_handleRmtsh    (s2ctx_t* s2ctx, ujdec_t* D);
+void     s2e_lstatUpdate    (s2ctx_t* s2ctx, rxjob_t* rxjob, const u1_t* frame);
+void     s2e_lstatSummary   (s2ctx_t* s2ctx);
+void     s2e_dnlatSample    (s2ctx_t* s2ctx, ustime_t turn, ustime_t slack, int rx1);
+void     s2e_dnlatReport    (s2ctx_t* s2ctx, int force);
+void     s2e_dnlatLog       (s2ctx_t* s2ctx);
 
 
 #endif // _s2e_h_
@@ -31,6 +31,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include "s2conf.h"
 #include "selftests.h"
 #include "rt.h"
 #include "fs.h"
@@ -392,6 +393,19 @@ void selftest_fs () {
     i3 = printFsInfo("Flash after triggering GC + emergency GC + still not enough space", NULL);
     TCHECK(i3.activeSection == i2.activeSection && i3.gcCycles == i2.gcCycles+2);
 
+    // Small writes are buffered - if the remaining space is used up meanwhile
+    // the failure is only reported by fs_close
+    fd = fs_open("big", O_CREAT|O_APPEND|O_WRONLY, 0777);
+    int fdS = fs_open("small", O_CREAT|O_TRUNC|O_WRONLY, 0777);
+    n = fs_write(fdS, sample, 100);
+    TCHECK(fd >= 0 && fdS >= 0 && n == 100);
+    fs_info(&i2);
+    n = fs_write(fd, sample, i2.free-8);    // use up all remaining space
+    err = fs_close(fd);
+    TCHECK(n == i2.free-8 && err == 0);
+    err = fs_close(fdS);
+    TCHECK(err == -1 && errno == ENOSPC);
+
     // Check fd1 - read file pointer should be still ok
     n = fs_read(fd1, buf, 16);
     TCHECK(n == 16 && memcmp(sample+16, buf, 16) == 0);
@@ -400,6 +414,109 @@ void selftest_fs () {
 
     fs_close(fd);
     fs_close(fd1);
+
+    // ----------------------------------------
+    // Write coalescing
+    fs_erase();
+    fs_ini(key);
+
+    fd = fs_open("coal", O_CREAT|O_TRUNC|O_WRONLY, 0777);
+    TCHECK(fd >= 0);
+    fs_info(&i1);
+    for( int k=0; k<100; k++ ) {
+        n = fs_write(fd, sample+7*k, 7);
+        TCHECK(n == 7);
+    }
+    fs_info(&i2);
+    TCHECK(i2.records == i1.records+1);     // first FS_WBUF_SIZE bytes flushed as one record
+    fd1 = fs_open("coal", O_RDONLY);        // flushes pending data of all writers
+    n = fs_read(fd1, buf, sizeof(buf));
+    TCHECK(fd1 >= 0 && n == 700 && memcmp(sample, buf, 700) == 0);
+    n = fs_write(fd, sample+700, 5);
+    TCHECK(n == 5);
+    n = fs_read(fd1, buf, sizeof(buf));     // reading flushes writers of same file
+    TCHECK(n == 5 && memcmp(sample+700, buf, 5) == 0);
+    n = fs_write(fd, sample, FS_WBUF_SIZE-1);
+    n1 = fs_write(fd, sample, 2*FS_WBUF_SIZE);
+    TCHECK(n == FS_WBUF_SIZE-1 && n1 == 2*FS_WBUF_SIZE);
+    err = fs_close(fd);
+    TCHECK(err == 0);
+    err = fs_stat("coal", &st1);
+    TCHECK(err == 0 && st1.st_size == 705+3*FS_WBUF_SIZE-1);
+    fs_close(fd1);
+    err = fs_ck();
+    TCHECK(err==1);
+
+    // CUPS like workload: credentials + firmware update arriving in small HTTP chunks.
+    // Compare against unbuffered behavior (fs_sync after each write => one record per write).
+    if( selftest_bench() ) {
+        for( int mode=0; mode<2; mode++ ) {
+            fs_erase();
+            fs_ini(key);
+            fs_info(&i1);
+            for( int round=0; round<24; round++ ) {
+                static const struct { str_t fn; int len; int chunk; } wl[] = {
+                    { "cups.cred",   3000,  97 },
+                    { "tc.cred",     3000,  97 },
+                    { "update.bin", 65536, 211 },
+                };
+                for( int w=0; w<SIZE_ARRAY(wl); w++ ) {
+                    fd = fs_open(wl[w].fn, O_CREAT|O_TRUNC|O_WRONLY, 0777);
+                    TCHECK(fd >= 0);
+                    for( int off=0; off < wl[w].len; off += wl[w].chunk ) {
+                        int l = min(wl[w].chunk, wl[w].len-off);
+                        n = fs_write(fd, sample + off % (sizeof(sample)-wl[w].chunk), l);
+                        TCHECK(n == l);
+                        if( mode == 0 )
+                            fs_sync();
+                    }
+                    err = fs_close(fd);
+                    TCHECK(err == 0);
+                }
+            }
+            fs_info(&i2);
+            err = fs_stat("update.bin", &st1);
+            TCHECK(err == 0 && st1.st_size == 65536);
+            fprintf(stderr, "FS CUPS workload %-10s: flash written=%7u bytes  gc=%d  records=%d\n",
+                    mode ? "buffered" : "unbuffered",
+                    i2.written-i1.written, i2.gcCycles-i1.gcCycles, i2.records);
+        }
+    }
+
+    // ----------------------------------------
+    // Mount time - checkpoint vs full scan on a filled up section
+    fs_erase();
+    fs_ini(key);
+    int fillsz = 0;
+    fs_info(&i1);
+    int gcCycles = i1.gcCycles;
+    for( int k=0; i1.free > 4*sizeof(sample); k++ ) {
+        snprintf(fnbuf, sizeof(fnbuf), "%c%c", 'A'+k/26, 'A'+k%26);
+        fd = fs_open(fnbuf, O_CREAT|O_TRUNC|O_WRONLY, 0777);
+        n = fs_write(fd, sample, sizeof(sample));
+        TCHECK(fd >= 0 && n == sizeof(sample));
+        fillsz = n;
+        for( int off=0; off+97 < sizeof(sample); off += 97 )
+            fillsz += fs_write(fd, sample+off, 97);
+        fs_close(fd);
+        fs_info(&i1);
+    }
+    TCHECK(i1.gcCycles == gcCycles);
+    ustime_t t0 = rt_getTime();
+    err = fs_ck();
+    ustime_t t1 = rt_getTime();
+    TCHECK(err==1);
+    fs_info(&i2);
+    err = fs_ckFull();
+    ustime_t t2 = rt_getTime();
+    TCHECK(err==1);
+    fs_info(&i3);
+    TCHECK(i1.used == i2.used && i2.used == i3.used && i1.records == i3.records);
+    if( selftest_bench() )
+        fprintf(stderr, "FS mount %d bytes/%d records: checkpoint=%ldus full scan=%ldus\n",
+                i3.used, i3.records, (long)(t1-t0), (long)(t2-t1));
+    err = fs_stat("AA", &st1);
+    TCHECK(err == 0 && st1.st_size == fillsz);
 }
 
 #endif
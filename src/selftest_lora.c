@@ -26,6 +26,7 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include "selftests.h"
 #include "s2e.h"
 
@@ -34,6 +35,186 @@
 static const uL_t euiFilter1[] = { 0xEFCDAB8967452300, 0xEFCDAB8967452300, 0 };
 static const uL_t euiFilter2[] = { 0xEFCDAB8967452300, 0xEFCDAB8967452301, 0 };
 
+static char upjson[BUFSZ];
+static int  upcnt;
+
+static dbuf_t test_getSendbuf (s2ctx_t* s2ctx, int minsize) {
+    dbuf_t b = { .buf = upjson, .bufsize = sizeof(upjson), .pos = 0 };
+    return b;
+}
+
+static void test_sendText (s2ctx_t* s2ctx, dbuf_t* b) {
+    upcnt += 1;
+    b->buf = NULL;
+}
+
+static void addRxFrame (s2ctx_t* s2ctx, const char* frame, int len, u1_t dr, s1_t snr, u1_t rssi) {
+    rxjob_t* j = s2e_nextRxjob(s2ctx);
+    TCHECK(j != NULL);
+    memcpy(&s2ctx->rxq.rxdata[j->off], frame, len);
+    j->len  = len;
+    j->dr   = dr;
+    j->snr  = snr;
+    j->rssi = rssi;
+    j->freq = 868100000;
+    s2e_addRxjob(s2ctx, j);
+}
+
+static void selftest_jreqDedup (const char* Tjreq) {
+    s2ctx_t* s2ctx = rt_malloc(s2ctx_t);
+    s2e_ini(s2ctx);
+    s2ctx->getSendbuf = test_getSendbuf;
+    s2ctx->sendText = test_sendText;
+    s2ctx->jreqWindow = rt_seconds(10);
+    s2ctx->jreqCap = 2;
+    upcnt = 0;
+    rt_lockHeap(1);  // uplink path must not touch the heap
+
+    // Three copies pending in rxq (different DRs => not mirrors) - forward best one
+    addRxFrame(s2ctx, Tjreq, 23, 5, 4*2, 100);
+    addRxFrame(s2ctx, Tjreq, 23, 4, 4*9,  80);
+    addRxFrame(s2ctx, Tjreq, 23, 3, 4*1, 110);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 1);
+    TCHECK(strstr(upjson, "\"DR\":4,") != NULL);
+    TCHECK(s2ctx->jreqs[0].dups == 2);
+
+    // Later retransmission within window is suppressed
+    addRxFrame(s2ctx, Tjreq, 23, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 1);
+    TCHECK(s2ctx->jreqs[0].dups == 3);
+
+    // New DevNonce is a new join request
+    char T2[23];
+    memcpy(T2, Tjreq, 23);
+    T2[17] ^= 1;
+    addRxFrame(s2ctx, T2, 23, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 2);
+
+    // Cache full - oldest entry is recycled
+    T2[17] ^= 2;
+    addRxFrame(s2ctx, T2, 23, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 3);
+    addRxFrame(s2ctx, Tjreq, 23, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 4);
+
+    // Expired entries do not suppress
+    for( int i=0; i<MAX_JREQ_DEDUP; i++ )
+        s2ctx->jreqs[i].expires = rt_getTime()-1;
+    addRxFrame(s2ctx, Tjreq, 23, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 5);
+
+    // Join requests stopped by the JoinEUI filter do not occupy the cache
+    T2[17] ^= 4;
+    s2e_joineuiFilter[0] = s2e_joineuiFilter[1] = 1;
+    addRxFrame(s2ctx, T2, 23, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 5);
+    s2e_joineuiFilter[0] = s2e_joineuiFilter[1] = 0;
+    addRxFrame(s2ctx, T2, 23, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 6);
+
+    // Disabled
+    s2ctx->jreqWindow = 0;
+    addRxFrame(s2ctx, Tjreq, 23, 5, 4*2, 100);
+    addRxFrame(s2ctx, Tjreq, 23, 4, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 8);
+
+    rt_lockHeap(0);
+    rt_free(s2ctx);
+}
+
+
+static void selftest_linkstats (const char* Tdaup) {
+    s2ctx_t* s2ctx = rt_malloc(s2ctx_t);
+    s2e_ini(s2ctx);
+    s2ctx->getSendbuf = test_getSendbuf;
+    s2ctx->sendText = test_sendText;
+    upcnt = 0;
+    TCHECK(s2ctx->lstatCap == min(LINKSTATS_ENTRIES, MAX_LINKSTATS));
+
+    char F[16];
+    memcpy(F, Tdaup, sizeof(F));
+    addRxFrame(s2ctx, F, 16, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    F[6] += 1;  // next FCnt - received twice (mirror)
+    addRxFrame(s2ctx, F, 16, 3, 4*6, 90);
+    addRxFrame(s2ctx, F, 16, 3, 4*1, 110);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(upcnt == 2 && s2ctx->lstatUsed == 1);
+    s2lstat_t* e = &s2ctx->lstats[0];
+    TCHECK(e->devaddr == 0xFFEFCDAB && e->frames == 2 && e->mirrors == 1);
+    TCHECK(e->fcnt0 == 0xF4F3 && e->fcnt1 == 0xF4F4);
+    TCHECK(e->rssiMin == -100 && e->rssiMax == -90 && e->rssiSum == -190);
+    TCHECK(e->snrMin == 4*2 && e->snrMax == 4*6);
+    TCHECK(e->drs[5] == 1 && e->drs[3] == 1);
+
+    // Table full - least recently seen device is evicted
+    s2ctx->lstatCap = 2;
+    F[1] = 1;
+    addRxFrame(s2ctx, F, 16, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    F[1] = 2;
+    addRxFrame(s2ctx, F, 16, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(s2ctx->lstatUsed == 2 && s2ctx->lstatEvicted == 1);
+    F[1] = 1;
+    addRxFrame(s2ctx, F, 16, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(s2ctx->lstatUsed == 2 && s2ctx->lstatEvicted == 1);
+    TCHECK(s2ctx->lstats[s2ctx->lstatHead].devaddr == 0xFFEFCD01 && s2ctx->lstats[s2ctx->lstatHead].frames == 2);
+
+    // Summary resets aggregates
+    upcnt = 0;
+    s2e_lstatSummary(s2ctx);
+    TCHECK(upcnt == 1);
+    TCHECK(strstr(upjson, "\"msgtype\":\"linkstats\"") != NULL);
+    TCHECK(strstr(upjson, "\"evicted\":1") != NULL);
+    TCHECK(strstr(upjson, "\"DevAddr\":-1061631,\"frames\":2,\"mirrors\":0,\"FCnt\":[62708,62708],\"rssi\":[-100,-100,-100]") != NULL);
+    TCHECK(strstr(upjson, "\"final\":true") != NULL);
+    TCHECK(s2ctx->lstatFlush == LSTAT_NIL && s2ctx->lstatEvicted == 0);
+    TCHECK(s2ctx->lstats[0].frames == 0 && s2ctx->lstats[1].frames == 0);
+
+    // Disabled
+    s2ctx->lstatCap = 0;
+    addRxFrame(s2ctx, F, 16, 5, 4*2, 100);
+    s2e_flushRxjobs(s2ctx);
+    TCHECK(s2ctx->lstats[0].frames == 0 && s2ctx->lstats[1].frames == 0);
+    rt_free(s2ctx);
+
+    if( selftest_bench() ) {
+        // Cost of one update - table hits and constant eviction
+        s2ctx = rt_malloc(s2ctx_t);
+        s2e_ini(s2ctx);
+        s2ctx->lstatCap = MAX_LINKSTATS;
+        static const int ndevs[] = { MAX_LINKSTATS/2, 8*MAX_LINKSTATS };
+        for( int k=0; k<SIZE_ARRAY(ndevs); k++ ) {
+            rxjob_t j = { .len = 16, .dr = 5, .snr = 4*2, .rssi = 100 };
+            u1_t frame[16];
+            memcpy(frame, Tdaup, sizeof(frame));
+            srand(4711);
+            enum { N = 1000000 };
+            ustime_t t0 = rt_getTime();
+            for( int i=0; i<N; i++ ) {
+                u4_t devaddr = 0x26000000 + rand() % ndevs[k];
+                memcpy(frame+1, &devaddr, 4);
+                s2e_lstatUpdate(s2ctx, &j, frame);
+            }
+            ustime_t dt = rt_getTime() - t0;
+            fprintf(stderr, "Link stats update: %5d devices / %d entries: %.0fns per uplink\n",
+                    ndevs[k], MAX_LINKSTATS, dt*1000.0/N);
+        }
+        rt_free(s2ctx);
+    }
+}
+
 
 void selftest_lora () {
     char* jsonbuf = rt_mallocN(char, BUFSZ);
@@ -80,6 +261,8 @@ void selftest_lora () {
     TCHECK(s2e_parse_lora_frame(&B, (const u1_t*)Tjreq, 23, NULL));
     s2e_joineuiFilter[0] = 0;
 
+    selftest_jreqDedup(Tjreq);
+
     B.pos = 0;
     const char* Tdaup1 = "\x40\xAB\xCD\xEF\xFF\x01\xF3\xF4\xFF\x20\x21\x22\xA0\xA1\xA2\xA3";  // daup
     TCHECK(s2e_parse_lora_frame(&B, (const u1_t*)Tdaup1, 12+1+3, NULL));
@@ -95,6 +278,9 @@ void selftest_lora () {
     B.pos = 0;
     s2e_netidFilter[0] = s2e_netidFilter[1] = s2e_netidFilter[2] = s2e_netidFilter[3] = 0;
     TCHECK(!s2e_parse_lora_frame(&B, (const u1_t*)Tdaup1, 12+1+3, NULL));
+    s2e_netidFilter[0] = s2e_netidFilter[1] = s2e_netidFilter[2] = s2e_netidFilter[3] = 0xFFFFFFFF;
+
+    selftest_linkstats(Tdaup1);
 
     free(jsonbuf);
 }
@@ -0,0 +1,163 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include "selftests.h"
+#include "ws.h"
+#include "http.h"
+#include "sys.h"
+#include "fs.h"
+
+static void refMask (u1_t* buf, int len, const u1_t key[4]) {
+    for( int i=0; i<len; i++ )
+        buf[i] ^= key[i&3];
+}
+
+static void benchMask (int len) {
+    enum { TOTAL = 16*1024*1024 };
+    u1_t* buf = rt_mallocN(u1_t, len);
+    const u1_t key[4] = { 0x37, 0xFA, 0x21, 0x3D };
+    int rounds = TOTAL / len;
+    ustime_t t0 = rt_getTime();
+    for( int r=0; r<rounds; r++ )
+        refMask(buf, len, key);
+    ustime_t t1 = rt_getTime();
+    for( int r=0; r<rounds; r++ )
+        ws_mask(buf, len, key);
+    ustime_t t2 = rt_getTime();
+    fprintf(stderr, "WS mask %5d bytes: bytewise %7.1f MB/s  ws_mask %7.1f MB/s\n", len,
+            (double)rounds*len / max(1, t1-t0), (double)rounds*len / max(1, t2-t1));
+    rt_free(buf);
+}
+
+static void credFile (str_t name, const char* data, int len) {
+    str_t fn = sys_makeFilepath(name, 0);
+    if( data ) {
+        int fd = fs_open(fn, O_CREAT|O_WRONLY|O_TRUNC, S_IRUSR|S_IWUSR);
+        TCHECK(fd >= 0 && fs_write(fd, data, len) == len && fs_close(fd) == 0);
+    } else {
+        fs_unlink(fn);
+    }
+    rt_free((void*)fn);
+}
+
+// Credentials for TLS setup are served from memory - reconnects must not reload them
+static void selftest_cred () {
+    static const char pem[] = "-----BEGIN CERTIFICATE-----\nMIIB\n-----END CERTIFICATE-----\n";
+    static const char der[] = "\x30\x82\x01\x0A\x02\x01\x00";
+    credFile("tc-boot.trust", pem, sizeof(pem)-1);
+    credFile("tc-boot.key", der, sizeof(der)-1);
+
+    str_t elems[SYS_CRED_NELEMS], elems2[SYS_CRED_NELEMS];
+    int elemslen[SYS_CRED_NELEMS], elemslen2[SYS_CRED_NELEMS];
+    TCHECK(sys_cred(SYS_CRED_TC, SYS_CRED_BOOT, elems, elemslen) == SYS_AUTH_TOKEN);
+    TCHECK(elemslen[SYS_CRED_TRUST] == sizeof(pem));       // PEM including terminating zero
+    TCHECK(elemslen[SYS_CRED_MYCERT] == 0 && elems[SYS_CRED_MYCERT] == NULL);
+    TCHECK(elemslen[SYS_CRED_MYKEY] == sizeof(der)-1);     // DER as is
+    TCHECK(memcmp(elems[SYS_CRED_MYKEY], der, sizeof(der)-1) == 0);
+
+    // Unchanged files - same data without touching the heap
+    rt_lockHeap(1);
+    for( int i=0; i<10; i++ ) {
+        TCHECK(sys_cred(SYS_CRED_TC, SYS_CRED_BOOT, elems2, elemslen2) == SYS_AUTH_TOKEN);
+        TCHECK(memcmp(elems, elems2, sizeof(elems)) == 0 && memcmp(elemslen, elemslen2, sizeof(elemslen)) == 0);
+    }
+    rt_lockHeap(0);
+
+    credFile("tc-boot.trust", NULL, 0);
+    credFile("tc-boot.key", NULL, 0);
+    TCHECK(sys_cred(SYS_CRED_TC, SYS_CRED_BOOT, elems, elemslen) == SYS_AUTH_NONE);
+    TCHECK(elemslen[SYS_CRED_TRUST] == 0 && elemslen[SYS_CRED_MYKEY] == 0);
+}
+
+// Storage fails midway through a download while the event loop waits for ring space
+static void selftest_updateWriteFail () {
+    enum { LEN = 1024*1024 };
+    u1_t* data = rt_mallocN(u1_t, LEN);
+    struct rlimit rl0, rl;
+    TCHECK(getrlimit(RLIMIT_FSIZE, &rl0) == 0);
+    void (*sig0)(int) = signal(SIGXFSZ, SIG_IGN);   // write fails with EFBIG instead
+
+    sys_updateStart(LEN);
+    rl = rl0;
+    rl.rlim_cur = 64*1024;
+    TCHECK(setrlimit(RLIMIT_FSIZE, &rl) == 0);
+    sys_updateWrite(data, 0, LEN);   // must not hang on a failed writer
+    TCHECK(sys_updateCommit(LEN) == 0);
+    TCHECK(setrlimit(RLIMIT_FSIZE, &rl0) == 0);
+    signal(SIGXFSZ, sig0);
+    struct stat st;
+    TCHECK(stat("/tmp/update.bi_", &st) == -1 && stat("/tmp/update.bin", &st) == -1);
+    rt_free(data);
+}
+
+void selftest_net () {
+    u1_t a[1024+16], b[1024+16];
+    const u1_t key[4] = { 0x81, 0x02, 0xC3, 0x7F };
+
+    for( int i=0; i<(int)sizeof(a); i++ )
+        a[i] = b[i] = i*7+3;
+    // All lengths and misalignments must agree with the bytewise reference
+    rt_lockHeap(1);
+    for( int off=0; off<16; off+=3 ) {
+        for( int len=0; len<=1024; len += (len < 64 ? 1 : 61) ) {
+            ws_mask(a+off, len, key);
+            refMask(b+off, len, key);
+            TCHECK(memcmp(a, b, sizeof(a)) == 0);
+        }
+    }
+    // Masking twice restores the payload
+    u1_t c[100];
+    memcpy(c, a, sizeof(c));
+    ws_mask(a, sizeof(c), key);
+    TCHECK(memcmp(a, c, sizeof(c)) != 0);
+    ws_mask(a, sizeof(c), key);
+    TCHECK(memcmp(a, c, sizeof(c)) == 0);
+    rt_lockHeap(0);
+
+    // Server directed backoff - only delta seconds are honored
+    char h1[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nretry-AFTER:  120\r\n\r\n";
+    char h2[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: Fri, 31 Dec 1999 23:59:59 GMT\r\n\r\n";
+    char h3[] = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n\r\n";
+    TCHECK(http_statusCode(h1) == 503);
+    TCHECK(http_findRetryAfter(h1) == 120);
+    TCHECK(http_findRetryAfter(h2) == 0);
+    TCHECK(http_findRetryAfter(h3) == 0);
+
+    selftest_cred();
+    selftest_updateWriteFail();
+
+    if( selftest_bench() ) {
+        for( int len=64; len<=16*1024; len*=2 )
+            benchMask(len);
+    }
+}
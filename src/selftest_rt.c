@@ -136,4 +136,18 @@ void selftest_rt () {
     str_t sp4 = "ms400---";
     p = sp4;
     TCHECK(rt_readSpan(&p, 0) == -1);
+
+    TCHECK(rt_randSpan(5, 5) == 5);
+    TCHECK(rt_randSpan(7, 3) == 7);
+    ustime_t lo = rt_seconds(3600), hi = 0, prev = 0;
+    for( int i=0; i<1000; i++ ) {
+        ustime_t r = rt_randSpan(rt_seconds(1), rt_seconds(3600));
+        TCHECK(r >= rt_seconds(1) && r <= rt_seconds(3600));
+        lo = min(lo, r);
+        hi = max(hi, r);
+        ustime_t b = rt_backoff(prev, rt_seconds(1), rt_seconds(30));
+        TCHECK(b >= rt_seconds(1) && b <= min(rt_seconds(30), 3*max(prev, rt_seconds(1))));
+        prev = b;
+    }
+    TCHECK(lo < rt_seconds(60) && hi > rt_seconds(3540));   // spread over range incl. above 2^31us
 }
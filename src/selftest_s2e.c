@@ -0,0 +1,397 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "selftests.h"
+#include "s2conf.h"
+#include "kwcrc.h"
+#include "s2e.h"
+
+// Model of TX placement on a gateway with NUNITS omni antennas.
+// Downlinks follow uplinks whose receiving board is skewed towards board #0.
+// Placement and execution mirror s2e_addTxjob/s2e_nextTxAction:
+//  - placement only refuses a txunit for lack of DC or collision with the ongoing TX
+//  - a frame overlapping the previous frame at TX time misses its slot and falls back to RX2
+// Legacy placement starts on the receiving board and tries others only on refusal.
+
+enum { NUNITS = 4, NDNLINKS = 20000 };
+#define RX1FREQ 868100000
+#define RX2FREQ 869525000
+
+static s2ctx_t  S;
+static ustime_t busyUntil[NUNITS];
+
+typedef struct bstats {
+    int rx1, rx2, drop;
+} bstats_t;
+
+
+static int dcBand (txjob_t* j) {
+    return j->freq == RX2FREQ ? DC_DECI : DC_CENTI;
+}
+
+static int dcOk (txjob_t* j, u1_t u) {
+    return S.region != J_EU868 || j->txtime >= S.txunits[u].dc_eu868bands[dcBand(j)];
+}
+
+static void enqueue (txjob_t* j, u1_t u) {
+    txidx_t* pidx = &S.txunits[u].head;
+    txjob_t* curr;
+    while( (curr = txq_idx2job(&S.txq, pidx[0])) != NULL && curr->txtime <= j->txtime )
+        pidx = &curr->next;
+    j->txunit = u;
+    j->next = pidx[0];
+    pidx[0] = txq_job2idx(&S.txq, j);
+}
+
+static int place (txjob_t* j, ustime_t now, int balance, u1_t alts) {
+    u1_t rxunit = j->rctx & 0xFF;
+    int first = 1;
+    while( alts ) {
+        u1_t u = 0;
+        if( balance ) {
+            u = s2e_pickTxunit(&S, j, rxunit, alts);
+        } else if( first && (alts & (1<<rxunit)) ) {
+            u = rxunit;
+        } else {
+            while( (alts & (1<<u)) == 0 )
+                u++;
+        }
+        first = 0;
+        alts &= ~(1<<u);
+        if( !dcOk(j, u) )
+            continue;
+        if( busyUntil[u] > now && j->txtime < busyUntil[u] + TX_MIN_GAP )
+            continue;
+        j->altAnts = alts;
+        enqueue(j, u);
+        return 1;
+    }
+    return 0;
+}
+
+static void toRx2 (txjob_t* j, ustime_t now, int balance, bstats_t* st) {
+    if( j->rx2freq != 0 ) {
+        j->rx2freq = 0;
+        j->txtime += rt_seconds(1);
+        j->freq = RX2FREQ;
+        j->airtime = s2e_calcDnAirTime(rps_make(SF12, BW125), j->rctx >> 8, 0, 0);
+        if( place(j, now, balance, (1<<NUNITS)-1) )
+            return;
+    }
+    st->drop += 1;
+    txq_freeJob(&S.txq, j);
+}
+
+static void execHead (u1_t u, int balance, bstats_t* st) {
+    txjob_t* j = txq_unqJob(&S.txq, &S.txunits[u].head);
+    ustime_t now = j->txtime;
+    if( j->txtime < busyUntil[u] + TX_MIN_GAP ) {
+        toRx2(j, now, balance, st);     // missed TX time - too late for other antennas
+        return;
+    }
+    if( !dcOk(j, u) ) {
+        if( !place(j, now, balance, j->altAnts) )
+            toRx2(j, now, balance, st);
+        return;
+    }
+    busyUntil[u] = j->txtime + j->airtime;
+    if( S.region == J_EU868 )
+        S.txunits[u].dc_eu868bands[dcBand(j)] = j->txtime + j->airtime * (dcBand(j) == DC_DECI ? 10 : 100);
+    if( j->rx2freq )
+        st->rx1 += 1;
+    else
+        st->rx2 += 1;
+    txq_freeJob(&S.txq, j);
+}
+
+static bstats_t simulate (ujcrc_t region, ustime_t meanGap, int balance) {
+    bstats_t st = { 0 };
+    s2e_ini(&S);
+    S.region = region;
+    memset(busyUntil, 0, sizeof(busyUntil));
+    for( int u=0; u<NUNITS; u++ ) {
+        for( int b=0; b<DC_NUM_BANDS; b++ )
+            S.txunits[u].dc_eu868bands[b] = 0;
+        for( int c=0; c<=MAX_DNCHNLS; c++ )
+            S.txunits[u].dc_perChnl[c] = USTIME_MIN;
+    }
+    srand(4711);
+    static const u1_t sfs[] = { SF7, SF7, SF7, SF7, SF8, SF8, SF9, SF9, SF10, SF12 };
+    ustime_t t = rt_seconds(10);
+    int n = 0;
+    while( 1 ) {
+        // Execute all frames due before next arrival
+        ustime_t te = USTIME_MAX;
+        u1_t ue = 0;
+        for( u1_t u=0; u<NUNITS; u++ ) {
+            txjob_t* h = txq_idx2job(&S.txq, S.txunits[u].head);
+            if( h && h->txtime < te ) {
+                te = h->txtime;
+                ue = u;
+            }
+        }
+        if( te <= t || (n == NDNLINKS && te != USTIME_MAX) ) {
+            execHead(ue, balance, &st);
+            continue;
+        }
+        if( n == NDNLINKS )
+            break;
+        txjob_t* j = txq_reserveJob(&S.txq);
+        TCHECK(j != NULL);
+        int r = rand() % 100;
+        int plen = 12 + rand() % 40;
+        j->rctx    = (r < 70 ? 0 : r < 85 ? 1 : r < 95 ? 2 : 3) | (plen << 8);  // rxunit + frame size
+        j->txtime  = t + rt_seconds(1);
+        j->freq    = RX1FREQ;
+        j->rx2freq = RX2FREQ;
+        j->airtime = s2e_calcDnAirTime(rps_make(sfs[rand() % SIZE_ARRAY(sfs)], BW125), plen, 0, 0);
+        TCHECK(txq_commitJob(&S.txq, j, 0));
+        if( !place(j, t, balance, (1<<NUNITS)-1) )
+            toRx2(j, t, balance, &st);
+        n += 1;
+        t += (ustime_t)(-log((rand()+1.0)/(RAND_MAX+2.0)) * meanGap);
+    }
+    return st;
+}
+
+
+static char evjson[1024];
+static int  evcnt;
+
+static dbuf_t test_getSendbuf (s2ctx_t* s2ctx, int minsize) {
+    dbuf_t b = { .buf = evjson, .bufsize = sizeof(evjson), .pos = 0 };
+    return b;
+}
+
+static void test_sendText (s2ctx_t* s2ctx, dbuf_t* b) {
+    TCHECK(b->pos < b->bufsize);
+    evjson[b->pos] = 0;
+    evcnt += 1;
+    b->buf = NULL;
+}
+
+static void selftest_dnlat () {
+    s2e_ini(&S);
+    S.getSendbuf = test_getSendbuf;
+    S.sendText = test_sendText;
+    s2dnlat_t* L = &S.dnlat;
+    evcnt = 0;
+
+    s2e_dnlatSample(&S, rt_millis(30), rt_millis(900), 1);
+    TCHECK(L->turn[2] == 1 && L->slack[11] == 1);
+    s2e_dnlatSample(&S, rt_millis(1100), -rt_millis(5), 1);
+    TCHECK(L->turn[12] == 1 && L->slack[0] == 1);
+    TCHECK(L->rx1cnt == 2 && L->rx1late == 1);
+    TCHECK(L->turnMax == rt_millis(1100) && L->slackMin == -rt_millis(5));
+    s2e_dnlatSample(&S, rt_millis(3000), 0, 0);     // RX2 only - no slack sample
+    TCHECK(L->turn[DNLAT_BINS-1] == 1 && L->rx1cnt == 2);
+    TCHECK(evcnt == 0 && L->rx2pref == 0);
+
+    // Sustained low slack engages RX2 preference and tells the LNS
+    int n = 1;
+    while( !L->rx2pref ) {
+        s2e_dnlatSample(&S, rt_millis(980), DNLAT_SLACK_MIN-1, 1);
+        n += 1;
+    }
+    TCHECK(n == DNLAT_RX2PREF_ON);
+    TCHECK(evcnt == 1);
+    TCHECK(strstr(evjson, "\"evcat\":\"dnlat\"") != NULL);
+    TCHECK(strstr(evjson, "\"rx2pref\":true") != NULL);
+
+    // Withdrawn once low slack samples age out
+    n = 0;
+    while( L->rx2pref ) {
+        s2e_dnlatSample(&S, rt_millis(100), rt_millis(800), 1);
+        n += 1;
+    }
+    TCHECK(n == 32 - DNLAT_RX2PREF_OFF);
+    TCHECK(evcnt == 2);
+    TCHECK(strstr(evjson, "\"rx2pref\":false") != NULL);
+    s2e_dnlatLog(&S);
+
+    // Thresholds without hysteresis are fixed up
+    u4_t off = DNLAT_RX2PREF_OFF;
+    TCHECK(s2conf_validate() == 1);
+    DNLAT_RX2PREF_OFF = DNLAT_RX2PREF_ON;
+    TCHECK(s2conf_validate() == 0 && DNLAT_RX2PREF_OFF == DNLAT_RX2PREF_ON-1);
+    DNLAT_RX2PREF_OFF = off;
+}
+
+
+// Reconnect with an unchanged router_config must not touch radio or queues
+static void selftest_rconfKeep () {
+    char m1[] = "{\"msgtype\":\"router_config\",\"region\":\"EU863\",\"MuxTime\":1000.5,\"hwspec\":\"sx1301/1\"}";
+    char m2[] = "{\"msgtype\":\"router_config\",\"region\":\"EU863\",\"MuxTime\": 2000.25,\"hwspec\":\"sx1301/1\"}";
+    char m3[] = "{\"msgtype\":\"router_config\",\"region\":\"US902\",\"MuxTime\":1000.5,\"hwspec\":\"sx1301/1\"}";
+    char copy[sizeof(m1)];
+    memcpy(copy, m1, sizeof(m1));
+    u4_t crc = s2e_rconfCrc(m1, sizeof(m1)-1);
+    TCHECK(crc != 0 && memcmp(copy, m1, sizeof(m1)) == 0);    // JSON text left intact
+    TCHECK(s2e_rconfCrc(m2, sizeof(m2)-1) == crc);
+    TCHECK(s2e_rconfCrc(m3, sizeof(m3)-1) != crc);
+
+    s2e_ini(&S);
+    S.getSendbuf = test_getSendbuf;
+    S.sendText = test_sendText;
+    S.region = J_EU868;
+    S.rconfCrc = crc;
+    txjob_t* j = txq_reserveJob(&S.txq);
+    TCHECK(j != NULL);
+    j->txtime = rt_getTime() + rt_seconds(5);
+    TCHECK(txq_commitJob(&S.txq, j, 0));
+    txidx_t head = txq_job2idx(&S.txq, j);
+    txq_insJob(&S.txq, &S.txunits[0].head, j);
+    TCHECK(s2e_onMsg(&S, m2, sizeof(m2)-1));
+    TCHECK(S.muxtime == 2000.25);
+    TCHECK(S.region == J_EU868 && S.rconfCrc == crc);
+    TCHECK(S.txunits[0].head == head);    // admitted downlink still queued
+}
+
+
+// Frames overlapping a future beacon are moved at admission time
+static void selftest_bcnGuard () {
+    s2e_ini(&S);
+    S.region = J_US915;
+    for( int dr=0; dr<4; dr++ )
+        S.dr_defs[dr] = rps_make(SF10-dr, BW125);
+    ustime_t now = rt_getTime();
+    S.bcn.txtime  = now + rt_seconds(2);
+    S.bcn.airtime = s2e_calcDnAirTime(S.dr_defs[0], 17, 0, 0);
+    ustime_t gap = (TX_PIPELINE_GAP > 0 ? TX_PIPELINE_GAP : TX_MIN_GAP) + BEACON_GUARD;
+    ustime_t bcnend = S.bcn.txtime + S.bcn.airtime + gap;
+
+    // Class A RX1 right after beacon start goes to RX2
+    txjob_t* a = txq_reserveJob(&S.txq);
+    a->txflags = TXFLAG_CLSA;
+    a->txtime  = S.bcn.txtime + rt_millis(50);
+    a->freq    = RX1FREQ;
+    a->rx2freq = RX2FREQ;
+    a->rx2dr   = 3;
+    a->len     = 12;
+    TCHECK(txq_commitJob(&S.txq, a, 0));
+    TCHECK(s2e_addTxjob(&S, a, /*initial placement*/0, now));
+    TCHECK(a->freq == RX2FREQ && a->txtime == S.bcn.txtime + rt_millis(1050));
+
+    // Class C ending just inside the guard of the 3rd next beacon is pushed back behind it
+    txjob_t* c = txq_reserveJob(&S.txq);
+    c->txflags = TXFLAG_CLSC;
+    c->len     = 12;
+    ustime_t air = s2e_calcDnAirTime(S.dr_defs[0], c->len, 0, 0);
+    c->txtime  = S.bcn.txtime + 3*BEACON_INTVL - gap - air + 1;
+    TCHECK(txq_commitJob(&S.txq, c, 0));
+    TCHECK(s2e_addTxjob(&S, c, /*initial placement*/0, now));
+    TCHECK(c->retries > 0 && c->txtime >= bcnend + 3*BEACON_INTVL);
+
+    // Same frame just clear of the guard and the beacon itself stay where they are
+    txjob_t* d = txq_reserveJob(&S.txq);
+    d->txflags = TXFLAG_CLSC;
+    d->len     = 12;
+    d->txtime  = S.bcn.txtime + BEACON_INTVL - gap - air;
+    TCHECK(txq_commitJob(&S.txq, d, 0));
+    TCHECK(s2e_addTxjob(&S, d, /*initial placement*/0, now));
+    TCHECK(d->retries == 0 && d->txtime == S.bcn.txtime + BEACON_INTVL - gap - air);
+    txjob_t* b = txq_reserveJob(&S.txq);
+    b->txflags = TXFLAG_BCN;
+    b->txtime  = S.bcn.txtime;
+    b->len     = 17;
+    TCHECK(txq_commitJob(&S.txq, b, 0));
+    TCHECK(s2e_addTxjob(&S, b, /*initial placement*/0, now));
+    TCHECK(b->txtime == S.bcn.txtime && S.txunits[0].head == txq_job2idx(&S.txq, b));
+    rt_clrTimer(&S.txunits[0].timer);
+}
+
+// Radio does not emit a frame while a follower is staged behind it. The follower's
+// DC check charged the frame tentatively - nothing must stay charged once it is abandoned.
+static void selftest_txAbandon () {
+    s2e_ini(&S);
+    S.region = J_EU868;
+    S.dc_chnlRate = 10;
+    S.txunits[0].dc_eu868bands[DC_CENTI] = 0;
+    S.txunits[0].dc_perChnl[0] = 0;
+    ustime_t pipelineGap = TX_PIPELINE_GAP;
+    TX_PIPELINE_GAP = rt_millis(4);
+
+    ustime_t now = rt_getTime();
+    txjob_t* j[2];
+    for( int i=0; i<2; i++ ) {
+        j[i] = txq_reserveJob(&S.txq);
+        TCHECK(j[i] != NULL);
+        j[i]->freq    = RX1FREQ;
+        j[i]->len     = 12;
+        j[i]->xtime   = 1;
+        j[i]->airtime = rt_millis(100);
+        j[i]->txtime  = now - TXCHECK_FUDGE - rt_millis(5) + i*(rt_millis(100) + TX_PIPELINE_GAP);
+        TCHECK(txq_commitJob(&S.txq, j[i], 0));
+    }
+    txq_insJob(&S.txq, &S.txunits[0].head, j[1]);
+    txq_insJob(&S.txq, &S.txunits[0].head, j[0]);
+    j[0]->txflags |= TXFLAG_TXING;
+    s2e_nextTxAction(&S, 0);
+    TCHECK(S.txunits[0].head == txq_job2idx(&S.txq, j[1]));   // j[0] not on air - dropped
+    TCHECK(j[1]->txflags & TXFLAG_STAGED);
+    TCHECK(S.txunits[0].dc_eu868bands[DC_CENTI] == 0);
+    TCHECK(S.txunits[0].dc_perChnl[0] == 0);
+
+    TX_PIPELINE_GAP = pipelineGap;
+    rt_clrTimer(&S.txunits[0].timer);
+}
+
+
+void selftest_s2e () {
+    selftest_dnlat();
+    selftest_rconfKeep();
+    selftest_bcnGuard();
+    selftest_txAbandon();
+
+    static const struct { ujcrc_t region; str_t name; ustime_t meanGap; } scenarios[] = {
+        { J_US915, "no DC ", rt_millis(400) },
+        { J_US915, "no DC ", rt_millis(1000) },
+        { J_EU868, "EU868 ", rt_millis(5000) },
+        { J_EU868, "EU868 ", rt_millis(15000) },
+    };
+    ustime_t balanceWindow = TX_BALANCE_WINDOW;
+    TX_BALANCE_WINDOW = rt_seconds(1);  // placement balancing is opt-in
+    for( int s=0; s<SIZE_ARRAY(scenarios); s++ ) {
+        bstats_t legacy   = simulate(scenarios[s].region, scenarios[s].meanGap, 0);
+        bstats_t balanced = simulate(scenarios[s].region, scenarios[s].meanGap, 1);
+        TCHECK(legacy.rx1+legacy.rx2+legacy.drop == NDNLINKS);
+        TCHECK(balanced.rx1+balanced.rx2+balanced.drop == NDNLINKS);
+        TCHECK(balanced.rx1 >= legacy.rx1);
+        TCHECK(balanced.drop <= legacy.drop);
+        if( selftest_bench() )
+            fprintf(stderr, "TX placement %s gap=%4dms legacy: RX1 %5.1f%% RX2 %5.1f%% drop %5.1f%%  balanced: RX1 %5.1f%% RX2 %5.1f%% drop %5.1f%%\n",
+                    scenarios[s].name, (int)(scenarios[s].meanGap/1000),
+                    100.0*legacy.rx1/NDNLINKS, 100.0*legacy.rx2/NDNLINKS, 100.0*legacy.drop/NDNLINKS,
+                    100.0*balanced.rx1/NDNLINKS, 100.0*balanced.rx2/NDNLINKS, 100.0*balanced.drop/NDNLINKS);
+    }
+    TX_BALANCE_WINDOW = balanceWindow;
+}
@@ -0,0 +1,120 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "selftests.h"
+#include "s2conf.h"
+#include "timesync.h"
+
+#define PPM ((sL_t)1000000)
+
+typedef struct simref {
+    ts_timeref_t ref;
+    sL_t         bias;   // deviation from true GPS time
+    int          off;    // no new samples
+} simref_t;
+
+static sL_t truth;   // true GPS time minus ustime
+
+
+// Synthetic reference - reports true GPS time plus a bias
+static int sampleSimref (ts_timeref_t* ref) {
+    simref_t* r = (simref_t*)ref;
+    if( r->off )
+        return 0;
+    r->ref.ustime = rt_getTime();
+    r->ref.gpstime = r->ref.ustime + truth + r->bias;
+    return 1;
+}
+
+// Concentrator time sync with a latched PPS edge at the last true GPS second
+static timesync_t ppsTimesync (sL_t xbase, ustime_t ustime) {
+    ustime_t edge = ustime - (ustime + truth) % PPM;
+    return (timesync_t){ .ustime=ustime, .xtime=xbase+ustime, .pps_xtime=xbase+edge };
+}
+
+
+void selftest_timesync () {
+    simref_t a = { .ref = { .name="a", .sample=sampleSimref, .err=  5 }, .bias=    3 };
+    simref_t b = { .ref = { .name="b", .sample=sampleSimref, .err=500 }, .bias=  300 };
+    simref_t c = { .ref = { .name="c", .sample=sampleSimref, .err= 10 }, .bias=50000 };
+
+    // References alone define GPS time - no PPS from concentrator
+    ts_iniTimesync();
+    ustime_t now = rt_getTime();
+    sL_t xbase = ts_newXtimeSession(0);
+    timesync_t sync = { .ustime=now, .xtime=xbase+now, .pps_xtime=0 };
+    ts_updateTimesync(0, 0, &sync);
+    truth = (sL_t)1300000000*PPM + 123456 - now;
+    TCHECK(ts_xtime2gpstime(sync.xtime) == 0);
+
+    TCHECK(ts_addTimeref(&a.ref));
+    TCHECK(ts_addTimeref(&b.ref));
+    TCHECK(ts_addTimeref(&c.ref));
+    ts_updateTimerefs();
+    TCHECK(a.ref.samples == 1 && c.ref.samples == 1);
+    TCHECK(c.ref.rejects == 1 && c.ref.weight == 0);   // outlier
+    TCHECK(a.ref.weight >= 99);
+    sL_t gpstime = ts_xtime2gpstime(sync.xtime);
+    TCHECK(abs(gpstime - (now + truth + a.bias)) <= 2);
+    TCHECK(ts_gpstime2xtime(0, gpstime) == sync.xtime);
+
+    // Concentrator PPS shows up - takes over and sits exactly on GPS seconds
+    timesync_t s1 = ppsTimesync(xbase, now + PPM);
+    timesync_t s2 = ppsTimesync(xbase, now + 2*PPM + PPM/3);
+    ts_updateTimesync(0, 0, &s1);
+    ts_updateTimesync(0, 0, &s2);
+    TCHECK(ts_xtime2gpstime(s2.pps_xtime) == s2.pps_xtime - xbase + truth);
+    ts_updateTimerefs();   // references must not override PPS
+    TCHECK(ts_xtime2gpstime(s2.pps_xtime) == s2.pps_xtime - xbase + truth);
+
+    // Fresh start with concentrator PPS - references label the PPS seconds (no LNS roundtrip)
+    ts_iniTimesync();
+    ts_updateTimesync(0, 0, &sync);
+    ts_updateTimesync(0, 0, &s1);
+    ts_updateTimesync(0, 0, &s2);
+    TCHECK(ts_gpstime2xtime(0, s2.pps_xtime - xbase + truth) == 0);
+    ts_updateTimerefs();
+    TCHECK(ts_xtime2gpstime(s2.pps_xtime) == s2.pps_xtime - xbase + truth);
+    TCHECK(ts_gpstime2xtime(0, s2.pps_xtime - xbase + truth) == s2.pps_xtime);
+
+    // Only a poor reference left
+    a.off = c.off = 1;
+    a.ref.ustime = c.ref.ustime = now - 2*TIMEREF_MAX_AGE;
+    ts_updateTimerefs();
+    TCHECK(a.ref.weight == 0 && b.ref.weight == 100);
+    // No fresh references at all
+    b.off = 1;
+    b.ref.ustime = now - 2*TIMEREF_MAX_AGE;
+    ts_updateTimerefs();
+    TCHECK(b.ref.weight == 0);
+
+    ts_delTimeref(&a.ref);
+    ts_delTimeref(&b.ref);
+    ts_delTimeref(&c.ref);
+    ts_iniTimesync();
+}
@@ -26,6 +26,7 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include "selftests.h"
 #include "uj.h"
 
@@ -174,6 +175,94 @@ static void test_simple_values() {
 }
 
 
+// uj_encInt/uj_encUint format digits themselves - check them against xprintf
+static void test_integers() {
+    char jsonbuf[64], ref[32];
+    ujbuf_t B = { .buf = jsonbuf, .bufsize = sizeof(jsonbuf), .pos = 0 };
+
+    static const sL_t ivals[] = { 0, -1, 1, 9, 10, -10, INT64_MIN, INT64_MIN+1, INT64_MAX };
+    for( int i=0; i<SIZE_ARRAY(ivals); i++ ) {
+        B.pos = 0;
+        uj_encInt(&B, ivals[i]);
+        TCHECK(xeos(&B) == 1);
+        snprintf(ref, sizeof(ref), "%lld", (long long)ivals[i]);
+        TCHECK(strcmp(ref, B.buf) == 0);
+    }
+    static const uL_t uvals[] = { 0, 1, 10, (uL_t)INT64_MAX+1, UINT64_MAX };
+    for( int i=0; i<SIZE_ARRAY(uvals); i++ ) {
+        B.pos = 0;
+        uj_encUint(&B, uvals[i]);
+        TCHECK(xeos(&B) == 1);
+        snprintf(ref, sizeof(ref), "%llu", (unsigned long long)uvals[i]);
+        TCHECK(strcmp(ref, B.buf) == 0);
+    }
+    B.pos = 0;
+    uj_encOpen(&B, '[');
+    uj_encInt (&B, INT64_MIN);
+    uj_encUint(&B, UINT64_MAX);
+    uj_encClose(&B, ']');
+    TCHECK(xeos(&B) == 1);
+    TCHECK(strcmp("[-9223372036854775808,18446744073709551615]", B.buf) == 0);
+
+    // Random values of all magnitudes - same text as xprintf
+    ujbuf_t R = { .buf = ref, .bufsize = sizeof(ref), .pos = 0 };
+    srand(7);
+    for( int i=0; i<100000; i++ ) {
+        uL_t v = ((uL_t)rand() << 62) ^ ((uL_t)rand() << 31) ^ (uL_t)rand();
+        v >>= rand() % 64;
+        B.pos = R.pos = 0;
+        uj_encInt(&B, (sL_t)v);
+        xprintf(&R, "%ld", (sL_t)v);
+        TCHECK(xeos(&B) == 1 && xeos(&R) == 1 && strcmp(R.buf, B.buf) == 0);
+        B.pos = R.pos = 0;
+        uj_encUint(&B, v);
+        xprintf(&R, "%lu", v);
+        TCHECK(xeos(&B) == 1 && xeos(&R) == 1 && strcmp(R.buf, B.buf) == 0);
+    }
+
+    // Truncation - never writes beyond bufsize, keeps the leading digits
+    str_t T = "-9223372036854775808";
+    for( int sz=1; sz<=strlen(T)+1; sz++ ) {
+        memset(jsonbuf, 'x', sizeof(jsonbuf));
+        B.pos = 0;
+        B.bufsize = sz;
+        uj_encInt(&B, INT64_MIN);
+        TCHECK(B.pos == min(sz, strlen(T)));
+        TCHECK(jsonbuf[sz] == 'x');
+        TCHECK(xeos(&B) == (sz > strlen(T)));
+        TCHECK(strncmp(T, B.buf, sz-1) == 0 && B.buf[min(sz-1, strlen(T))] == 0);
+    }
+    // Buffer already full - nothing added
+    B.bufsize = 4;
+    B.pos = 4;
+    memcpy(jsonbuf, "abcdx", 5);
+    uj_encUint(&B, 12345);
+    TCHECK(B.pos == 4 && memcmp(jsonbuf, "abcdx", 5) == 0);
+
+    if( selftest_bench() ) {
+        static const sL_t bvals[] = { 0, 7, -42, 868100000, -1061461, 1451649600000000LL, INT64_MIN };
+        enum { ROUNDS = 1000000 };
+        B.bufsize = R.bufsize = sizeof(jsonbuf);
+        for( int i=0; i<SIZE_ARRAY(bvals); i++ ) {
+            ustime_t t0 = rt_getTime();
+            for( int k=0; k<ROUNDS; k++ ) {
+                B.pos = 0;
+                uj_encInt(&B, bvals[i]);
+            }
+            ustime_t t1 = rt_getTime();
+            for( int k=0; k<ROUNDS; k++ ) {
+                R.pos = 0;
+                xprintf(&R, "%ld", bvals[i]);
+            }
+            ustime_t t2 = rt_getTime();
+            fprintf(stderr, "JSON int %20lld: uj_encInt %5.1f ns  xprintf %5.1f ns\n", (long long)bvals[i],
+                    (double)(t1-t0)*1000/ROUNDS, (double)(t2-t1)*1000/ROUNDS);
+        }
+    }
+}
+
+
 void selftest_ujenc () {
     test_simple_values();
+    test_integers();
 }
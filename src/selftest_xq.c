@@ -26,6 +26,7 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include "selftests.h"
 #include "xq.h"
 #include "uj.h"
@@ -45,6 +46,35 @@ static int in_queue(txq_t* txq, txidx_t q) {
     return n;
 }
 
+// Steady state of a busy scheduler: free a random queued job and commit
+// a new one on a random txunit. Compares one shared txdata area with
+// per txunit shards.
+static double benchTxq (txq_t* txq, txoff_t unitSize, int ntxunits) {
+    enum { NLIVE = 96, ROUNDS = 200000 };
+    txjob_t* live[NLIVE];
+    txq_iniShards(txq, unitSize);
+    srand(7);
+    for( int i=0; i<NLIVE; i++ ) {
+        txjob_t* j = txq_reserveJob(txq);
+        txq_reserveData(txq, 64);
+        j->len = 16 + rand() % 48;
+        TCHECK(txq_commitJob(txq, j, i % ntxunits));
+        live[i] = j;
+    }
+    ustime_t t0 = rt_getTime();
+    for( int r=0; r<ROUNDS; r++ ) {
+        int i = rand() % NLIVE;
+        txq_freeJob(txq, live[i]);
+        txjob_t* j = txq_reserveJob(txq);
+        txq_reserveData(txq, 64);
+        j->len = 16 + rand() % 48;
+        TCHECK(txq_commitJob(txq, j, rand() % ntxunits));
+        live[i] = j;
+    }
+    return (double)(rt_getTime() - t0) * 1000 / ROUNDS;
+}
+
+
 #define txq (*_txq)
 void selftest_txq () {
     txidx_t heads[1];
@@ -95,8 +125,13 @@ void selftest_txq () {
                 continue;
             memcpy(txd, data, len);
             j->len = len;
-            txq_commitJob(&txq, j);
-            TCHECK((txd && j->off != TXOFF_NIL) || (!txd && j->off == TXOFF_NIL));
+            int txunit = rand() % MAX_TXUNITS;
+            if( !txq_commitJob(&txq, j, txunit) ) {
+                j->len = 0;  // walk away from reserved job
+                continue;
+            }
+            TCHECK(j->off != TXOFF_NIL);
+            TCHECK(j->shard <= TXSHARD_OVERFLOW && (j->shard == txunit || txq.shards[txunit].size - txq.shards[txunit].inUse < len));
             // Insert somewhere along the Q
             int l = rand()%3;
             txidx_t* p = &heads[0];
@@ -143,19 +178,38 @@ void selftest_txq () {
     }
     n = in_queue(&txq, txq.freeJobs) + in_queue(&txq, heads[0]);
     TCHECK(n==MAX_TXJOBS);
-    TCHECK(txq.txdataInUse==0);
+    for( int s=0; s<=MAX_TXUNITS; s++ )
+        TCHECK(txq.shards[s].inUse==0 && txq.shards[s].njobs==0);
 
+    // A single txunit fills its own shard, spills over into the shared shard
+    // and then borrows from the shards of the other txunits
+    int njobs = 0;
     do {
         if( (j = txq_reserveJob(&txq)) == NULL )
             TFAIL("Fail");    // LCOV_EXCL_LINE
         if( txq_reserveData(&txq, 255) == NULL )
             break;
         j->len = 255;
-        txq_commitJob(&txq, j);
-    } while(1);
+        if( txq_commitJob(&txq, j, 0) ) {
+            TCHECK(njobs < txq.shards[0].size/255 ? j->shard == 0 : j->shard != 0);
+            njobs++;
+        }
+    } while( j->off != TXOFF_NIL );
+    for( int s=0; s<=MAX_TXUNITS; s++ )
+        TCHECK(txq.shards[s].size - txq.shards[s].inUse < 255);
+    TCHECK(txq_reserveData(&txq, 255) == NULL);
 
     heads[0] = TXIDX_END;
     TCHECK(NULL == txq_unqJob(&txq, &heads[0]));
+
+    if( selftest_bench() ) {
+        for( int ntxunits=1; ntxunits<=MAX_TXUNITS; ntxunits*=2 ) {
+            double shared  = benchTxq(&txq, 0, ntxunits);
+            double sharded = benchTxq(&txq, (MAX_TXDATA - TXDATA_OVERFLOW) / MAX_TXUNITS, ntxunits);
+            fprintf(stderr, "TXQ free+commit %d txunits: shared %6.1f ns/op  sharded %6.1f ns/op\n",
+                    ntxunits, shared, sharded);
+        }
+    }
     rt_free(_txq);
 }
 
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <setjmp.h>
+#include "rt.h"
 #include "selftests.h"
 
 #if defined(CFG_selftests)
@@ -45,6 +46,9 @@ static void (*const selftest_fns[])() = {
     selftest_ujenc,
     selftest_xprintf,
     selftest_fs,
+    selftest_net,
+    selftest_s2e,
+    selftest_timesync,
     NULL
 };
 
@@ -57,11 +61,18 @@ void selftest_fail (const char* expr, const char* file, int line) {
 // LCOV_EXCL_STOP
 
 
+// Microbenchmarks slow down test runs and clutter output - only on request
+int selftest_bench () {
+    return getenv("STATION_SELFTEST_BENCH") != NULL;
+}
+
+
 void selftests () {
     int i=-1;
     while( selftest_fns[++i] ) {
         if( setjmp(onfail) ) {
             fails += 1;                  // LCOV_EXCL_LINE
+            rt_lockHeap(0);              // LCOV_EXCL_LINE
         } else {
             selftest_fns[i]();
         }
@@ -49,8 +49,12 @@ extern void selftest_ujdec ();
 extern void selftest_ujenc ();
 extern void selftest_xprintf ();
 extern void selftest_fs ();
+extern void selftest_net ();
+extern void selftest_s2e ();
+extern void selftest_timesync ();
 
 void selftest_fail (const char* expr, const char* file, int line);
+int  selftest_bench ();   // run microbenchmarks? (opt-in: STATION_SELFTEST_BENCH)
 void selftests ();
 
 
@@ -78,6 +78,38 @@ static char* pendData;
 enum { UPD_CUPS=1<<FN_CUPS, UPD_TC=1<<FN_TC, UPD_ERROR=0xFF };;
 static u1_t updateState;
 
+// Identity of a file as seen by stat - used to detect changes of cached digests
+typedef struct filesig {
+    sL_t size;      // -1 if file does not exist
+    sL_t mtime;
+    sL_t ctime;
+    uL_t ino;
+} filesig_t;
+
+// Digests reported to CUPS are cached and only recomputed if files change
+typedef struct credcrc {
+    u1_t      valid;
+    u4_t      crc;
+    filesig_t sigs[FN_URI];
+} credcrc_t;
+
+enum { MAX_SIGKEYS = 8 };  // signing keys beyond this are not cached
+typedef struct sigkeycrc {
+    u1_t      valid;
+    u4_t      crc;
+    filesig_t sig;
+} sigkeycrc_t;
+
+// Contents of credential files handed out by sys_cred - reloaded only if files change
+typedef struct credfile {
+    filesig_t sig;
+    dbuf_t    data;    // zero terminated, buf==NULL if not loaded
+} credfile_t;
+
+static credcrc_t   credCrcs[nFN_CAT][FN_BOOT+1];
+static sigkeycrc_t sigkeyCrcs[MAX_SIGKEYS];
+static credfile_t  credFiles[nFN_CAT][FN_BOOT+1][FN_URI];
+
 #define categoryName(cat) (&sFN_CAT[cat*5])
 #define configFilename(cat,set,ext) (CFNS[(cat)*(nFN_SET*nFN_EXT + nFN_TAF)+((set)*nFN_EXT)+(ext)])
 #define transactionFilename(cat,taf) (CFNS[(cat)*(nFN_SET*nFN_EXT + nFN_TAF)+(nFN_SET*nFN_EXT)+(taf)])
@@ -93,6 +125,33 @@ static int sizeFile (str_t file) {
     return st.st_size;
 }
 
+static void statFile (str_t file, filesig_t* sig) {
+    struct stat st;
+    memset(sig, 0, sizeof(*sig));
+    if( file == NULL || fs_stat(file, &st) == -1 ) {
+        sig->size = -1;
+        return;
+    }
+    sig->size  = st.st_size;
+    sig->mtime = (sL_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    sig->ctime = (sL_t)st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+    sig->ino   = st.st_ino;
+}
+
+static void dropCredFile (credfile_t* cf) {
+    rt_free(cf->data.buf);
+    memset(cf, 0, sizeof(*cf));
+}
+
+static void flushConfigCaches () {
+    memset(credCrcs, 0, sizeof(credCrcs));
+    memset(sigkeyCrcs, 0, sizeof(sigkeyCrcs));
+    for( int cat=0; cat < nFN_CAT; cat++ )
+        for( int set=0; set <= FN_BOOT; set++ )
+            for( int ext=0; ext < FN_URI; ext++ )
+                dropCredFile(&credFiles[cat][set][ext]);
+}
+
 char* makeFilepath (const char* prefix, const char* suffix, char** pCachedFile, int isReadable) {
     if( pCachedFile )
         rt_free(*pCachedFile);
@@ -153,8 +212,13 @@ dbuf_t readFile (str_t file, int complain) {
         b.bufsize = b.pos = n;
         b.buf[b.bufsize] = 0;  // make it zero terminated if used as a string
     }
-    if (fd != -1)
-        fs_close(fd);
+    if( fd != -1 && fs_close(fd) == -1 && b.buf ) {
+        if( complain )
+            LOG(MOD_SYS|ERROR, "Failed to close '%s': %s", file, strerror(errno));
+        rt_free(b.buf);
+        b.buf = NULL;
+        b.bufsize = b.pos = 0;
+    }
     return b;
 }
 
@@ -193,7 +257,11 @@ int writeFile (str_t file, const char* data, int datalen) {
         LOG(MOD_SYS|CRITICAL, "Failed to write file '%s': %s", file, strerror(errno));
         err = 0;
     }
-    fs_close(fd);
+    // Buffered data is written by fs_close - it reports if this fails
+    if( fd != -1 && fs_close(fd) == -1 && err ) {
+        LOG(MOD_SYS|CRITICAL, "Failed to write file '%s': %s", file, strerror(errno));
+        err = 0;
+    }
     return err;
 }
 
@@ -441,15 +509,34 @@ void checkRollForward () {
 }
 
 
+// Returns credential data held in memory (elemslen>0) - the data stays valid
+// until the next call or until the config files are updated.
+// If a file cannot be read its name is returned instead (elemslen==0).
 int sys_cred (int cred_cat, int cred_set, str_t* elems, int* elemslen) {
     memset(elems,    0, sizeof(elems[0]   ) * SYS_CRED_NELEMS);
     memset(elemslen, 0, sizeof(elemslen[0]) * SYS_CRED_NELEMS);
     for( int ext=FN_TRUST; ext < FN_URI; ext++ ) {
         str_t fn = configFilename(cred_cat, cred_set, ext);
-        int sz = sizeFile(fn);
-        if( sz > 0 ) { // Empty file (sz==0) is treated as absent
-            elems[ext] = fn;
+        credfile_t* cf = &credFiles[cred_cat][cred_set][ext];
+        filesig_t sig;
+        statFile(fn, &sig);
+        if( sig.size <= 0 ) { // Empty file (sz==0) is treated as absent
+            dropCredFile(cf);
+            continue;
+        }
+        if( cf->data.buf == NULL || memcmp(&cf->sig, &sig, sizeof(sig)) != 0 ) {
+            dropCredFile(cf);
+            cf->data = readFile(fn, 0);
+            if( cf->data.buf == NULL || cf->data.bufsize == 0 ) {
+                dropCredFile(cf);
+                elems[ext] = fn;
+                continue;
+            }
+            cf->sig = sig;
         }
+        elems[ext] = cf->data.buf;
+        // PEM data is passed to mbedTLS including the terminating zero - DER as is
+        elemslen[ext] = cf->data.bufsize + (cf->data.buf[0] == '-' ? 1 : 0);
     }
     if( elems[SYS_CRED_TRUST] == NULL ) {
         return SYS_AUTH_NONE;
@@ -465,6 +552,12 @@ int sys_cred (int cred_cat, int cred_set, str_t* elems, int* elemslen) {
 
 
 u4_t sys_crcCred (int cred_cat, int cred_set) {
+    credcrc_t* cc = &credCrcs[cred_cat][cred_set];
+    filesig_t sigs[FN_URI];
+    for( int ext=FN_TRUST; ext < FN_URI; ext++ )
+        statFile(configFilename(cred_cat, cred_set, ext), &sigs[ext]);
+    if( cc->valid && memcmp(cc->sigs, sigs, sizeof(sigs)) == 0 )
+        return cc->crc;
     u4_t crc = 0;
     for( int ext=FN_TRUST; ext < FN_URI; ext++ ) {
         dbuf_t data = readFile(configFilename(cred_cat, cred_set, ext), 0);
@@ -474,6 +567,9 @@ u4_t sys_crcCred (int cred_cat, int cred_set) {
             crc = rt_crc32(crc, &(u1_t[]){0,0,0,0}, 4);
         rt_free(data.buf);
     }
+    cc->valid = 1;
+    cc->crc = crc;
+    memcpy(cc->sigs, sigs, sizeof(sigs));
     return crc;
 }
 
@@ -494,6 +590,7 @@ void sys_resetConfigUpdate () {
 void sys_commitConfigUpdate () {
     if( updateState == UPD_ERROR )
         return;
+    flushConfigCaches();
     for( int cat=0; cat < nFN_CAT; cat++ ) {
         if( updateState & (1<<cat) ) {
             updateConfigFiles(cat, 0);
@@ -605,17 +702,45 @@ parsing_failed:
 parsing_done:
     rt_free(pendData);
     pendData = NULL;
+    flushConfigCaches();
 }
 
 u4_t sys_crcSigkey (int key_id) {
+    sigkeycrc_t* kc = NULL;
+    filesig_t sig;
+    if( key_id >= 0 && key_id < MAX_SIGKEYS ) {
+        char path[20];
+        snprintf(path, sizeof(path), "~/sig-%d.key", key_id);
+        str_t fn = makeFilepath(path,"",NULL,0);
+        statFile(fn, &sig);
+        rt_free((void*)fn);
+        kc = &sigkeyCrcs[key_id];
+        if( kc->valid && memcmp(&kc->sig, &sig, sizeof(sig)) == 0 )
+            return kc->crc;
+    }
     u4_t crc = 0;
     dbuf_t data = sys_sigKey(key_id);
     if( data.buf )
         crc = rt_crc32(crc, data.buf, data.bufsize);
     sys_sigKey(-1); // Clear buffer
+    if( kc ) {
+        kc->valid = 1;
+        kc->crc = crc;
+        kc->sig = sig;
+    }
     return crc;
 }
 
+int sys_findSigkey (u4_t keycrc) {
+    u4_t crc;
+    int keyid = -1;
+    while( (crc = sys_crcSigkey(++keyid)) > 0 ) {
+        if( crc == keycrc )
+            return keyid;
+    }
+    return -1;
+}
+
 
 dbuf_t sys_sigKey (int key_id) {
     static dbuf_t b;
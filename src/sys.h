@@ -96,6 +96,7 @@ int    sys_execCommand (ustime_t max_wait, str_t* argv);
 
 dbuf_t sys_sigKey (int key_id);
 u4_t   sys_crcSigkey (int key_id);
+int    sys_findSigkey (u4_t keycrc);          // key_id of key with given CRC or -1
 dbuf_t sys_readFile (str_t filename);   // should this be here? - only used in sx130xconf.c
 str_t  sys_makeFilepath (str_t fn, int complain);
 
@@ -114,6 +115,7 @@ void   sys_iniWeb ();
 void   sys_stopWeb ();
 
 void   sys_keepAlive (int fd);
+void   sys_dnlocalTxed (u1_t client, dbuf_t* json);   // confirm TX of a frame submitted by a local client
 
 int    sys_getLatLon (double* lat, double* lon);
 
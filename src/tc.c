@@ -32,14 +32,45 @@
 #include "kwcrc.h"
 #include "s2e.h"
 #include "tc.h"
+#include "trace.h"
+#include "record.h"
 
 
 tc_t* TC;
 static s1_t tstateLast;
+static ustime_t connectTat;  // token bucket of handshake attempts - survives TC restarts
+
+
+// Token bucket in its GCRA form: each handshake advances a theoretical
+// arrival time by WINDOW/BURST and may run ahead of now by at most WINDOW.
+// Returns 0 if a handshake may start right away, else the time to wait.
+static ustime_t tc_admit () {
+    if( TC_CONNECT_BURST == 0 )
+        return 0;
+    ustime_t now = rt_getTime();
+    ustime_t tat = max(connectTat, now) + TC_CONNECT_WINDOW / TC_CONNECT_BURST;
+    if( tat - now > TC_CONNECT_WINDOW )
+        return tat - now - TC_CONNECT_WINDOW;
+    connectTat = tat;
+    return 0;
+}
+
+
+// Next reconnect delay - jittered, but never shorter than what the server asked for
+static ustime_t tc_backoff (tc_t* tc, ustime_t base, ustime_t cap) {
+    ustime_t delay = rt_backoff(tc->backoff, base, cap);
+    if( tc->retryAfter ) {
+        ustime_t ra = min(rt_seconds(tc->retryAfter), TC_RETRY_AFTER_MAX);
+        delay = max(delay, rt_randSpan(ra, ra + ra/4));
+        tc->retryAfter = 0;
+    }
+    return tc->backoff = delay;
+}
 
 
 static void tc_done (tc_t* tc, s1_t tstate) {
     tc->tstate = tstate;
+    tc->retryAfter = tc->ws.retryAfter;
     ws_free(&tc->ws);
     rt_yieldTo(&tc->timeout, tc->ondone);
     sys_inState(SYSIS_TC_DISCONNECTED);
@@ -58,6 +89,7 @@ static void tc_muxs_connection (conn_t* _conn, int ev) {
     if( ev == WSEV_CONNECTED ) {
         rt_clrTimer(&tc->timeout);
         tc->tstate = TC_MUXS_CONNECTED;
+        tc->connectedAt = rt_getTime();
         LOG(MOD_TCE|VERBOSE, "Connected to MUXS.");
         dbuf_t b = ws_getSendbuf(&tc->ws, MIN_UPJSON_SIZE);
         assert(b.buf != NULL);   // this should not fail on a fresh connection
@@ -71,6 +103,7 @@ static void tc_muxs_connection (conn_t* _conn, int ev) {
         uj_encKV(&b, "protocol", 'i', MUXS_PROTOCOL_VERSION);
         uj_encKV(&b, "features", 's', rt_features());
         uj_encClose(&b, '}');
+        REC(text, REC_WSTX, b.buf, b.pos);
         ws_sendText(&tc->ws, &b);
         if( tc->credset == SYS_CRED_REG )
             sys_backupConfig(SYS_CRED_TC);
@@ -84,7 +117,11 @@ static void tc_muxs_connection (conn_t* _conn, int ev) {
     }
     if( ev == WSEV_TEXTRCVD ) {
         dbuf_t b = ws_getRecvbuf(&tc->ws);
-        if( !s2e_onMsg(&tc->s2ctx, b.buf, b.bufsize) ) {
+        TRACE(WS_MSG_BEG, b.bufsize);
+        REC(text, REC_WSRX, b.buf, b.bufsize);
+        int ok = s2e_onMsg(&tc->s2ctx, b.buf, b.bufsize);
+        TRACE(WS_MSG_END, ok);
+        if( !ok ) {
             LOG(ERROR, "Closing connection to muxs - error in s2e_onMsg");
             tc->tstate = TC_ERR_FAILED;
             ws_close(&tc->ws, 1000);
@@ -103,6 +140,11 @@ static void tc_muxs_connection (conn_t* _conn, int ev) {
     if( ev == WSEV_CLOSED ) {
         s1_t tstate = tc->tstate;
         LOG(MOD_TCE|VERBOSE, "Connection to MUXS closed in state %d", tstate);
+        if( tstate == TC_MUXS_CONNECTED && rt_getTime() - tc->connectedAt >= TC_MUXS_BACKOFF_MAX ) {
+            // Connection was healthy for a while - start over with short backoffs
+            tc->retries = 0;
+            tc->backoff = 0;
+        }
         if( tstate >= 0 ) {
             // Quickly reopen muxs connection if just close else go thru infos
             tstate = tstate == TC_MUXS_CONNECTED ? TC_ERR_CLOSED : TC_ERR_FAILED;
@@ -258,6 +300,7 @@ static dbuf_t tc_getSendbuf (s2ctx_t* s2ctx, int minsize) {
 
 static void tc_sendText (s2ctx_t* s2ctx, dbuf_t* buf) {
     tc_t* tc = s2ctx2tc(s2ctx);
+    REC(text, REC_WSTX, buf->buf, buf->pos);
     ws_sendText(&tc->ws, buf);
 }
 
@@ -349,14 +392,22 @@ void tc_continue (tc_t* tc) {
         return;
     }
 
+    if( tstate == TC_INFOS_BACKOFF || tstate == TC_MUXS_BACKOFF ) {
+        ustime_t wait = tc_admit();
+        if( wait ) {
+            LOG(MOD_TCE|INFO, "Handshake rate limit reached - %s reconnect delayed by %~T",
+                tstate == TC_MUXS_BACKOFF ? "MUXS" : "INFOS", wait);
+            rt_setTimerCb(&tc->timeout, rt_micros_ahead(wait), tc->ondone);
+            return;
+        }
+    }
     if( tstate == TC_INFOS_BACKOFF ) {
-        int retries_old = tc->retries;
-        tmrcb_t ondone = tc->ondone;
-        assert(TC == tc);
-        tc_free(tc);
-        TC = tc = tc_ini(ondone);
+        // Start over with INFOS - only the connection is reset,
+        // admitted downlinks and buffered uplinks stay with the engine
+        ws_ini(&tc->ws, TC_RECV_BUFFER_SIZE, TC_SEND_BUFFER_SIZE);
+        tc->tstate = TC_INI;
+        tc->retries += 1;
         tc_start(tc);
-        tc->retries = retries_old + 1;
         return;
     }
     if( tstate == TC_MUXS_BACKOFF ) {
@@ -368,21 +419,21 @@ void tc_continue (tc_t* tc) {
     if( tc->muxsuri[0] != URI_BAD ) {
         // We have a muxs uri
         if( tc->retries <= 4 && tstate == TC_ERR_CLOSED ) {
-            // Try to reconnect with increasing backoff
-            int backoff = 1 << tc->retries;
+            // Try to reconnect with increasing, jittered backoff
+            ustime_t backoff = tc_backoff(tc, TC_MUXS_BACKOFF_BASE, TC_MUXS_BACKOFF_MAX);
             tc->tstate = TC_MUXS_BACKOFF;
-            rt_setTimerCb(&tc->timeout, rt_seconds_ahead(backoff), tc->ondone);
-            LOG(MOD_TCE|INFO, "MUXS reconnect backoff %ds (retry %d)", backoff, tc->retries);
+            rt_setTimerCb(&tc->timeout, rt_micros_ahead(backoff), tc->ondone);
+            LOG(MOD_TCE|INFO, "MUXS reconnect backoff %~T (retry %d)", backoff, tc->retries);
             return;
         }
         tc->muxsuri[0] = URI_BAD;
         tc->retries = 1;
     }
 
-    int backoff = min(tc->retries, 6);
+    ustime_t backoff = tc_backoff(tc, TC_INFOS_BACKOFF_BASE, TC_INFOS_BACKOFF_MAX);
     tc->tstate = TC_INFOS_BACKOFF;
-    rt_setTimerCb(&tc->timeout, rt_seconds_ahead(backoff * 10), tc->ondone);
-    LOG(MOD_TCE|INFO, "INFOS reconnect backoff %ds (retry %d)", backoff*10, tc->retries);
+    rt_setTimerCb(&tc->timeout, rt_micros_ahead(backoff), tc->ondone);
+    LOG(MOD_TCE|INFO, "INFOS reconnect backoff %~T (retry %d)", backoff, tc->retries);
 }
 
 
@@ -51,13 +51,19 @@ enum {
 };
 
 typedef struct tc {
+    // Connection to INFOS/MUXS - restarted on every reconnect
     ws_t     ws;          // WS connection state
     tmr_t    timeout;
     s1_t     tstate;      // state of TC engine
     u1_t     credset;     // connect via this credential set
     u1_t     retries;
+    u4_t     retryAfter;  // server requested backoff of last connection [s] (0=none)
+    ustime_t backoff;     // last reconnect delay - decorrelated jitter state
+    ustime_t connectedAt; // when MUXS connection came up
     char     muxsuri[MAX_URI_LEN+3];
     tmrcb_t  ondone;
+    // Radio engine - TX/RX queues, DC and beacon state, timesync.
+    // Lives from tc_ini until tc_free and keeps running while reconnecting.
     s2ctx_t  s2ctx;
 } tc_t;
 
@@ -32,6 +32,8 @@
 #include "tc.h"
 #include "timesync.h"
 #include "ral.h"
+#include "trace.h"
+#include "record.h"
 
 #if defined(CFG_smtcpico)
 #define _MAX_DT 300
@@ -58,6 +60,8 @@
 #define NO_PPS_ALARM_MAX     3600  // seconds
 #define XTICKS_DECAY       100000  // max age of xticks from FIFO (us)
 #define UTC_GPS_EPOCH_US 315964800 // UTC epoch expressed in s since GPS epoch
+#define MAX_TIMEREFS            4  // external time reference sources
+#define TIMEREF_AGING_PPM      20  // error growth of an aging reference sample
 
 #define ustimeRoundSecs(x) (((x) + PPM/2) / PPM * PPM)
 #define ustime2xtime(sync, _ustime) ((sync)->xtime + ((_ustime)-(sync)->ustime))
@@ -95,9 +99,15 @@ static u1_t        wsBufFull;
 static int         syncQual[N_SYNC_QUAL];
 static int         syncQual_widx;
 static int         syncQual_thres;  // current threshold
+static ts_timeref_t* timerefs[MAX_TIMEREFS];
+static int         n_timerefs;
+static tmr_t       timerefTmr;       // sample external time references
+static u1_t        refSync;          // ppsSync/gpsOffset derived from time references - not a PPS edge
+static ustime_t    refErr;           // error estimate of last combined time references, 0=none
 
 // Fwd decl
 static void onTimesyncLns (tmr_t* tmr);
+static void onTimeref (tmr_t* tmr);
 
 
 static void timesyncReport (int force) {
@@ -110,6 +120,12 @@ static void timesyncReport (int force) {
         now, rt_ustime2utc(now),  gpsOffset, ppsOffset, syncQual[0]);
     LOG(MOD_SYN|INFO, "Time sync: MCU/SX130X#0 ustime=0x%012lX xtime=0x%lX pps_ustime=0x%lX pps_xtime=0x%lX",
         timesyncs[0].ustime, timesyncs[0].xtime, pps_ustime, timesyncs[0].pps_xtime);
+    for( int i=0; i<n_timerefs; i++ ) {
+        ts_timeref_t* ref = timerefs[i];
+        LOG(MOD_SYN|INFO, "Time ref:  %-12s err=%ldus age=%~T weight=%d%% samples=%u rejects=%u%s",
+            ref->name, ref->err, ref->ustime ? now - ref->ustime : 0, ref->weight, ref->samples, ref->rejects,
+            refSync && ref->weight ? " (in use)" : "");
+    }
     if( !ppsOffset )
         return;
     pps_ustime = xtime2ustime(&timesyncs[0], ppsSync.pps_xtime);
@@ -172,6 +188,7 @@ ustime_t ts_normalizeTimespanMCU (ustime_t timespan) {
 }
 
 ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
+    REC(timesync, txunit, quality, curr->ustime, curr->xtime, curr->pps_xtime);
     syncQual[syncQual_widx] = quality;
     syncQual_widx = (syncQual_widx + 1) % N_SYNC_QUAL;
     if( syncQual_widx == 0 ) {
@@ -184,6 +201,7 @@ ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
         syncQual_thres = max(SYNC_QUAL_GOOD, abs(thres));
     }
     if( abs(quality) > syncQual_thres ) {
+        TRACE(TS_REJECTED, quality | (txunit<<16));
         LOG(MOD_SYN|VERBOSE, "Time sync rejected: quality=%d threshold=%d", quality, syncQual_thres);
         return TIMESYNC_RADIO_INTV;
     }
@@ -282,6 +300,7 @@ ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
 
     ustime_t pps_ustime = xtime2ustime(curr, curr->pps_xtime);
     ustime_t off = pps_ustime % PPM;
+    TRACE(TS_PPS, off);
     if( syncLnsCnt == 0 ) {
         ppsOffset = off;
         syncLnsCnt = 1;
@@ -307,8 +326,12 @@ ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
     delay += off + (off < 0 ? 0 : PPM);
     // Update time reference for conversions + update GPS offset based on # of seconds passed
     // ppsSync->pps_xtime and gpsOffset are pairs related to same point in time
+    // Time references did not sit on a PPS edge - round the GPS time of the new edge instead.
     if( gpsOffset )
-        gpsOffset += ustimeRoundSecs(curr->pps_xtime - ppsSync.pps_xtime);
+        gpsOffset = refSync
+            ? ustimeRoundSecs(gpsOffset + curr->pps_xtime - ppsSync.pps_xtime)
+            : gpsOffset + ustimeRoundSecs(curr->pps_xtime - ppsSync.pps_xtime);
+    refSync = 0;
     ppsSync = *curr;
   done:
     *last = *curr;
@@ -437,6 +460,10 @@ void ts_iniTimesync () {
     sum_mcu_drifts = 0;  // 初始化MCU漂移总和
     memset(timesyncs, 0, sizeof(timesyncs));  // 清空时间同步结构
     rt_clrTimer(&syncLnsTmr);  // 清除同步LNS定时器
+    refSync = 0;
+    refErr = 0;
+    if( n_timerefs )
+        rt_yieldTo(&timerefTmr, onTimeref);  // time references restore GPS time right away
 }
 
 
@@ -473,6 +500,7 @@ static void onTimesyncLns (tmr_t* tmr) {
               NULL);
     uj_encClose(&sendbuf, '}');
     (*s2ctx->sendText)(s2ctx, &sendbuf);
+    TRACE(TS_LNS_REQ, syncLnsCnt);
     ustime_t delay = syncLnsCnt % TIMESYNC_LNS_BURST ? TIMESYNC_LNS_RETRY : TIMESYNC_LNS_PAUSE;
     syncLnsCnt += 1;
     rt_setTimer(tmr, rt_micros_ahead(delay));
@@ -491,6 +519,7 @@ void ts_setTimesyncLns (ustime_t xtime, sL_t gpstime) {
     ppsSync.pps_xtime = xtime;
     ppsSync.xtime = xtime;
     ppsSync.ustime = ustime;
+    refSync = 0;
     LOG(MOD_SYN|INFO, "Server time sync: xtime=0x%lX gpstime=0x%lX ppsOffset=%ld gpsOffset=0x%lX",
         xtime, gpstime, ppsOffset, gpsOffset);
 }
@@ -549,6 +578,132 @@ void ts_processTimesyncLns (ustime_t txtime, ustime_t rxtime, sL_t gpstime) {
     timesyncReport(1);
 }
 
+
+// --------------------------------------------------------------------------------
+//
+// External time references - GPS time without a concentrator attached GPS
+//
+// --------------------------------------------------------------------------------
+
+static void onTimeref (tmr_t* tmr) {
+    ts_updateTimerefs();
+    timesyncReport(0);
+    rt_setTimer(tmr, rt_micros_ahead(TIMEREF_POLL_INTV));
+}
+
+
+int ts_addTimeref (ts_timeref_t* ref) {
+    if( n_timerefs >= MAX_TIMEREFS ) {
+        LOG(MOD_SYN|ERROR, "Too many time references - ignoring: %s", ref->name);
+        return 0;
+    }
+    ref->ustime = 0;
+    ref->samples = ref->rejects = 0;
+    ref->weight = 0;
+    timerefs[n_timerefs++] = ref;
+    LOG(MOD_SYN|INFO, "Time reference added: %s", ref->name);
+    if( n_timerefs == 1 )
+        rt_yieldTo(&timerefTmr, onTimeref);
+    return 1;
+}
+
+
+void ts_delTimeref (ts_timeref_t* ref) {
+    for( int i=0; i<n_timerefs; i++ ) {
+        if( timerefs[i] == ref ) {
+            timerefs[i] = timerefs[--n_timerefs];
+            break;
+        }
+    }
+    if( n_timerefs == 0 ) {
+        rt_clrTimer(&timerefTmr);
+        refErr = 0;
+    }
+}
+
+
+static ustime_t timerefErr (ts_timeref_t* ref, ustime_t now) {
+    return max((ustime_t)1, ref->err + (now - ref->ustime) * TIMEREF_AGING_PPM / PPM);
+}
+
+
+// Sample all time references and combine fresh samples weighted by their errors (1/err^2).
+// Samples far off the best one are dropped. If the concentrator tracks its own PPS
+// the references only provide the GPS second label. Otherwise they define
+// GPS time directly - anchored at the current MCU/SX130X#0 time sync.
+void ts_updateTimerefs () {
+    ustime_t now = rt_getTime();
+    ts_timeref_t* best = NULL;
+    for( int i=0; i<n_timerefs; i++ ) {
+        ts_timeref_t* ref = timerefs[i];
+        if( ref->sample(ref) )
+            ref->samples += 1;
+        ref->weight = 0;
+        if( ref->ustime == 0 || now - ref->ustime > TIMEREF_MAX_AGE )
+            continue;
+        if( best == NULL || timerefErr(ref, now) < timerefErr(best, now) )
+            best = ref;
+    }
+    if( best == NULL ) {
+        if( refErr )
+            LOG(MOD_SYN|WARNING, "Lost all time references");
+        refErr = 0;
+        return;
+    }
+    sL_t     base = best->gpstime - best->ustime;
+    ustime_t berr = timerefErr(best, now);
+    double   weights[MAX_TIMEREFS] = { 0 };
+    double   wsum = 0, dsum = 0;
+    for( int i=0; i<n_timerefs; i++ ) {
+        ts_timeref_t* ref = timerefs[i];
+        if( ref->ustime == 0 || now - ref->ustime > TIMEREF_MAX_AGE )
+            continue;
+        ustime_t err = timerefErr(ref, now);
+        sL_t d = ref->gpstime - ref->ustime - base;
+        if( abs(d) > 3*(err + berr) ) {
+            ref->rejects += 1;
+            LOG(MOD_SYN|VERBOSE, "Time reference %s off by %ldus from %s - ignored", ref->name, d, best->name);
+            continue;
+        }
+        weights[i] = 1.0 / ((double)err * err);
+        wsum += weights[i];
+        dsum += weights[i] * d;
+    }
+    for( int i=0; i<n_timerefs; i++ )
+        timerefs[i]->weight = (u1_t)round(100 * weights[i] / wsum);
+    sL_t     offset = base + (sL_t)round(dsum / wsum);   // GPS time minus ustime
+    ustime_t err = (ustime_t)ceil(1.0 / sqrt(wsum));
+    if( err > TIMEREF_MAX_ERR ) {
+        if( refErr )
+            LOG(MOD_SYN|WARNING, "Time references too imprecise: %ldus (max %ldus)", err, TIMEREF_MAX_ERR);
+        refErr = 0;
+        return;
+    }
+    if( !refSync && ppsSync.pps_xtime && timesyncs[0].xtime - ppsSync.pps_xtime <= TIMEREF_MAX_AGE ) {
+        // Concentrator PPS is being tracked and is more precise - only label its seconds
+        if( !gpsOffset && err < PPM/4 && sys_modePPS != PPS_FUZZY ) {
+            gpsOffset = ustimeRoundSecs(xtime2ustime(&ppsSync, ppsSync.pps_xtime) + offset);
+            LOG(MOD_SYN|INFO, "Time reference %s labeled PPS: gpsOffset=0x%lX", best->name, gpsOffset);
+            timesyncReport(1);
+        }
+        refErr = err;
+        return;
+    }
+    sL_t xtime = ts_ustime2xtime(0, now);
+    if( xtime == 0 )
+        return;  // no SX130X time sync yet
+    if( !refSync || !refErr )
+        LOG(MOD_SYN|INFO, "GPS time from time references: best=%s err=%ldus", best->name, err);
+    ppsOffset = (PPM - offset % PPM) % PPM;
+    gpsOffset = now + offset;
+    ppsSync.pps_xtime = xtime;
+    ppsSync.xtime = xtime;
+    ppsSync.ustime = now;
+    refSync = 1;
+    refErr = err;
+}
+
+
 // --------------------------------------------------------------------------------
 //
 // Time sync health data
@@ -50,6 +50,24 @@ void     ts_setTimesyncLns (ustime_t xtime, sL_t gpstime);
 void     ts_processTimesyncLns (ustime_t txtime, ustime_t rxtime, sL_t servertime);
 void     ts_iniTimesync ();
 
+// External time reference - e.g. kernel PPS or a disciplined system clock.
+// A source reports pairs of local time and GPS time with an error estimate.
+// All fresh sources are combined weighted by their errors.
+typedef struct ts_timeref {
+    str_t    name;
+    int    (*sample) (struct ts_timeref* ref);  // 1 if a new sample was stored below
+    ustime_t ustime;    // local time of last sample (0=none)
+    sL_t     gpstime;   // GPS time at ustime
+    ustime_t err;       // estimated error of sample
+    u4_t     samples;   // samples taken
+    u4_t     rejects;   // samples dropped as outliers
+    u1_t     weight;    // share in last combined estimate (%)
+} ts_timeref_t;
+
+int      ts_addTimeref (ts_timeref_t* ref);
+void     ts_delTimeref (ts_timeref_t* ref);
+void     ts_updateTimerefs ();
+
 // ------------------------------
 // Used by RAL impl only
 sL_t ts_xticks2xtime (u4_t xticks, sL_t last_xtime);
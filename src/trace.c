@@ -0,0 +1,112 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#if defined(CFG_trace)
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+// Dump file layout (host byte order):
+//   header  : "STRC" u2:version u2:nnames u4:nrecs u4:lost sL:utcOffset
+//   names   : nnames 0-terminated strings - index is the trace id
+//   records : nrecs x trace_rec_t oldest first
+#define TRACE_MAGIC   { 'S','T','R','C' }
+#define TRACE_VERSION 1
+
+struct trace_hdr {
+    char magic[4];
+    u2_t version;
+    u2_t nnames;
+    u4_t nrecs;
+    u4_t lost;
+    sL_t utcOffset;
+};
+
+trace_rec_t trace_ring[TRACE_RING];
+u4_t        trace_widx;
+
+#define TRACE_NAME(n) #n "\0"
+static const char traceNames[] = TRACE_POINTS(TRACE_NAME);
+#undef TRACE_NAME
+
+static str_t traceFile;
+
+
+static int writeAll (int fd, const void* data, int len) {
+    const u1_t* p = data;
+    while( len > 0 ) {
+        int n = write(fd, p, len);
+        if( n <= 0 )
+            return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+
+void trace_ini (str_t file) {
+    traceFile = file;
+}
+
+
+str_t trace_file () {
+    return traceFile;
+}
+
+
+// Only uses async-signal-safe functions - may be called from a signal handler.
+int trace_dump (str_t file) {
+    if( file == NULL && (file = traceFile) == NULL )
+        return -1;
+    int fd = open(file, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP|S_IROTH);
+    if( fd == -1 )
+        return -1;
+    u4_t widx = trace_widx;
+    u4_t nrecs = widx < TRACE_RING ? widx : TRACE_RING;
+    u4_t first = (widx - nrecs) & (TRACE_RING-1);
+    struct trace_hdr hdr = {
+        .magic     = TRACE_MAGIC,
+        .version   = TRACE_VERSION,
+        .nnames    = nTRACE,
+        .nrecs     = nrecs,
+        .lost      = widx - nrecs,
+        .utcOffset = rt_utcOffset,
+    };
+    int ok = (writeAll(fd, &hdr, sizeof(hdr)) &&
+              writeAll(fd, traceNames, sizeof(traceNames)-1) &&
+              writeAll(fd, &trace_ring[first], (min(nrecs, TRACE_RING-first)) * sizeof(trace_rec_t)) &&
+              (first + nrecs <= TRACE_RING ||
+               writeAll(fd, &trace_ring[0], (first + nrecs - TRACE_RING) * sizeof(trace_rec_t))));
+    close(fd);
+    return ok ? (int)nrecs : -1;
+}
+
+#endif // defined(CFG_trace)
@@ -0,0 +1,113 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2022. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _trace_h_
+#define _trace_h_
+
+#include "rt.h"
+
+// Trace points along the RX, TX, timesync and websocket paths.
+// Names ending in _BEG/_END are paired and rendered as slices by the
+// offline converter (pysys/trace2json.py), all others as instant events.
+#define TRACE_POINTS(X)   \
+    X(AIO_WAKE)           \
+    X(RXPOLL_BEG)         \
+    X(RXPOLL_END)         \
+    X(RX_FRAME)           \
+    X(RX_ADDJOB)          \
+    X(RX_MIRROR)          \
+    X(RX_FLUSH_BEG)       \
+    X(RX_FLUSH_END)       \
+    X(RX_FILTERED)        \
+    X(RX_UPJSON)          \
+    X(WS_MSG_BEG)         \
+    X(WS_MSG_END)         \
+    X(DNMSG_BEG)          \
+    X(DNMSG_END)          \
+    X(TX_ADD)             \
+    X(TX_ACTION_BEG)      \
+    X(TX_ACTION_END)      \
+    X(TX_MISSED)          \
+    X(TX_STAGED)          \
+    X(RAL_TX_BEG)         \
+    X(RAL_TX_END)         \
+    X(TX_CHECKED)         \
+    X(TX_DONE)            \
+    X(TX_DNTXED)          \
+    X(TS_RADIO)           \
+    X(TS_REJECTED)        \
+    X(TS_PPS)             \
+    X(TS_LNS_REQ)         \
+    X(TS_LNS_RESP)        \
+    X(WS_SEND)            \
+    X(WS_FRAME_TX)        \
+    X(WS_WRITE)           \
+    X(WS_WRPEND)          \
+    X(WS_FRAME_RX)
+
+#define TRACE_ENUM(n) TRACE_##n,
+enum { TRACE_POINTS(TRACE_ENUM) nTRACE };
+#undef TRACE_ENUM
+
+#if defined(CFG_trace)
+
+enum { TRACE_RING = 1<<14 };   // must be a power of 2
+
+typedef struct trace_rec {
+    sL_t ts;     // rt_getTime() - monotonic micros
+    u4_t arg;
+    u2_t id;
+    u2_t _pad;
+} trace_rec_t;
+
+extern trace_rec_t trace_ring[TRACE_RING];
+extern u4_t        trace_widx;
+
+// Station runs a single threaded event loop - a plain index is sufficient.
+// A dump from a signal handler may see a torn record at the write position.
+static inline void trace_add (u2_t id, u4_t arg) {
+    trace_rec_t* r = &trace_ring[trace_widx & (TRACE_RING-1)];
+    r->ts  = rt_getTime();
+    r->arg = arg;
+    r->id  = id;
+    trace_widx += 1;
+}
+
+void  trace_ini  (str_t file);
+int   trace_dump (str_t file);   // async-signal-safe, file=NULL uses the path set by trace_ini
+str_t trace_file ();
+
+#define TRACE(id,arg) trace_add(TRACE_##id, (u4_t)(arg))
+
+#else // !defined(CFG_trace)
+
+#define TRACE(id,arg) ((void)0)
+
+#endif // !defined(CFG_trace)
+
+#endif // _trace_h_
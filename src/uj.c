@@ -762,14 +762,31 @@ void uj_encBool(ujbuf_t* b, int val) {
     xputs(b, val ? "true" : "false", -1);
 }
 
+// Hot path for every uplink - avoid going through xprintf
+static void addDec (ujbuf_t* b, uL_t val) {
+    char tmp[20];
+    int n = 0;
+    do {
+        tmp[n++] = '0' + val % 10;
+        val /= 10;
+    } while( val );
+    while( n > 0 )
+        addChar(b, tmp[--n]);
+}
+
 void uj_encInt(ujbuf_t* b, sL_t val) {
     anotherValue(b);
-    xprintf(b, "%ld", val);
+    if( val < 0 ) {
+        addChar(b, '-');
+        addDec(b, -(uL_t)val);
+    } else {
+        addDec(b, val);
+    }
 }
 
 void uj_encUint(ujbuf_t* b, uL_t val) {
     anotherValue(b);
-    xprintf(b, "%lu", val);
+    addDec(b, val);
 }
 
 void uj_encNum(ujbuf_t* b, double val) {
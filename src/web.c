@@ -82,12 +82,13 @@ static int web_route(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* buf) {
         path = "index.html";
         pstate->contentType = "text/html";
     }
-    *buf = sys_webFile(path);
+    dbuf_t fbuf = sys_webFile(path);
 
-    if ( buf->buf != NULL) {
-        if( buf->pos >= 4 && (rt_rlsbf4((u1_t*)buf->buf) & 0x00ffffff) == 0x088b1f ) {
+    if ( fbuf.buf != NULL) {
+        if( fbuf.pos >= 4 && (rt_rlsbf4((u1_t*)fbuf.buf) & 0x00ffffff) == 0x088b1f ) {
             pstate->contentEnc = "gzip";
         }
+        *buf = fbuf;
         return 200;
     }
 
@@ -119,14 +120,15 @@ static void web_onev (conn_t* _conn, int ev) {
         int r = 500;
         // Note: writing to respbuf overwrites hdr!
         dbuf_t respbuf = httpd_getRespbuf(hd);
-        dbuf_t fbuf = {0};
+        dbuf_t fbuf = dbuf_ini(web->scratch);
         if( !httpd_parseReqLine(&pstate, &hdr) ) {
             LOG(MOD_WEB|ERROR, "Failed to parse request header");
             r = 400;
         } else {
             r = web_route(&pstate, hd, &fbuf);
         }
-        char* path = rt_strdup(pstate.path);
+        char path[MAX_FILEPATH_LEN];
+        snprintf(path, sizeof(path), "%s", pstate.path);
         switch(r) {
         case 200:
             xprintf(&respbuf,
@@ -145,7 +147,8 @@ static void web_onev (conn_t* _conn, int ev) {
                 memcpy(respbuf.buf + respbuf.pos, fbuf.buf, fbuf.pos);
                 respbuf.pos += fbuf.pos;
             }
-            rt_free((void*)fbuf.buf);
+            if( fbuf.buf != web->scratch )
+                rt_free((void*)fbuf.buf);
             break;
         case 400:
             xprintf(&respbuf, "HTTP/1.1 400 Bad Request\r\n\r\n");
@@ -165,7 +168,6 @@ static void web_onev (conn_t* _conn, int ev) {
             xprintf(&respbuf, "HTTP/1.1 500 Internal Server Error\r\n\r\n");
             break;
         }
-        free(path);
         httpd_response(hd, &respbuf);
         break;
     }
@@ -225,7 +227,7 @@ void sys_stopWeb () {
 /* ------------------------------------------------------------------------------
  *  HTTP request handlers
  *   - return HTTP response code (OK->200, ERROR->500)
- *   - dbuf_t *b not initialized
+ *   - dbuf_t *b is preset to a scratch buffer of WEB_SCRATCH_SIZE bytes
  * ------------------------------------------------------------------------------ */
 
 int handle_api(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* b) {
@@ -236,8 +238,6 @@ int handle_version(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* b) {
     if ( pstate->method != HTTP_GET )
         return 405; // Method not allowed
 
-    b->buf = _rt_malloc(200,0);
-    b->bufsize = 200;
     uj_encOpen(b, '{');
         uj_encKV(b, "msgtype",  's', "version");
         uj_encKV(b, "firmware", 's', sys_version());
@@ -33,6 +33,8 @@
 
 #define WEB_PORT "8080"
 
+enum { WEB_SCRATCH_SIZE = 2048 };  // response buffer handed to request handlers
+
 enum {
     WEB_INI            = 0,
 
@@ -48,6 +50,7 @@ typedef struct web {
     httpd_t   hd;          // HTTPD connection state
     tmr_t     timeout;
     s1_t      wstate;      // state of web
+    char      scratch[WEB_SCRATCH_SIZE];
 } web_t;
 
 typedef struct {
@@ -75,5 +75,6 @@ void   ws_free       (ws_t*);                   // free all resources (=> ws_ini
 int    ws_connect    (ws_t*, char* host, char* port, char* uripath);
 
 int    ws_getRtt     (ws_t*, u2_t* q_80_90_95); // round trip quantiles 80/90/95% in millis
+void   ws_mask       (u1_t* buf, int len, const u1_t key[4]); // XOR payload with WS masking key
 
 #endif // _ws_h_
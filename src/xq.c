@@ -37,19 +37,36 @@
 //
 // TX jobs are not strictly FIFO and may trade places arbitrarily.
 // Txjobs are managed in single linked lists. One for free jobs and one for each
-// TX unit. Txjobs optionally have txdata attached. If a txjob is freed an
-// associated txdata section is removed and txdata is compacted immediately.
-// The remainder of txdata is always the available free data space.
+// TX unit. Txjobs optionally have txdata attached.
+// Txdata is partitioned into one shard per TX unit and a shared overflow shard
+// which takes frames if the TX unit's shard is full. If the overflow shard is full
+// as well the frame borrows space from the shard of another TX unit - thus a
+// gateway with fewer TX units than MAX_TXUNITS can still use all of txdata.
+// If a txjob is freed an
+// associated txdata section is removed and its shard is compacted immediately.
+// This only touches frames in the same shard. A txjob relocated to another
+// TX unit keeps its data where it is.
+// The remainder of each shard is always the available free data space.
 //
 
 
-void txq_ini (txq_t* txq) {
+void txq_iniShards (txq_t* txq, txoff_t unitSize) {
+    assert(unitSize*MAX_TXUNITS <= MAX_TXDATA);
     memset(txq, 0, sizeof(*txq));
     for( txidx_t i=0; i<MAX_TXJOBS; i++ ) {
         txq->txjobs[i].next = i+1;
         txq->txjobs[i].off = TXOFF_NIL;
     }
     txq->txjobs[MAX_TXJOBS-1].next = TXIDX_END;
+    for( int s=0; s<=MAX_TXUNITS; s++ ) {
+        txq->shards[s].base = s*unitSize;
+        txq->shards[s].size = s < TXSHARD_OVERFLOW ? unitSize : MAX_TXDATA - s*unitSize;
+    }
+}
+
+
+void txq_ini (txq_t* txq) {
+    txq_iniShards(txq, (MAX_TXDATA - TXDATA_OVERFLOW) / MAX_TXUNITS);
 }
 
 
@@ -130,43 +147,70 @@ txjob_t* txq_reserveJob (txq_t* txq) {
 }
 
 
+// Frame data is staged and only placed into a shard by commitJob
+// when the TX unit is known. Fails if no shard could hold maxlen bytes.
 u1_t* txq_reserveData (txq_t* txq, txoff_t maxlen) {
-    if( maxlen > MAX_TXDATA - txq->txdataInUse )
-        return NULL;  // no enough data space
-    return &txq->txdata[txq->txdataInUse];
+    if( maxlen > sizeof(txq->txstage) )
+        return NULL;
+    for( int s=0; s<=MAX_TXUNITS; s++ ) {
+        if( maxlen <= txq->shards[s].size - txq->shards[s].inUse )
+            return txq->txstage;
+    }
+    return NULL;  // no enough data space
 }
 
 
-void txq_commitJob (txq_t* txq, txjob_t*j) {
+// Place job and its staged data into the shard of txunit, the overflow shard,
+// or any other shard with enough space - in this order.
+// Returns 0 if all shards are full - job stays reserved.
+int txq_commitJob (txq_t* txq, txjob_t*j, u1_t txunit) {
     assert(j == &txq->txjobs[txq->freeJobs]);
-    assert(j->len <= MAX_TXDATA - txq->txdataInUse);
+    assert(j->len <= sizeof(txq->txstage));
     assert(j->off == TXOFF_NIL);
+    txshard_t* shard = &txq->shards[min(txunit, TXSHARD_OVERFLOW)];
+    if( j->len > shard->size - shard->inUse ) {
+        shard = &txq->shards[TXSHARD_OVERFLOW];
+        for( int s=0; j->len > shard->size - shard->inUse; s++ ) {
+            if( s == TXSHARD_OVERFLOW )
+                return 0;
+            shard = &txq->shards[s];
+        }
+    }
     // Unqueue free head
     txq->freeJobs = j->next;
     j->next = TXIDX_NIL;
-    j->off = txq->txdataInUse;
-    txq->txdataInUse += j->len;
+    j->shard = shard - txq->shards;
+    j->off = shard->base + shard->inUse;
+    memcpy(&txq->txdata[j->off], txq->txstage, j->len);
+    shard->inUse += j->len;
+    shard->jobs[shard->njobs++] = j - txq->txjobs;
+    return 1;
 }
 
 
-
-
 void txq_freeData (txq_t* txq, txjob_t* j) {
-    
-    // If job had data compactify and fix offset of jobs in any tx queues
+    // If job had data compactify its shard and fix offsets of following jobs
     txoff_t freeOff = j->off;
     if( freeOff == TXOFF_NIL )
         return;
+    txshard_t* shard = &txq->shards[j->shard];
+    txidx_t idx = j - txq->txjobs;
+    int k = 0;
+    while( shard->jobs[k] != idx ) {
+        k++;
+        assert(k < shard->njobs);
+    }
     u1_t freeLen = j->len;
-    for( txidx_t idx=0; idx<MAX_TXJOBS; idx++ ) {
-        txjob_t* fixjob = &txq->txjobs[idx];
-        if( fixjob->off != TXOFF_NIL && fixjob->off >= freeOff )
-            fixjob->off -= freeLen;
+    for( int i=k+1; i<shard->njobs; i++ ) {
+        txq->txjobs[shard->jobs[i]].off -= freeLen;
+        shard->jobs[i-1] = shard->jobs[i];
     }
+    shard->njobs -= 1;
     txoff_t freeEnd = freeOff + freeLen;
-    if( freeEnd < txq->txdataInUse )
-        memcpy(&txq->txdata[freeOff], &txq->txdata[freeEnd], txq->txdataInUse - freeEnd);
-    txq->txdataInUse -= freeLen;
+    txoff_t shardEnd = shard->base + shard->inUse;
+    if( freeEnd < shardEnd )
+        memmove(&txq->txdata[freeOff], &txq->txdata[freeEnd], shardEnd - freeEnd);
+    shard->inUse -= freeLen;
     j->off = TXOFF_NIL;
     j->len = 0;
 }
@@ -53,6 +53,7 @@ typedef struct txjob {
     txoff_t  off;      // frame start in txdata or TXOFF_NIL if none
     s2_t     txpow;    // (scaled by TXPOW_SCALE)
     u1_t     txunit;   // currently queued for this TX path
+    u1_t     shard;    // txdata shard holding the frame (see txq_t)
     u1_t     altAnts;  // alternate antennas
     u1_t     txflags;  // see TXFLAGS_* in s2e.h
     u1_t     retries;  // class C: TX attempts
@@ -61,21 +62,36 @@ typedef struct txjob {
     u1_t     rxdelay;
     u1_t     len;     // frame length
     u1_t     prio;    // priority
+    u1_t     origin;  // 0=LNS, else local client tag+1 (see dnlocal)
     u1_t     dnchnl;  // channel number (internal use only - for DC tracking)
     u1_t     dnchnl2; //   -ditto- RX2
     u1_t     addcrc;   // add CRC to Lora DN frame
     u2_t     preamble; // preamble length - if zero use default
 } txjob_t;
 
+// Area of txdata owned by one txunit (or the shared overflow area).
+// Frames are kept compacted at the start of the area.
+typedef struct txshard {
+    txoff_t base;                // start of shard in txdata
+    txoff_t size;                // size of shard
+    txoff_t inUse;               // free space from base+inUse to base+size
+    txidx_t njobs;
+    txidx_t jobs[MAX_TXJOBS];    // jobs with data in this shard - ordered by offset
+} txshard_t;
+
+enum { TXSHARD_OVERFLOW = MAX_TXUNITS };
+
 typedef struct txq {
-    txjob_t txjobs[MAX_TXJOBS];  // pool of txjobs
-    u1_t    txdata[MAX_TXDATA];  // pool for pending txdata
-    txidx_t freeJobs;            // linked list of free txjob elements
-    txoff_t txdataInUse;         // free buffer space from here to end of txdata
+    txjob_t   txjobs[MAX_TXJOBS];           // pool of txjobs
+    u1_t      txdata[MAX_TXDATA];           // pool for pending txdata
+    txshard_t shards[MAX_TXUNITS+1];        // one per txunit plus shared overflow area
+    u1_t      txstage[MAX_TXFRAME_LEN];     // frame data between reserveData and commitJob
+    txidx_t   freeJobs;                     // linked list of free txjob elements
 } txq_t;
 
 
 void     txq_ini      (txq_t* txq);
+void     txq_iniShards(txq_t* txq, txoff_t unitSize);
 txidx_t  txq_job2idx  (txq_t* txq, txjob_t* j);
 txjob_t* txq_idx2job  (txq_t* txq, txidx_t  i);
 txjob_t* txq_nextJob  (txq_t* txq, txjob_t* j);
@@ -86,7 +102,7 @@ void     txq_freeJob  (txq_t* txq, txjob_t* j);
 void     txq_freeData (txq_t* txq, txjob_t* j);
 txjob_t* txq_reserveJob  (txq_t* txq);
 u1_t*    txq_reserveData (txq_t* txq, txoff_t maxlen);
-void     txq_commitJob   (txq_t* txq, txjob_t*j);
+int      txq_commitJob   (txq_t* txq, txjob_t*j, u1_t txunit);
 
 
 typedef u2_t rxoff_t;
@@ -102,6 +118,7 @@ typedef struct rxjob {
     s1_t     snr;    // scaled SNR (*4)
     u1_t     dr;
     u1_t     len;    // frame end
+    u1_t     mirrors; // mirror copies folded into this frame
 } rxjob_t;
 
 typedef struct rxq {